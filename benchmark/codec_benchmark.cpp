@@ -0,0 +1,98 @@
+// compares deflateInit2/deflateEnd per body with the pooled thread_local
+// contexts of gzip_codec on small JSON bodies, where the init cost
+// dominates the actual compression.
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <string_view>
+
+#include "cinatra/gzip.hpp"
+
+using namespace cinatra;
+
+namespace {
+std::string make_json(size_t items) {
+  std::string json = "{\"items\":[";
+  for (size_t i = 0; i < items; i++) {
+    if (i > 0) {
+      json.append(",");
+    }
+    json.append("{\"id\":")
+        .append(std::to_string(i))
+        .append(",\"name\":\"item ")
+        .append(std::to_string(i))
+        .append("\",\"price\":")
+        .append(std::to_string(i * 3 % 100))
+        .append(".99,\"in_stock\":true}");
+  }
+  json.append("]}");
+  return json;
+}
+
+// what gzip_codec::compress did before the contexts were pooled
+bool compress_unpooled(std::string_view data, std::string &out, int level) {
+  unsigned char buf[CHUNK];
+  z_stream strm{};
+  if (deflateInit2(&strm, level, Z_DEFLATED, windowBits | GZIP_ENCODING, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    return false;
+  }
+  strm.next_in = (unsigned char *)data.data();
+  strm.avail_in = (uInt)data.length();
+  do {
+    strm.avail_out = CHUNK;
+    strm.next_out = buf;
+    if (deflate(&strm, Z_FINISH) == Z_STREAM_ERROR) {
+      deflateEnd(&strm);
+      return false;
+    }
+    out.append((char *)buf, CHUNK - strm.avail_out);
+  } while (strm.avail_out == 0);
+  return deflateEnd(&strm) == Z_OK;
+}
+
+template <typename F>
+void run(const char *name, size_t rounds, F &&f) {
+  size_t sink = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < rounds; i++) {
+    sink += f();
+  }
+  auto ns = std::chrono::duration<double, std::nano>(
+                std::chrono::steady_clock::now() - start)
+                .count();
+  printf("%-28s %8.1f ns/body (%zu)\n", name, ns / rounds, sink % 10);
+}
+
+void bench(size_t items, size_t rounds) {
+  auto json = make_json(items);
+  printf("%zu bytes of json\n", json.size());
+
+  std::string out;
+  run("  init per body", rounds, [&] {
+    out.clear();
+    compress_unpooled(json, out, Z_DEFAULT_COMPRESSION);
+    return out.size();
+  });
+
+  run("  pooled context", rounds, [&] {
+    out.clear();
+    gzip_codec::compress(json, out, Z_DEFAULT_COMPRESSION);
+    return out.size();
+  });
+
+  std::string plain;
+  run("  pooled uncompress", rounds, [&] {
+    plain.clear();
+    gzip_codec::uncompress(out, plain);
+    return plain.size();
+  });
+}
+}  // namespace
+
+int main(int argc, char **argv) {
+  size_t rounds = argc > 1 ? std::stoul(argv[1]) : 100000;
+  bench(2, rounds);
+  bench(10, rounds);
+  bench(100, rounds / 10);
+}
@@ -0,0 +1,143 @@
+// compares the linear header scan with header_index on header sets sent by
+// browsers, looking up the headers the server itself asks for.
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "cinatra/header_index.hpp"
+#include "cinatra/utils.hpp"
+
+using namespace cinatra;
+
+namespace {
+const char *chrome_request =
+    "GET /index.html HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "Connection: keep-alive\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "sec-ch-ua: \"Chromium\";v=\"118\", \"Google Chrome\";v=\"118\"\r\n"
+    "sec-ch-ua-mobile: ?0\r\n"
+    "sec-ch-ua-platform: \"Windows\"\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) "
+    "AppleWebKit/537.36 (KHTML, like Gecko) Chrome/118.0.0.0 "
+    "Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,"
+    "image/avif,image/webp,*/*;q=0.8\r\n"
+    "Sec-Fetch-Site: none\r\n"
+    "Sec-Fetch-Mode: navigate\r\n"
+    "Sec-Fetch-User: ?1\r\n"
+    "Sec-Fetch-Dest: document\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Accept-Language: en-US,en;q=0.9\r\n"
+    "Cookie: CSESSIONID=1234567890abcdef; theme=dark\r\n"
+    "\r\n";
+
+const char *firefox_request =
+    "POST /api/items HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:119.0) Gecko/20100101 "
+    "Firefox/119.0\r\n"
+    "Accept: application/json\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Referer: https://www.example.com/items\r\n"
+    "Content-Type: application/json\r\n"
+    "Content-Length: 27\r\n"
+    "Origin: https://www.example.com\r\n"
+    "DNT: 1\r\n"
+    "Connection: keep-alive\r\n"
+    "Cookie: CSESSIONID=1234567890abcdef\r\n"
+    "Sec-Fetch-Dest: empty\r\n"
+    "Sec-Fetch-Mode: cors\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "X-Requested-With: XMLHttpRequest\r\n"
+    "Pragma: no-cache\r\n"
+    "Cache-Control: no-cache\r\n"
+    "\r\n";
+
+// what parse_header, check_keep_alive and the handlers look up per request.
+const std::vector<std::string_view> lookups = {
+    "content-length", "transfer-encoding", "cookie",      "connection",
+    "upgrade",        "content-encoding",  "content-type", "range",
+    "host",           "x-requested-with",
+};
+
+struct parsed {
+  phr_header headers[64];
+  size_t num_headers = 64;
+};
+
+parsed parse(const char *request) {
+  parsed p;
+  const char *method, *path;
+  size_t method_len, path_len;
+  int minor_version;
+  phr_parse_request(request, strlen(request), &method, &method_len, &path,
+                    &path_len, &minor_version, p.headers, &p.num_headers, 0);
+  return p;
+}
+
+std::string_view linear_find(const parsed &p, std::string_view key) {
+  for (size_t i = 0; i < p.num_headers; i++) {
+    if (iequal(p.headers[i].name, p.headers[i].name_len, key.data(),
+               key.length()))
+      return {p.headers[i].value, p.headers[i].value_len};
+  }
+  return {};
+}
+
+template <typename F>
+double run(const char *name, size_t rounds, F &&f) {
+  size_t sink = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < rounds; i++) {
+    sink += f();
+  }
+  auto ns = std::chrono::duration<double, std::nano>(
+                std::chrono::steady_clock::now() - start)
+                .count();
+  printf("%-28s %8.1f ns/request (%zu)\n", name, ns / rounds, sink % 10);
+  return ns;
+}
+
+void bench(const char *name, const char *request, size_t rounds) {
+  auto p = parse(request);
+  printf("%s, %zu headers\n", name, p.num_headers);
+
+  run("  linear scan", rounds, [&] {
+    size_t len = 0;
+    for (auto key : lookups) {
+      len += linear_find(p, key).size();
+    }
+    return len;
+  });
+
+  header_index index;
+  run("  build index + lookups", rounds, [&] {
+    index.build(p.headers, p.num_headers);
+    size_t len = 0;
+    for (auto key : lookups) {
+      len += index.find(key).size();
+    }
+    return len;
+  });
+
+  index.build(p.headers, p.num_headers);
+  run("  lookups only", rounds, [&] {
+    size_t len = 0;
+    for (auto key : lookups) {
+      len += index.find(key).size();
+    }
+    return len;
+  });
+}
+}  // namespace
+
+int main(int argc, char **argv) {
+  size_t rounds = argc > 1 ? std::stoul(argv[1]) : 1000000;
+  bench("chrome navigation", chrome_request, rounds);
+  bench("firefox xhr", firefox_request, rounds);
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <string_view>
+
+#include "utils.hpp"
+
+namespace cinatra {
+// the qvalue an Accept-Encoding header gives coding, RFC 7231 section
+// 5.3.4, in thousandths: 0 when it is not acceptable. A coding that is not
+// listed gets the qvalue of "*", and identity is acceptable unless it is
+// refused explicitly.
+inline int accept_encoding_q(std::string_view header, std::string_view coding) {
+  auto parse_q = [](std::string_view params) {
+    // ";q=0.5", anything unexpected counts as 1
+    auto pos = params.find("q=");
+    if (pos == std::string_view::npos) {
+      return 1000;
+    }
+    auto value = trim(params.substr(pos + 2));
+    if (value.empty() || value[0] != '0') {
+      return 1000;
+    }
+    int q = 0;
+    int scale = 100;
+    for (size_t i = 2; i < value.size() && scale > 0; ++i, scale /= 10) {
+      if (value[i] < '0' || value[i] > '9') {
+        break;
+      }
+      q += (value[i] - '0') * scale;
+    }
+    return q;
+  };
+
+  int star = -1;
+  while (!header.empty()) {
+    size_t comma = header.find(',');
+    auto item = trim(header.substr(0, comma));
+    header.remove_prefix(comma == std::string_view::npos ? header.size()
+                                                         : comma + 1);
+
+    size_t semicolon = item.find(';');
+    auto name = trim(item.substr(0, semicolon));
+    int q = semicolon == std::string_view::npos
+                ? 1000
+                : parse_q(item.substr(semicolon + 1));
+    if (iequal(name.data(), name.size(), coding.data(), coding.size())) {
+      return q;
+    }
+    if (name == "*") {
+      star = q;
+    }
+  }
+
+  if (star >= 0) {
+    return star;
+  }
+  return coding == "identity" ? 1000 : 0;
+}
+
+inline bool accepts_encoding(std::string_view header, std::string_view coding) {
+  return accept_encoding_q(header, coding) > 0;
+}
+}  // namespace cinatra
@@ -197,6 +197,17 @@ inline async_simple::coro::Lazy<std::pair<std::error_code, size_t>> async_write(
   });
 }
 
+template <typename Socket>
+inline async_simple::coro::Lazy<std::error_code> async_wait(
+    Socket &socket, typename Socket::wait_type type) noexcept {
+  callback_awaitor<std::error_code> awaitor;
+  co_return co_await awaitor.await_resume([&](auto handler) {
+    socket.async_wait(type, [&, handler](const auto &ec) {
+      handler.set_value_then_resume(ec);
+    });
+  });
+}
+
 template <typename executor_t>
 inline async_simple::coro::Lazy<std::error_code> async_connect(
     const executor_t &executor, asio::ip::tcp::socket &socket,
@@ -0,0 +1,222 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+namespace cinatra {
+struct buffer_pool_stats {
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+  // bytes allocated through the pools, in use or cached
+  int64_t resident_bytes = 0;
+  // bytes idle in the pools' free lists
+  int64_t cached_bytes = 0;
+
+  double hit_rate() const {
+    uint64_t total = hits + misses;
+    return total == 0 ? 0 : double(hits) / total;
+  }
+};
+
+// thread local pool of request buffers in power of two size classes from
+// 1KB to 4MB. A buffer may be released on another thread than the one it
+// was acquired on, it then just moves to that thread's pool.
+class buffer_pool {
+ public:
+  static constexpr size_t min_size = 1024;
+  static constexpr size_t class_count = 13;  // 1KB .. 4MB
+
+  // nullptr once the thread's pool has been destroyed.
+  static buffer_pool *local() {
+    if (destroyed_) {
+      return nullptr;
+    }
+
+    thread_local buffer_pool pool;
+    return &pool;
+  }
+
+  // cached bytes each thread keeps at most, 16MB by default.
+  static void set_max_cached_bytes(size_t size) { max_cached_bytes_ = size; }
+
+  static buffer_pool_stats stats() {
+    std::lock_guard lock(registry_mtx());
+    buffer_pool_stats stats = retired();
+    for (auto pool : registry()) {
+      stats.hits += pool->hits_.load(std::memory_order_relaxed);
+      stats.misses += pool->misses_.load(std::memory_order_relaxed);
+      stats.resident_bytes += pool->resident_.load(std::memory_order_relaxed);
+      stats.cached_bytes += pool->cached_.load(std::memory_order_relaxed);
+    }
+    return stats;
+  }
+
+  static char *acquire(size_t size, size_t &capacity) {
+    size_t index = class_index(size);
+    if (index == class_count) {
+      capacity = size;
+      return new char[size];
+    }
+
+    capacity = min_size << index;
+    auto pool = local();
+    if (pool == nullptr) {
+      return new char[capacity];
+    }
+
+    return pool->do_acquire(index, capacity);
+  }
+
+  static void release(char *data, size_t capacity) {
+    size_t index = class_index(capacity);
+    auto pool = local();
+    if (pool == nullptr || index == class_count) {
+      delete[] data;
+      return;
+    }
+
+    pool->do_release(index, data, capacity);
+  }
+
+  ~buffer_pool() {
+    for (auto &list : free_lists_) {
+      for (auto data : list) {
+        delete[] data;
+      }
+    }
+
+    std::lock_guard lock(registry_mtx());
+    auto &pools = registry();
+    pools.erase(std::find(pools.begin(), pools.end(), this));
+    auto &stats = retired();
+    stats.hits += hits_;
+    stats.misses += misses_;
+    stats.resident_bytes += resident_ - cached_;
+    destroyed_ = true;
+  }
+
+ private:
+  buffer_pool() {
+    std::lock_guard lock(registry_mtx());
+    registry().push_back(this);
+  }
+
+  static size_t class_index(size_t size) {
+    size_t index = 0;
+    while ((min_size << index) < size) {
+      if (++index == class_count) {
+        break;
+      }
+    }
+    return index;
+  }
+
+  char *do_acquire(size_t index, size_t capacity) {
+    auto &list = free_lists_[index];
+    if (!list.empty()) {
+      char *data = list.back();
+      list.pop_back();
+      hits_.store(hits_ + 1, std::memory_order_relaxed);
+      cached_.store(cached_ - capacity, std::memory_order_relaxed);
+      return data;
+    }
+
+    misses_.store(misses_ + 1, std::memory_order_relaxed);
+    resident_.store(resident_ + capacity, std::memory_order_relaxed);
+    return new char[capacity];
+  }
+
+  void do_release(size_t index, char *data, size_t capacity) {
+    if (size_t(cached_) + capacity > max_cached_bytes_) {
+      resident_.store(resident_ - capacity, std::memory_order_relaxed);
+      delete[] data;
+      return;
+    }
+
+    free_lists_[index].push_back(data);
+    cached_.store(cached_ + capacity, std::memory_order_relaxed);
+  }
+
+  static std::mutex &registry_mtx() {
+    static std::mutex mtx;
+    return mtx;
+  }
+
+  static std::vector<buffer_pool *> &registry() {
+    static std::vector<buffer_pool *> pools;
+    return pools;
+  }
+
+  static buffer_pool_stats &retired() {
+    static buffer_pool_stats stats;
+    return stats;
+  }
+
+  inline static thread_local bool destroyed_ = false;
+  inline static std::atomic<size_t> max_cached_bytes_ = 16 * 1024 * 1024;
+
+  std::vector<char *> free_lists_[class_count];
+  // written by the owning thread only, atomic so stats() may read them.
+  std::atomic<uint64_t> hits_ = 0;
+  std::atomic<uint64_t> misses_ = 0;
+  std::atomic<int64_t> resident_ = 0;
+  std::atomic<int64_t> cached_ = 0;
+};
+
+// growable byte buffer backed by buffer_pool, resize keeps the content like
+// std::vector but never shrinks the storage, release() gives it back.
+class pooled_buffer {
+ public:
+  pooled_buffer() = default;
+  pooled_buffer(const pooled_buffer &) = delete;
+  pooled_buffer &operator=(const pooled_buffer &) = delete;
+
+  ~pooled_buffer() { release(); }
+
+  char *data() { return data_; }
+  const char *data() const { return data_; }
+
+  size_t size() const { return size_; }
+  size_t capacity() const { return capacity_; }
+  bool empty() const { return size_ == 0; }
+
+  char &operator[](size_t index) { return data_[index]; }
+  const char &operator[](size_t index) const { return data_[index]; }
+
+  void resize(size_t size) {
+    if (size <= capacity_) {
+      size_ = size;
+      return;
+    }
+
+    size_t capacity;
+    char *data = buffer_pool::acquire(size, capacity);
+    if (size_ > 0) {
+      std::memcpy(data, data_, size_);
+    }
+    release();
+    data_ = data;
+    size_ = size;
+    capacity_ = capacity;
+  }
+
+  void release() {
+    if (data_ == nullptr) {
+      return;
+    }
+
+    buffer_pool::release(data_, capacity_);
+    data_ = nullptr;
+    size_ = 0;
+    capacity_ = 0;
+  }
+
+ private:
+  char *data_ = nullptr;
+  size_t size_ = 0;
+  size_t capacity_ = 0;
+};
+}  // namespace cinatra
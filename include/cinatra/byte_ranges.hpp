@@ -0,0 +1,183 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "utils.hpp"
+
+namespace cinatra {
+// an inclusive range of bytes of a representation, RFC 7233.
+struct byte_range {
+  int64_t first;
+  int64_t last;
+
+  int64_t length() const { return last - first + 1; }
+};
+
+enum class range_result {
+  // no Range header, or one that has to be ignored: send a 200
+  none,
+  // send a 206
+  satisfiable,
+  // send a 416 with "Content-Range: bytes */size"
+  unsatisfiable,
+};
+
+// parses a "Range: bytes=..." header against a representation of size
+// bytes into ranges, clamped to the size. Overlapping and adjacent ranges
+// are coalesced in ascending order; when more than max_ranges are still
+// left the header is ignored and the whole representation is sent.
+inline range_result parse_byte_ranges(std::string_view header, int64_t size,
+                                      std::vector<byte_range> &ranges,
+                                      size_t max_ranges = 16) {
+  ranges.clear();
+  header = trim(header);
+  constexpr std::string_view unit = "bytes=";
+  if (header.size() <= unit.size() ||
+      !iequal(header.data(), unit.size(), unit.data(), unit.size())) {
+    return range_result::none;
+  }
+  header.remove_prefix(unit.size());
+
+  auto to_int = [](std::string_view str, int64_t &n) {
+    if (str.empty() || str.size() > 18) {
+      return false;
+    }
+    n = 0;
+    for (char c : str) {
+      if (c < '0' || c > '9') {
+        return false;
+      }
+      n = n * 10 + (c - '0');
+    }
+    return true;
+  };
+
+  bool syntax_ok = true;
+  while (!header.empty()) {
+    size_t comma = header.find(',');
+    auto spec = trim(header.substr(0, comma));
+    header.remove_prefix(comma == std::string_view::npos ? header.size()
+                                                         : comma + 1);
+    if (spec.empty()) {
+      // "bytes=0-1,,2-3" is allowed by the list rule
+      continue;
+    }
+
+    size_t dash = spec.find('-');
+    if (dash == std::string_view::npos) {
+      syntax_ok = false;
+      break;
+    }
+
+    int64_t first, last;
+    auto first_str = trim(spec.substr(0, dash));
+    auto last_str = trim(spec.substr(dash + 1));
+    if (first_str.empty()) {
+      // "-n", the last n bytes
+      if (!to_int(last_str, last)) {
+        syntax_ok = false;
+        break;
+      }
+      if (last > 0 && size > 0) {
+        ranges.push_back({(std::max)(size - last, int64_t(0)), size - 1});
+      }
+      continue;
+    }
+
+    if (!to_int(first_str, first)) {
+      syntax_ok = false;
+      break;
+    }
+    if (last_str.empty()) {
+      last = size - 1;
+    }
+    else if (!to_int(last_str, last) || last < first) {
+      syntax_ok = false;
+      break;
+    }
+
+    if (first < size) {
+      ranges.push_back({first, (std::min)(last, size - 1)});
+    }
+  }
+
+  if (!syntax_ok) {
+    ranges.clear();
+    return range_result::none;
+  }
+  if (ranges.empty()) {
+    return range_result::unsatisfiable;
+  }
+
+  if (ranges.size() > 1) {
+    std::sort(ranges.begin(), ranges.end(),
+              [](const byte_range &a, const byte_range &b) {
+                return a.first < b.first;
+              });
+    size_t n = 0;
+    for (size_t i = 1; i < ranges.size(); ++i) {
+      if (ranges[i].first <= ranges[n].last + 1) {
+        ranges[n].last = (std::max)(ranges[n].last, ranges[i].last);
+      }
+      else {
+        ranges[++n] = ranges[i];
+      }
+    }
+    ranges.resize(n + 1);
+  }
+
+  if (ranges.size() > max_ranges) {
+    ranges.clear();
+    return range_result::none;
+  }
+  return range_result::satisfiable;
+}
+
+// "bytes first-last/size"
+inline std::string content_range(const byte_range &range, int64_t size) {
+  std::string str = "bytes ";
+  str.append(std::to_string(range.first))
+      .append("-")
+      .append(std::to_string(range.last))
+      .append("/")
+      .append(std::to_string(size));
+  return str;
+}
+
+// the pieces of a multipart/byteranges body, the file data of the ranges
+// goes between them: parts[i], range i, ..., and the closing delimiter.
+struct byteranges_layout {
+  std::string boundary;
+  std::vector<std::string> parts;
+  std::string closing;
+  int64_t content_length = 0;
+};
+
+inline byteranges_layout make_byteranges_layout(
+    const std::vector<byte_range> &ranges, int64_t size,
+    std::string_view mime) {
+  byteranges_layout layout;
+  thread_local std::mt19937_64 gen{std::random_device{}()};
+  layout.boundary = "CINATRA_BYTERANGES_" + std::to_string(gen());
+
+  for (size_t i = 0; i < ranges.size(); ++i) {
+    std::string part = i == 0 ? "--" : "\r\n--";
+    part.append(layout.boundary)
+        .append("\r\nContent-Type: ")
+        .append(mime)
+        .append("\r\nContent-Range: ")
+        .append(content_range(ranges[i], size))
+        .append("\r\n\r\n");
+    layout.content_length += int64_t(part.size()) + ranges[i].length();
+    layout.parts.push_back(std::move(part));
+  }
+
+  layout.closing = "\r\n--" + layout.boundary + "--\r\n";
+  layout.content_length += int64_t(layout.closing.size());
+  return layout;
+}
+}  // namespace cinatra
@@ -0,0 +1,198 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <string_view>
+#include <type_traits>
+
+namespace cinatra {
+// Incremental decoder of a chunked body, RFC 9112 section 7.1. It takes the
+// bytes in pieces of any size, as they are read, and hands the chunk data
+// out in place. Only the position in the framing is kept between pieces, so
+// nothing is buffered whatever the chunk sizes are. Chunk extensions and
+// trailer fields are skipped.
+class chunked_decoder {
+ public:
+  enum class status { need_more, done, error };
+
+  // longest chunk-size line, extensions included, and all trailer fields
+  static constexpr size_t max_line_size = 4096;
+  static constexpr size_t max_trailer_size = 16 * 1024;
+
+  // calls on_data(std::string_view) with every piece of chunk data in data.
+  // consumed is how much of data was body: all of it unless the body is
+  // done, the rest is the next request then. An on_data returning false
+  // stops right behind its piece, need_more comes back with consumed short
+  // of the size of data.
+  template <typename F>
+  status feed(std::string_view data, size_t &consumed, F &&on_data) {
+    consumed = 0;
+    if (state_ == state::done) {
+      return status::done;
+    }
+    if (state_ == state::error) {
+      return status::error;
+    }
+
+    size_t i = 0;
+    while (i < data.size()) {
+      if (state_ == state::data) {
+        size_t n = (std::min)(size_t(chunk_left_), data.size() - i);
+        auto piece = data.substr(i, n);
+        i += n;
+        chunk_left_ -= n;
+        body_size_ += n;
+        if (chunk_left_ == 0) {
+          state_ = state::data_cr;
+        }
+        if constexpr (std::is_same_v<std::invoke_result_t<F, std::string_view>,
+                                     bool>) {
+          if (!on_data(piece)) {
+            consumed = i;
+            return status::need_more;
+          }
+        }
+        else {
+          on_data(piece);
+        }
+        continue;
+      }
+
+      char c = data[i++];
+      switch (state_) {
+        case state::size: {
+          int digit = hex_digit(c);
+          if (digit >= 0) {
+            // 15 digits are 2^60, more is no sensible chunk
+            if (++digits_ > 15) {
+              return fail();
+            }
+            chunk_left_ = chunk_left_ * 16 + uint64_t(digit);
+            break;
+          }
+          if (digits_ == 0) {
+            return fail();
+          }
+          if (c == '\r') {
+            state_ = state::size_lf;
+          }
+          else if (c == ';' || c == ' ' || c == '\t') {
+            state_ = state::extension;
+          }
+          else {
+            return fail();
+          }
+        } break;
+        case state::extension:
+          if (c == '\r') {
+            state_ = state::size_lf;
+          }
+          else if (++line_size_ > max_line_size) {
+            return fail();
+          }
+          break;
+        case state::size_lf:
+          if (c != '\n') {
+            return fail();
+          }
+          state_ = chunk_left_ == 0 ? state::trailer_start : state::data;
+          break;
+        case state::data_cr:
+          if (c != '\r') {
+            return fail();
+          }
+          state_ = state::data_lf;
+          break;
+        case state::data_lf:
+          if (c != '\n') {
+            return fail();
+          }
+          state_ = state::size;
+          digits_ = 0;
+          line_size_ = 0;
+          break;
+        case state::trailer_start:
+          if (c == '\r') {
+            state_ = state::last_lf;
+            break;
+          }
+          state_ = state::trailer;
+          [[fallthrough]];
+        case state::trailer:
+          if (++trailer_size_ > max_trailer_size) {
+            return fail();
+          }
+          if (c == '\r') {
+            state_ = state::trailer_lf;
+          }
+          break;
+        case state::trailer_lf:
+          if (c != '\n') {
+            return fail();
+          }
+          state_ = state::trailer_start;
+          break;
+        case state::last_lf:
+          if (c != '\n') {
+            return fail();
+          }
+          state_ = state::done;
+          consumed = i;
+          return status::done;
+        default:
+          return fail();
+      }
+    }
+
+    consumed = data.size();
+    return status::need_more;
+  }
+
+  bool done() const { return state_ == state::done; }
+
+  // the decoded size so far
+  uint64_t body_size() const { return body_size_; }
+
+  void reset() { *this = chunked_decoder{}; }
+
+ private:
+  enum class state {
+    size,
+    extension,
+    size_lf,
+    data,
+    data_cr,
+    data_lf,
+    trailer_start,
+    trailer,
+    trailer_lf,
+    last_lf,
+    done,
+    error,
+  };
+
+  static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') {
+      return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+      return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+      return c - 'A' + 10;
+    }
+    return -1;
+  }
+
+  status fail() {
+    state_ = state::error;
+    return status::error;
+  }
+
+  state state_ = state::size;
+  uint64_t chunk_left_ = 0;
+  uint64_t body_size_ = 0;
+  size_t digits_ = 0;
+  size_t line_size_ = 0;
+  size_t trailer_size_ = 0;
+};
+}  // namespace cinatra
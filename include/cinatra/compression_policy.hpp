@@ -0,0 +1,105 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "accept_encoding.hpp"
+#include "content_codec.hpp"
+#include "utils.hpp"
+
+namespace cinatra {
+// formats that are text underneath. Images, audio, video, archives and
+// fonts are compressed already and only cost cpu.
+inline bool is_compressible_mime(std::string_view mime) {
+  return mime.substr(0, 5) == "text/" ||
+         mime.find("javascript") != std::string_view::npos ||
+         mime.find("json") != std::string_view::npos ||
+         mime.find("xml") != std::string_view::npos ||
+         mime.find("wasm") != std::string_view::npos;
+}
+
+// which responses the server compresses on its own, see
+// http_server::set_compression_policy. A response is compressed when it is
+// large enough, its type is in the list, the client accepts one of the
+// codings and no Content-Encoding was set by the handler.
+struct compression_policy {
+#ifdef CINATRA_ENABLE_GZIP
+  bool enabled = true;
+#else
+  // no coding is built in without zlib, one added to codec_registry can be
+  // used when this is turned on
+  bool enabled = false;
+#endif
+  // smaller bodies hardly shrink, if at all
+  size_t min_size = 1024;
+  // media types to compress, an entry ending in '/' matches a whole top
+  // level type, "text/". Empty means is_compressible_mime.
+  std::vector<std::string> mime_types;
+  // codings from codec_registry, preferred first on equal qvalues
+  std::vector<std::string> codings = {"gzip", "deflate"};
+  codec_options options;
+
+  // whether a body of this type and size is worth compressing at all,
+  // whatever the client accepts. mime may carry parameters.
+  bool compressible(std::string_view mime, size_t size) const {
+    if (!enabled || size < min_size) {
+      return false;
+    }
+
+    mime = trim(mime.substr(0, mime.find(';')));
+    if (mime_types.empty()) {
+      return is_compressible_mime(mime);
+    }
+    for (auto &type : mime_types) {
+      if (!type.empty() && type.back() == '/') {
+        if (mime.size() > type.size() &&
+            iequal(mime.data(), type.size(), type.data(), type.size())) {
+          return true;
+        }
+      }
+      else if (iequal(mime.data(), mime.size(), type.data(), type.size())) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // looks codings up in codec_registry once, negotiate() then takes no
+  // lock. http_server does this when the policy is set; codecs added to the
+  // registry later are seen after the policy is set again.
+  void resolve() {
+    codecs.clear();
+    for (auto &coding : codings) {
+      codecs.push_back(codec_registry::instance().find(coding));
+    }
+  }
+
+  // the codec to use for a client sending accept_encoding, nullptr when it
+  // takes none of ours or the policy was not resolved. The policy keeps it
+  // alive.
+  content_codec *negotiate(std::string_view accept_encoding) const {
+    if (accept_encoding.empty()) {
+      return nullptr;
+    }
+
+    content_codec *best = nullptr;
+    int best_q = 0;
+    for (size_t i = 0; i < codecs.size() && i < codings.size(); ++i) {
+      if (codecs[i] == nullptr) {
+        continue;
+      }
+      int q = accept_encoding_q(accept_encoding, codings[i]);
+      if (q > best_q) {
+        best = codecs[i].get();
+        best_q = q;
+      }
+    }
+    return best;
+  }
+
+  // the codec of each of codings, nullptr for those the registry doesn't
+  // have; filled by resolve()
+  std::vector<std::shared_ptr<content_codec>> codecs;
+};
+}  // namespace cinatra
@@ -1,17 +1,38 @@
 #pragma once
 #include <any>
 #include <cassert>
+#include <deque>
 #include <mutex>
 #include <vector>
 
+#include "asio_util/asio_coro_util.hpp"
 #include "define.h"
 #include "http_cache.hpp"
+#include "http_date.hpp"
 #include "request.hpp"
 #include "response.hpp"
+#include "timer_wheel.hpp"
 #include "use_asio.hpp"
 #include "websocket.hpp"
 
+#if defined(__linux__)
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+#define CINATRA_HAS_SENDFILE
+#endif
+
 namespace cinatra {
+#ifdef CINATRA_HAS_SENDFILE
+// a piece of a response sent with sendfile(2): head is written as it is,
+// then count bytes of the file from offset.
+struct sendfile_part {
+  std::string head;
+  int64_t offset = 0;
+  int64_t count = 0;
+};
+#endif
+
 using http_handler = std::function<void(request &, response &)>;
 using send_ok_handler = std::function<void()>;
 using send_failed_handler = std::function<void(const std::error_code &)>;
@@ -38,9 +59,10 @@ class connection : public base_connection,
       std::string &static_dir,
       std::function<bool(request &req, response &res)> *upload_check)
       : socket_(io_service),
+        executor_wrapper_(io_service.get_executor()),
+        wheel_(asio::use_service<timer_wheel>(io_service)),
         MAX_REQ_SIZE_(max_req_size),
         KEEP_ALIVE_TIMEOUT_(keep_alive_timeout),
-        timer_(io_service),
         http_handler_(handler),
         req_(res_),
         static_dir_(static_dir),
@@ -50,6 +72,24 @@ class connection : public base_connection,
     }
 
     init_multipart_parser();
+    res_.set_date_source(&asio::use_service<http_date>(io_service));
+
+    idle_node_.owner = this;
+    idle_node_.on_expire = [](void *owner) {
+      static_cast<connection *>(owner)->on_idle_timeout();
+    };
+    ping_node_.owner = this;
+    ping_node_.on_expire = [](void *owner) {
+      static_cast<connection *>(owner)->on_ping_timeout();
+    };
+  }
+
+  // the timer nodes were unlinked by close(), on the io_context of the
+  // wheel; the last reference may be dropped on any thread.
+  ~connection() {
+#ifdef CINATRA_HAS_SENDFILE
+    close_file();
+#endif
   }
 
   void init_ssl_context(ssl_configure ssl_conf) {
@@ -148,7 +188,19 @@ class connection : public base_connection,
 
   void start() {
     req_.set_conn(this->shared_from_this());
-    do_read();
+    if constexpr (!is_ssl_) {
+      if (release_idle_buffer_) {
+        // for the non-blocking reads in read_or_release()
+        std::error_code ec;
+        socket_.non_blocking(true, ec);
+      }
+    }
+    if (enable_coro_) {
+      coro_start();
+    }
+    else {
+      do_read();
+    }
   }
 
   const std::string &static_dir() { return static_dir_; }
@@ -165,31 +217,32 @@ class connection : public base_connection,
     close();
   }
 
+  // keep-alive, header, body and websocket idle deadline, a relink in the
+  // io_context's timer wheel. A closed connection is not linked again, a
+  // late response must not leave it in the wheel.
   void reset_timer() {
-    if (!enable_timeout_)
+    if (!enable_timeout_ || has_closed_)
       return;
 
-    timer_.expires_from_now(std::chrono::seconds(KEEP_ALIVE_TIMEOUT_));
-    auto self = this->shared_from_this();
+    wheel_.add(idle_node_, std::chrono::seconds(KEEP_ALIVE_TIMEOUT_));
+  }
 
-    timer_.async_wait([self](std::error_code const &ec) {
-      if (ec) {
-        return;
-      }
+  void cancel_timer() { wheel_.remove(idle_node_); }
 
-      self->close();
-    });
-  }
+  void enable_timeout(bool enable) { enable_timeout_ = enable; }
 
-  void cancel_timer() {
-    if (!enable_timeout_)
+  void on_idle_timeout() {
+    auto self = this->weak_from_this().lock();
+    if (!self) {
       return;
+    }
 
-    std::error_code ec;
-    timer_.cancel(ec);
+    close();
   }
 
-  void enable_timeout(bool enable) { enable_timeout_ = enable; }
+  // serve requests with one coroutine per connection instead of the
+  // callback chain, should be called before start().
+  void enable_coro(bool enable) { enable_coro_ = enable; }
 
   void set_tag(std::any &&tag) { tag_ = std::move(tag); }
 
@@ -219,16 +272,38 @@ class connection : public base_connection,
     send_msg(std::move(header), std::move(msg));
   }
 
+#ifdef CINATRA_ENABLE_GZIP
+  // compresses the next chunked response with gzip while it is written,
+  // call it before write_chunked_header(). The compressed data is flushed
+  // to the peer each time flush_size bytes went in since the last flush,
+  // 0 leaves that to deflate; write_chunked_data(buf, eof, true) flushes
+  // at a point of the handler's choice. The gzip stream ends with the
+  // chunk written with eof.
+  bool enable_chunked_gzip(int level = -1, size_t flush_size = 0) {
+    gzip_flush_size_ = flush_size;
+    gzip_unflushed_ = 0;
+    return chunked_gzip_.init(level);
+  }
+#endif
+
   void write_chunked_header(std::string_view mime, bool is_range = false) {
     req_.set_http_type(content_type::chunked);
     reset_timer();
-    if (!is_range) {
-      chunked_header_ = http_chunk_header + "Content-Type: " +
-                        std::string(mime.data(), mime.length()) + "\r\n\r\n";
+    chunked_header_ = is_range ? http_range_chunk_header : http_chunk_header;
+#ifdef CINATRA_ENABLE_GZIP
+    if (chunked_gzip_.active()) {
+      chunked_header_.append("Content-Encoding: gzip\r\n");
     }
-    else {
-      chunked_header_ = http_range_chunk_header + "Content-Type: " +
-                        std::string(mime.data(), mime.length()) + "\r\n\r\n";
+#endif
+    chunked_header_.append("Content-Type: ")
+        .append(mime.data(), mime.length())
+        .append("\r\n\r\n");
+    if (pipeline_count_ > 0) {
+      stash_response(chunked_header_);
+      flush_pipeline([this] {
+        handle_chunked_header(std::error_code{});
+      });
+      return;
     }
     asio::async_write(socket(), asio::buffer(chunked_header_),
                       [self = this->shared_from_this()](
@@ -240,6 +315,13 @@ class connection : public base_connection,
   void write_ranges_header(std::string header_str) {
     reset_timer();
     chunked_header_ = std::move(header_str);  // reuse the variable
+    if (pipeline_count_ > 0) {
+      stash_response(chunked_header_);
+      flush_pipeline([this] {
+        handle_chunked_header(std::error_code{});
+      });
+      return;
+    }
     asio::async_write(socket(), asio::buffer(chunked_header_),
                       [this, self = this->shared_from_this()](
                           const std::error_code &ec, std::size_t) {
@@ -247,8 +329,37 @@ class connection : public base_connection,
                       });
   }
 
-  void write_chunked_data(std::string &&buf, bool eof) {
+  void write_chunked_data(std::string &&buf, bool eof, bool flush = false) {
     reset_timer();
+#ifdef CINATRA_ENABLE_GZIP
+    if (chunked_gzip_.active()) {
+      gzip_unflushed_ += buf.size();
+      bool sync = flush || (gzip_flush_size_ > 0 &&
+                            gzip_unflushed_ >= gzip_flush_size_);
+      std::string out;
+      if (!chunked_gzip_.compress(buf, out, sync ? Z_SYNC_FLUSH : Z_NO_FLUSH) ||
+          (eof && !chunked_gzip_.finish(out))) {
+        close();
+        return;
+      }
+      if (sync) {
+        gzip_unflushed_ = 0;
+      }
+
+      buf = std::move(out);
+      if (buf.empty() && !eof) {
+        // deflate kept all of it, ask for more without writing a chunk
+        asio::post(socket_.get_executor(),
+                   [this, self = this->shared_from_this()] {
+                     req_.set_state(data_proc_state::data_continue);
+                     call_back();
+                   });
+        return;
+      }
+    }
+#else
+    (void)flush;
+#endif
 
     std::vector<asio::const_buffer> buffers =
         res_.to_chunked_buffers(buf.data(), buf.length(), eof);
@@ -273,7 +384,9 @@ class connection : public base_connection,
                         }
 
                         call_back();
-                        if (keep_alive_) {
+                        // the next request is read once the last chunk is
+                        // out, not beside the chunks still to come
+                        if (eof && keep_alive_) {
                           do_read();
                         }
                       });
@@ -301,9 +414,52 @@ class connection : public base_connection,
                       });
   }
 
+#ifdef CINATRA_HAS_SENDFILE
+  // writes header_str, then count bytes of fd from offset with sendfile(2),
+  // so the file never passes through user space. The connection owns fd
+  // from now on. Plain tcp only.
+  void write_file(std::string header_str, int fd, int64_t offset,
+                  int64_t count) {
+    std::vector<sendfile_part> parts(1);
+    parts[0] = {std::move(header_str), offset, count};
+    write_file(std::move(parts), fd);
+  }
+
+  // the same for a response made of several pieces of fd, e.g. a
+  // multipart/byteranges one; the first head holds the header.
+  void write_file(std::vector<sendfile_part> parts, int fd) {
+    static_assert(!is_ssl_, "sendfile needs a plain tcp socket");
+    req_.set_http_type(content_type::chunked);
+    reset_timer();
+    close_file();
+    file_fd_ = fd;
+    file_parts_ = std::move(parts);
+    file_part_ = 0;
+
+    std::error_code ec;
+    socket_.native_non_blocking(true, ec);
+    if (pipeline_count_ > 0) {
+      auto &part = file_parts_[0];
+      stash_response(part.head);
+      file_offset_ = part.offset;
+      file_left_ = part.count;
+      flush_pipeline([this] {
+        send_file_data();
+      });
+      return;
+    }
+    write_file_part();
+  }
+#endif
+
+  // may be called from any thread, the write and the timer wheel belong to
+  // the connection's io_context.
   void response_now() {
-    res_.set_delay(false);
-    do_write();
+    auto self = this->shared_from_this();
+    asio::dispatch(socket_.get_executor(), [this, self] {
+      res_.set_delay(false);
+      do_write();
+    });
   }
 
   void set_multipart_begin(
@@ -317,6 +473,42 @@ class connection : public base_connection,
 
   void enable_response_time(bool enable) { res_.enable_response_time(enable); }
 
+  void set_compression_policy(const compression_policy *policy) {
+    res_.set_compression_policy(policy);
+  }
+
+  // whether the body of a request is streamed to the handler instead of
+  // being buffered, asked once its header is in.
+  void set_stream_body_check(std::function<bool(request &)> check) {
+    stream_body_check_ = std::move(check);
+  }
+
+  // called by the handler with a streamed body piece: it stays valid, and
+  // no more of the body is read, until resume_body().
+  void pause_body() { stream_paused_ = true; }
+
+  // the paused piece is consumed, the body goes on. Any thread may call it.
+  void resume_body() {
+    asio::post(socket_.get_executor(),
+               [this, self = this->shared_from_this()] {
+                 if (!stream_paused_ || has_closed_) {
+                   return;
+                 }
+                 stream_paused_ = false;
+                 feed_stream_body();
+               });
+  }
+
+  // give the read buffer back to the pool while the peer is idle.
+  void set_release_idle_buffer(bool release) {
+    release_idle_buffer_ = release;
+  }
+
+  // max responses batched into one write when requests are pipelined.
+  void set_max_pipeline_depth(size_t depth) {
+    max_pipeline_depth_ = depth == 0 ? 1 : depth;
+  }
+
   bool has_close() { return has_closed_; }
 
   response &get_res() { return res_; }
@@ -334,15 +526,233 @@ class connection : public base_connection,
 
     if (is_ssl_ && !has_shake_) {
       async_handshake();
+      return;
     }
-    else {
+
+    size_t size = read_or_release([this](const std::error_code &ec) {
+      if (ec) {
+        close();
+        return;
+      }
+
       async_read_some();
+    });
+    if (size != 0) {
+      handle_read({}, size);
+    }
+  }
+
+  // between two requests nothing is buffered. Read what the peer has sent
+  // already without blocking; if there is nothing, give the read buffer back
+  // to the thread's pool and call on_readable once the peer sends more, or
+  // with the error. Returns the bytes read. SSL streams may hold decrypted
+  // data the socket doesn't report, they only drop a buffer grown by a large
+  // request.
+  template <typename F>
+  size_t read_or_release(F &&on_readable, size_t max_size = 0) {
+    req_.shrink_buffer();
+    req_.acquire_buffer();
+    if constexpr (!is_ssl_) {
+      if (release_idle_buffer_) {
+        std::error_code ec;
+        size_t size = socket_.read_some(
+            asio::buffer(req_.buffer(),
+                         max_size == 0 ? req_.left_size() : max_size),
+            ec);
+        if (!ec) {
+          return size;
+        }
+
+        if (ec != asio::error::would_block) {
+          on_readable(ec);
+          return 0;
+        }
+
+        req_.release_buffer();
+        socket_.async_wait(
+            asio::ip::tcp::socket::wait_read,
+            [this, self = this->shared_from_this(),
+             on_readable =
+                 std::forward<F>(on_readable)](const std::error_code &ec) {
+              req_.acquire_buffer();
+              on_readable(ec);
+            });
+        return 0;
+      }
+    }
+
+    on_readable(std::error_code{});
+    return 0;
+  }
+
+  //-------------coroutine engine----------------//
+  void coro_start() {
+    // the frame lives as long as the connection serves plain requests, the
+    // only reference it holds is the one captured here.
+    coro_loop().via(&executor_wrapper_).start(
+        [self = this->shared_from_this()](auto &&) {
+        });
+  }
+
+  async_simple::coro::Lazy<void> coro_loop() {
+#ifdef CINATRA_ENABLE_SSL
+    if constexpr (is_ssl_) {
+      if (!has_shake_) {
+        auto ec = co_await asio_util::async_handshake(
+            ssl_stream_, asio::ssl::stream_base::server);
+        if (ec) {
+          close();
+          co_return;
+        }
+        has_shake_ = true;
+      }
+    }
+#endif
+
+    size_t left = 0;
+    while (!has_closed_) {
+      reset();
+      int ret = parse_status::not_complete;
+      if (left > 0) {
+        // pipelined request which has been read with the last one.
+        req_.set_current_size(left);
+        ret = req_.parse_header(0);
+      }
+      else {
+        // see read_or_release()
+        req_.shrink_buffer();
+        req_.acquire_buffer();
+        if (!is_ssl_ && release_idle_buffer_) {
+          std::error_code ec;
+          size_t size = socket_.read_some(
+              asio::buffer(req_.buffer(), req_.left_size()), ec);
+          if (ec == asio::error::would_block) {
+            req_.release_buffer();
+            ec = co_await asio_util::async_wait(
+                socket_, asio::ip::tcp::socket::wait_read);
+            req_.acquire_buffer();
+          }
+          else if (!ec) {
+            req_.update_and_expand_size(size);
+            ret = req_.parse_header(0);
+          }
+
+          if (ec) {
+            close();
+            co_return;
+          }
+        }
+      }
+
+      while (ret == parse_status::not_complete) {
+        auto [ec, size] = co_await asio_util::async_read_some(
+            socket(), asio::buffer(req_.buffer(), req_.left_size()));
+        if (ec) {
+          close();
+          co_return;
+        }
+
+        if (req_.update_and_expand_size(size)) {
+          response_back(status_type::bad_request,
+                        "The request is too long, limitation is 3M");
+          co_return;
+        }
+
+        ret = req_.parse_header(0);
+        reset_timer();
+      }
+
+      if (ret == parse_status::has_error) {
+        response_back(status_type::bad_request);
+        co_return;
+      }
+
+      check_keep_alive();
+      auto type = get_content_type();
+      req_.set_http_type(type);
+      if (is_upgrade_ ||
+          (req_.has_body() && type != content_type::string &&
+           type != content_type::unknown &&
+           type != content_type::urlencoded) ||
+          (req_.has_body() && stream_body_check_ &&
+           stream_body_check_(req_))) {
+        // websocket and streaming bodies stay with the callback engine for
+        // the rest of the connection.
+        handle_request(req_.current_size());
+        co_return;
+      }
+
+      if (req_.has_body()) {
+        if (req_.at_capacity()) {
+          response_back(status_type::bad_request,
+                        "The request is too long, limitation is 3M");
+          co_return;
+        }
+
+        if (!req_.has_recieved_all()) {
+          req_.expand_size();
+          size_t body_left = req_.total_len() - req_.current_size();
+          auto [ec, size] = co_await asio_util::async_read(
+              socket(), asio::buffer(req_.buffer(), body_left));
+          if (ec) {
+            close();
+            co_return;
+          }
+          req_.update_size(size);
+        }
+
+        if (type == content_type::urlencoded &&
+            !req_.parse_form_urlencoded()) {
+          response_back(status_type::bad_request, "form urlencoded error");
+          co_return;
+        }
+      }
+
+      if (!handle_gzip()) {
+        response_back(status_type::bad_request, "gzip uncompress error");
+        co_return;
+      }
+
+      if (req_.body_len() > 0 && !req_.check_request()) {
+        response_back(status_type::bad_request, "request check error");
+        co_return;
+      }
+
+      call_back();
+      start_lazy_handler();
+      if (res_.need_delay() ||
+          req_.get_content_type() == content_type::chunked ||
+          req_.get_state() == data_proc_state::data_error) {
+        // the handler owns the response now, e.g. delayed responses or
+        // chunked static files, the callback engine goes on from there.
+        co_return;
+      }
+
+      if (res_.has_response()) {
+        reset_timer();
+        auto [ec, size] =
+            co_await asio_util::async_write(socket(), res_.to_buffers());
+        if (ec) {
+          close();
+          co_return;
+        }
+      }
+
+      if (!keep_alive_) {
+        reset();
+        cancel_timer();
+        shutdown();
+        close();
+        co_return;
+      }
+
+      left = req_.move_pipelined_data();
     }
   }
+  //-------------coroutine engine----------------//
 
   void reset() {
-    last_transfer_ = 0;
-    len_ = 0;
+    parsed_ = false;
     req_.reset();
     res_.reset();
     reset_timer();
@@ -396,8 +806,6 @@ class connection : public base_connection,
       return;
     }
 
-    auto last_len = req_.current_size();
-    last_transfer_ = last_len;
     bool at_capacity = req_.update_and_expand_size(bytes_transferred);
     if (at_capacity) {
       response_back(status_type::bad_request,
@@ -405,7 +813,14 @@ class connection : public base_connection,
       return;
     }
 
-    int ret = req_.parse_header(len_);
+    handle_buffered_request();
+  }
+
+  // parse the request at the front of the buffer, it was either read just
+  // now or left over behind a pipelined request.
+  void handle_buffered_request() {
+    parsed_ = false;
+    int ret = req_.parse_header(0);
 
     if (ret == parse_status::has_error) {
       response_back(status_type::bad_request);
@@ -414,32 +829,40 @@ class connection : public base_connection,
 
     check_keep_alive();
     if (ret == parse_status::not_complete) {
-      do_read_head();
-    }
-    else {
-      auto total_len = req_.total_len();
-      if (bytes_transferred > total_len + 4) {
-        std::string_view str(req_.data() + len_ + total_len, 4);
-        if (str == "GET " || str == "POST") {
-          handle_pipeline(total_len, bytes_transferred);
-          return;
-        }
+      if (pipeline_count_ > 0) {
+        flush_pipeline([this] {
+          do_read_head();
+        });
+      }
+      else {
+        do_read_head();
       }
-      //				if (req_.get_method() ==
-      //"GET"&&http_cache::get().need_cache(req_.get_url())&&!http_cache::get().not_cache(req_.get_url()))
-      //{ 					handle_cache();
-      // return;
-      //				}
+      return;
+    }
 
-      req_.set_last_len(len_);
-      handle_request(bytes_transferred);
+    parsed_ = true;
+    if (pipeline_count_ > 0 &&
+        (is_upgrade_ || req_.is_chunked() || !req_.has_recieved_all())) {
+      // the batched responses must not wait for more data from the client.
+      flush_pipeline([this] {
+        handle_request(req_.current_size());
+      });
+      return;
     }
+
+    handle_request(req_.current_size());
   }
 
   void handle_request(std::size_t bytes_transferred) {
     auto type = get_content_type();
     req_.set_http_type(type);
     if (req_.has_body()) {
+      if (type == content_type::chunked ||
+          (stream_body_check_ && stream_body_check_(req_))) {
+        handle_stream_body(bytes_transferred);
+        return;
+      }
+
       switch (type) {
         case cinatra::content_type::string:
         case cinatra::content_type::websocket:
@@ -455,8 +878,7 @@ class connection : public base_connection,
         case cinatra::content_type::urlencoded:
           handle_form_urlencoded(bytes_transferred);
           break;
-        case cinatra::content_type::chunked:
-          handle_chunked(bytes_transferred);
+        default:
           break;
       }
     }
@@ -485,84 +907,6 @@ class connection : public base_connection,
     }
   }
 
-  void handle_pipeline(size_t ret, std::size_t bytes_transferred) {
-    res_.set_delay(true);
-    req_.set_last_len(len_);
-    handle_request(bytes_transferred);
-    last_transfer_ += bytes_transferred;
-    if (len_ == 0)
-      len_ = ret;
-    else
-      len_ += ret;
-
-    auto &rep_str = res_.response_str();
-    int result = 0;
-    bool head_not_complete = false;
-    bool body_not_complete = false;
-    size_t left_body_len = 0;
-    // int index = 1;
-    while (true) {
-      // std::cout << std::this_thread::get_id() << ", index: " << index <<
-      // "\n";
-      result = req_.parse_header(len_);
-      if (result == -1) {
-        return;
-      }
-
-      if (result == -2) {
-        head_not_complete = true;
-        break;
-      }
-
-      // index++;
-      auto total_len = req_.total_len();
-
-      if (total_len <= (bytes_transferred - len_)) {
-        req_.set_last_len(len_);
-        handle_request(bytes_transferred);
-      }
-
-      len_ += total_len;
-
-      if (len_ == last_transfer_) {
-        break;
-      }
-      else if (len_ > last_transfer_) {
-        auto n = len_ - last_transfer_;
-        len_ -= total_len;
-        if (n < req_.header_len()) {
-          head_not_complete = true;
-        }
-        else {
-          body_not_complete = true;
-          left_body_len = n;
-        }
-
-        break;
-      }
-    }
-
-    res_.set_delay(false);
-    asio::async_write(socket(), asio::buffer(rep_str.data(), rep_str.size()),
-                      [head_not_complete, body_not_complete, left_body_len,
-                       this, self = this->shared_from_this(),
-                       &rep_str](const std::error_code &ec, std::size_t) {
-                        rep_str.clear();
-                        if (head_not_complete) {
-                          do_read_head();
-                          return;
-                        }
-
-                        if (body_not_complete) {
-                          req_.set_left_body_size(left_body_len);
-                          do_read_body();
-                          return;
-                        }
-
-                        handle_write(ec);
-                      });
-  }
-
   void do_read_head() {
     reset_timer();
 
@@ -600,14 +944,36 @@ class connection : public base_connection,
   }
 
   void do_write() {
-    if (res_.need_delay()) {
+    if (start_lazy_handler() || res_.need_delay()) {
       return;
     }
 
     reset_timer();
 
-    std::string &rep_str = res_.response_str();
-    if (rep_str.empty()) {
+    if (has_pipelined_request()) {
+      stash_response();
+      if (pipeline_count_ < max_pipeline_depth_) {
+        pipeline_next();
+      }
+      else {
+        flush_pipeline([this] {
+          pipeline_next();
+        });
+      }
+      return;
+    }
+
+    if (pipeline_count_ > 0) {
+      // the last one goes out with the stash without being copied.
+      flush_pipeline(
+          [this] {
+            handle_write(std::error_code{});
+          },
+          res_.has_response());
+      return;
+    }
+
+    if (!res_.has_response()) {
       handle_write(std::error_code{});
       return;
     }
@@ -622,13 +988,91 @@ class connection : public base_connection,
     // res_.raw_content());
     //			}
 
-    asio::async_write(socket(), asio::buffer(rep_str.data(), rep_str.size()),
+    asio::async_write(socket(), res_.to_buffers(),
                       [this, self = this->shared_from_this()](
                           const std::error_code &ec, std::size_t) {
                         handle_write(ec);
                       });
   }
 
+  //-------------pipeline----------------//
+  // another request follows the one just answered in the buffer, only for
+  // requests whose body was read into the buffer as well.
+  bool has_pipelined_request() {
+    if (!keep_alive_ || is_upgrade_ || !parsed_) {
+      return false;
+    }
+
+    auto type = req_.get_content_type();
+    if (req_.has_body() && type != content_type::string &&
+        type != content_type::unknown && type != content_type::urlencoded) {
+      return false;
+    }
+
+    return req_.current_size() > req_.total_len();
+  }
+
+  // keep the response for the next batched write, it takes the storage of
+  // res_ along; the stashes keep their capacity for later responses.
+  void stash_response() { res_.stash(next_stash()); }
+
+  // str stays alive and unchanged until the batch has been written.
+  void stash_response(std::string_view str) {
+    auto &rep = next_stash();
+    rep.owner = nullptr;
+    rep.buffers.clear();
+    rep.buffers.push_back(asio::buffer(str));
+  }
+
+  stashed_response &next_stash() {
+    if (pipeline_count_ == pipeline_reps_.size()) {
+      pipeline_reps_.emplace_back();
+    }
+
+    return pipeline_reps_[pipeline_count_++];
+  }
+
+  void pipeline_next() {
+    size_t left = req_.move_pipelined_data();
+    reset();
+    req_.set_current_size(left);
+    handle_buffered_request();
+  }
+
+  // with_response also writes the current response after the stash.
+  template <typename F>
+  void flush_pipeline(F &&next, bool with_response = false) {
+    pipeline_buffers_.clear();
+    for (size_t i = 0; i < pipeline_count_; ++i) {
+      auto &buffers = pipeline_reps_[i].buffers;
+      pipeline_buffers_.insert(pipeline_buffers_.end(), buffers.begin(),
+                               buffers.end());
+    }
+    if (with_response) {
+      auto &buffers = res_.to_buffers();
+      pipeline_buffers_.insert(pipeline_buffers_.end(), buffers.begin(),
+                               buffers.end());
+    }
+
+    asio::async_write(
+        socket(), pipeline_buffers_,
+        [this, self = this->shared_from_this(),
+         next = std::forward<F>(next)](const std::error_code &ec,
+                                       std::size_t) mutable {
+          for (size_t i = 0; i < pipeline_count_; ++i) {
+            pipeline_reps_[i].owner = nullptr;
+          }
+          pipeline_count_ = 0;
+          if (ec) {
+            close();
+            return;
+          }
+
+          next();
+        });
+  }
+  //-------------pipeline----------------//
+
   void handle_write(const std::error_code &ec) {
     if (ec) {
       return;
@@ -649,7 +1093,7 @@ class connection : public base_connection,
     if (req_.is_chunked())
       return content_type::chunked;
 
-    auto content_type = req_.get_header_value("content-type");
+    auto content_type = req_.get_header_value(http_header::content_type);
     if (!content_type.empty()) {
       if (content_type.find("application/x-www-form-urlencoded") !=
           std::string_view::npos) {
@@ -684,10 +1128,17 @@ class connection : public base_connection,
     }
 
     req_.close_upload_file();
+#ifdef CINATRA_HAS_SENDFILE
+    close_file();
+#endif
+#ifdef CINATRA_ENABLE_GZIP
+    chunked_gzip_.release();
+#endif
     shutdown();
     std::error_code ec;
     socket_.close(ec);
-    timer_.cancel();
+    wheel_.remove(idle_node_);
+    wheel_.remove(ping_node_);
     if (quit_callback_) {
       quit_callback_(conn_id_);
     }
@@ -850,16 +1301,63 @@ class connection : public base_connection,
   }
   //-------------form urlencoded----------------//
 
-  void call_back() {
+  // true when the handler is a coroutine. It is started by
+  // start_lazy_handler() once the request is complete, a coroutine made for
+  // a piece of the body or an error is dropped unstarted.
+  bool call_back() {
     assert(http_handler_);
     http_handler_(req_, res_);
+    if (!req_.has_lazy_handler()) {
+      return false;
+    }
+
+    auto state = req_.get_state();
+    if (state == data_proc_state::data_continue ||
+        state == data_proc_state::data_error ||
+        state == data_proc_state::data_close) {
+      req_.take_lazy_handler();
+    }
+    return true;
   }
 
-  void call_back_data() {
-    req_.set_state(data_proc_state::data_continue);
-    call_back();
-    req_.set_part_data({});
+  bool start_lazy_handler() {
+    auto lazy = req_.take_lazy_handler();
+    if (!lazy) {
+      return false;
+    }
+    run_lazy_handler(std::move(*lazy));
+    return true;
+  }
+
+  // a handler returning Lazy<void> runs on the io_context of the
+  // connection, which serves other connections while it is suspended. Its
+  // response is delayed until it is done.
+  void run_lazy_handler(async_simple::coro::Lazy<void> lazy) {
+    res_.set_delay(true);
+    reset_timer();
+    // via() schedules the start, so it never completes inside do_write()
+    std::move(lazy).via(&executor_wrapper_).start(
+        [this, self = this->shared_from_this()](async_simple::Try<void> &&r) {
+          if (has_closed_) {
+            return;
+          }
+          if (r.hasError()) {
+            try {
+              std::rethrow_exception(r.getException());
+            } catch (const std::exception &ex) {
+              res_.set_status_and_content(
+                  status_type::internal_server_error,
+                  ex.what() + std::string(" exception in business function"));
+            } catch (...) {
+              res_.set_status_and_content(
+                  status_type::internal_server_error,
+                  "unknown exception in business function");
+            }
+          }
+          response_now();
+        });
   }
+
   //-------------multipart----------------------//
   void init_multipart_parser() {
     multipart_parser_.on_part_begin = [this](const multipart_headers &headers) {
@@ -1092,7 +1590,7 @@ class connection : public base_connection,
     res.add_header("Connection", "Upgrade");
     res.add_header("Sec-WebSocket-Accept", std::string(accept_key, 28));
     // res.add_header("content-length", "0");
-    auto protocal_str = req.get_header_value("sec-websocket-protocol");
+    auto protocal_str = req.get_header_value(http_header::sec_websocket_protocol);
     if (!protocal_str.empty()) {
       res.add_header("Sec-WebSocket-Protocol",
                      {protocal_str.data(), protocal_str.length()});
@@ -1100,7 +1598,7 @@ class connection : public base_connection,
   }
 
   void response_handshake() {
-    std::vector<asio::const_buffer> buffers = res_.to_buffers();
+    auto &buffers = res_.to_buffers();
     if (buffers.empty()) {
       close();
       return;
@@ -1118,8 +1616,7 @@ class connection : public base_connection,
                         call_back();
                         req_.call_event(req_.get_state());
 
-                        req_.set_current_size(0);
-                        do_read_websocket_head(SHORT_HEADER);
+                        read_websocket_frame();
                       });
   }
 
@@ -1199,11 +1696,30 @@ class connection : public base_connection,
           if (!handle_ws_frame(ret, std::move(payload), bytes_transferred))
             return;
 
-          req_.set_current_size(0);
-          do_read_websocket_head(SHORT_HEADER);
+          read_websocket_frame();
         });
   }
 
+  void read_websocket_frame() {
+    req_.set_current_size(0);
+    size_t size = read_or_release(
+        [this](const std::error_code &ec) {
+          if (ec) {
+            cancel_timer();
+            req_.call_event(data_proc_state::data_error);
+            close();
+            return;
+          }
+
+          do_read_websocket_head(SHORT_HEADER);
+        },
+        SHORT_HEADER);
+    if (size != 0) {
+      req_.set_current_size(size);
+      do_read_websocket_head(SHORT_HEADER - size);
+    }
+  }
+
   bool handle_ws_frame(ws_frame_type ret, std::string &&payload, size_t) {
     switch (ret) {
       case cinatra::ws_frame_type::WS_ERROR_FRAME:
@@ -1252,29 +1768,219 @@ class connection : public base_connection,
   }
 
   void ws_ping() {
-    timer_.expires_from_now(std::chrono::seconds(60));
-    timer_.async_wait(
-        [self = this->shared_from_this()](std::error_code const &ec) {
+    if (!has_closed_) {
+      wheel_.add(ping_node_, std::chrono::seconds(60));
+    }
+  }
+
+  void on_ping_timeout() {
+    auto self = this->weak_from_this().lock();
+    if (!self) {
+      return;
+    }
+
+    send_ws_msg("ping", opcode::ping);
+  }
+  //-------------web socket----------------//
+
+  //-------------streamed body----------------------//
+  // a chunked body, or any body of a stream_body route, goes to the handler
+  // as it is read: data_continue with get_part_data() for each piece, then
+  // data_end after the last one. A piece is consumed when the handler
+  // returns, unless it called pause_body(); the piece stays valid then and
+  // no more is read until resume_body(). No more than a read buffer of the
+  // body is held, whatever its size.
+  void handle_stream_body(size_t bytes_transferred) {
+    if (req_.is_chunked() &&
+        !req_.get_header_value(http_header::content_length).empty()) {
+      // RFC 9112 section 6.3, the framing of the peer can't be trusted
+      keep_alive_ = false;
+    }
+    stream_left_ = req_.body_len();
+    stream_paused_ = false;
+    collect_body_ = false;
+    stream_pos_ = req_.header_len();
+    stream_end_ = bytes_transferred;
+    feed_stream_body();
+  }
+
+  void feed_stream_body() {
+    std::string_view data(req_.buffer(stream_pos_), stream_end_ - stream_pos_);
+    size_t consumed = 0;
+    bool done = false;
+    if (req_.is_chunked()) {
+      auto status = req_.get_chunked_decoder().feed(
+          data, consumed, [this](std::string_view piece) {
+            return on_body_piece(piece);
+          });
+      if (status == chunked_decoder::status::error) {
+        keep_alive_ = false;
+        req_.set_state(data_proc_state::data_error);
+        call_back();
+        response_back(status_type::bad_request, "bad chunked body");
+        return;
+      }
+      done = status == chunked_decoder::status::done;
+    }
+    else {
+      consumed = (std::min)(stream_left_, data.size());
+      stream_left_ -= consumed;
+      if (consumed > 0) {
+        on_body_piece(data.substr(0, consumed));
+      }
+      done = stream_left_ == 0;
+    }
+    stream_pos_ += consumed;
+
+    if (collect_body_ && req_.at_capacity(req_.body().size())) {
+      keep_alive_ = false;
+      response_back(status_type::bad_request,
+                    "The body is too long, limitation is 3M");
+      return;
+    }
+
+    if (stream_paused_) {
+      cancel_timer();
+      return;
+    }
+
+    if (done) {
+      if (stream_pos_ < stream_end_) {
+        // no pipelining behind a streamed body
+        keep_alive_ = false;
+      }
+      req_.set_state(data_proc_state::data_end);
+      call_back();
+      do_write();
+      return;
+    }
+
+    req_.set_current_size(0);
+    req_.fit_chunked_size();
+    do_read_stream_body();
+  }
+
+  // a coroutine handler gets the whole body at data_end instead, it can't
+  // run before the piece is gone.
+  bool on_body_piece(std::string_view piece) {
+    req_.set_part_data(piece);
+    if (!collect_body_) {
+      req_.set_state(data_proc_state::data_continue);
+      collect_body_ = call_back();
+    }
+    if (collect_body_) {
+      req_.collect_body(req_.get_part_data());
+    }
+    req_.set_part_data({});
+    return !stream_paused_ &&
+           !(collect_body_ && req_.at_capacity(req_.body().size()));
+  }
+
+  void do_read_stream_body() {
+    reset_timer();
+
+    socket().async_read_some(
+        asio::buffer(req_.buffer(), req_.left_size()),
+        [this, self = this->shared_from_this()](const std::error_code &ec,
+                                                std::size_t length) {
           if (ec) {
-            self->close();
+            req_.set_state(data_proc_state::data_error);
+            call_back();
+            close();
             return;
           }
 
-          self->send_ws_msg("ping", opcode::ping);
+          stream_pos_ = 0;
+          stream_end_ = length;
+          feed_stream_body();
         });
   }
-  //-------------web socket----------------//
 
-  //-------------chunked(read chunked not support yet, write chunked is
-  // ok)----------------------//
-  void handle_chunked(size_t bytes_transferred) {
-    int ret = req_.parse_chunked(bytes_transferred);
-    if (ret == parse_status::has_error) {
-      response_back(status_type::internal_server_error, "not support yet");
+#ifdef CINATRA_HAS_SENDFILE
+  void send_file_data() {
+    // yield to the other connections of this io_context now and then.
+    constexpr int64_t max_bytes_per_round = 8 * 1024 * 1024;
+    int64_t sent = 0;
+    while (file_left_ > 0) {
+      if (sent >= max_bytes_per_round) {
+        asio::post(socket_.get_executor(),
+                   [this, self = this->shared_from_this()] {
+                     send_file_data();
+                   });
+        return;
+      }
+
+      off_t offset = file_offset_;
+      ssize_t n = ::sendfile(socket_.native_handle(), file_fd_, &offset,
+                             size_t(file_left_));
+      if (n > 0) {
+        file_offset_ = offset;
+        file_left_ -= n;
+        sent += n;
+        continue;
+      }
+
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        reset_timer();
+        socket_.async_wait(asio::ip::tcp::socket::wait_write,
+                           [this, self = this->shared_from_this()](
+                               const std::error_code &ec) {
+                             if (ec) {
+                               close();
+                               return;
+                             }
+                             send_file_data();
+                           });
+        return;
+      }
+
+      // an error, or the file got shorter than announced
+      close();
       return;
     }
+
+    ++file_part_;
+    write_file_part();
+  }
+
+  void write_file_part() {
+    if (file_part_ == file_parts_.size()) {
+      close_file();
+      req_.set_state(data_proc_state::data_end);
+      call_back();
+      if (keep_alive_) {
+        do_read();
+      }
+      return;
+    }
+
+    auto &part = file_parts_[file_part_];
+    file_offset_ = part.offset;
+    file_left_ = part.count;
+    asio::async_write(socket(), asio::buffer(part.head),
+                      [this, self = this->shared_from_this()](
+                          const std::error_code &ec, std::size_t) {
+                        if (ec) {
+                          close();
+                          return;
+                        }
+                        send_file_data();
+                      });
   }
 
+  void close_file() {
+    if (file_fd_ >= 0) {
+      ::close(file_fd_);
+      file_fd_ = -1;
+    }
+    file_parts_.clear();
+  }
+#endif
+
   void handle_chunked_header(const std::error_code &ec) {
     if (ec) {
       return;
@@ -1283,8 +1989,7 @@ class connection : public base_connection,
     req_.set_state(data_proc_state::data_continue);
     call_back();  // app set the data
   }
-  //-------------chunked(read chunked not support yet, write chunked is
-  // ok)----------------------//
+  //-------------streamed body----------------------//
 
   void handle_body() {
     if (req_.at_capacity()) {
@@ -1345,7 +2050,7 @@ class connection : public base_connection,
   };
 
   void check_keep_alive() {
-    auto req_conn_hdr = req_.get_header_value("connection");
+    auto req_conn_hdr = req_.get_header_value(http_header::connection);
     if (req_.is_http11()) {
       keep_alive_ = req_conn_hdr.empty() ||
                     !iequal(req_conn_hdr.data(), req_conn_hdr.size(), "close");
@@ -1359,7 +2064,7 @@ class connection : public base_connection,
     if (keep_alive_) {
       is_upgrade_ = req_.is_upgrade();
       if (is_upgrade_)
-        ws_.sec_ws_key(req_.get_header_value("sec-websocket-key"));
+        ws_.sec_ws_key(req_.get_header_value(http_header::sec_websocket_key));
     }
   }
 
@@ -1433,11 +2138,15 @@ class connection : public base_connection,
 
   //-----------------send message----------------//
   asio::ip::tcp::socket socket_;
+  asio_util::ExecutorWrapper<> executor_wrapper_;
+  bool enable_coro_ = false;
 #ifdef CINATRA_ENABLE_SSL
   std::unique_ptr<asio::ssl::stream<asio::ip::tcp::socket &>> ssl_stream_ =
       nullptr;
 #endif
-  asio::steady_timer timer_;
+  timer_wheel &wheel_;
+  timer_node idle_node_;
+  timer_node ping_node_;
   bool enable_timeout_ = true;
   response res_;
   request req_;
@@ -1467,10 +2176,39 @@ class connection : public base_connection,
   const http_handler &http_handler_;
   std::function<bool(request &req, response &res)> *upload_check_ = nullptr;
   std::any tag_;
+#ifdef CINATRA_HAS_SENDFILE
+  int file_fd_ = -1;
+  int64_t file_offset_ = 0;
+  int64_t file_left_ = 0;
+  std::vector<sendfile_part> file_parts_;
+  size_t file_part_ = 0;
+#endif
+#ifdef CINATRA_ENABLE_GZIP
+  gzip_codec::compressor chunked_gzip_;
+  size_t gzip_flush_size_ = 0;
+  size_t gzip_unflushed_ = 0;
+#endif
   std::function<void(request &, std::string &)> multipart_begin_ = nullptr;
 
-  size_t len_ = 0;
-  size_t last_transfer_ = 0;
+  // the streamed body: the undecoded bytes of the buffer, and what is left
+  // of a Content-Length body
+  std::function<bool(request &)> stream_body_check_;
+  size_t stream_pos_ = 0;
+  size_t stream_end_ = 0;
+  size_t stream_left_ = 0;
+  bool stream_paused_ = false;
+  // the body is collected for a coroutine handler
+  bool collect_body_ = false;
+
+  bool release_idle_buffer_ = false;
+
+  // pipelined responses waiting for one vectored write.
+  bool parsed_ = false;
+  size_t max_pipeline_depth_ = 16;
+  size_t pipeline_count_ = 0;
+  // a deque, the buffers may point into the stashes themselves
+  std::deque<stashed_response> pipeline_reps_;
+  std::vector<asio::const_buffer> pipeline_buffers_;
 
   QuitCallback quit_callback_ = nullptr;
   uint64_t conn_id_ = 0;
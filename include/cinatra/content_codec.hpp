@@ -0,0 +1,122 @@
+#pragma once
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "utils.hpp"
+#ifdef CINATRA_ENABLE_GZIP
+#include "gzip.hpp"
+#endif
+
+namespace cinatra {
+struct codec_options {
+  // in the range of the backend, -1 is its default
+  int level = -1;
+  // backend specific, 0 is the default of every backend
+  int strategy = 0;
+};
+
+// A content coding, RFC 9110 section 8.4.1, for whole bodies. Backends are
+// called from every io thread at once, so they keep their per-call state in
+// thread_local contexts rather than in the object.
+class content_codec {
+public:
+  virtual ~content_codec() = default;
+
+  // the Content-Encoding token, "gzip", "deflate", "zstd"...
+  virtual std::string_view name() const = 0;
+
+  // both append to out
+  virtual bool compress(std::string_view data, std::string &out,
+                        const codec_options &options) = 0;
+  virtual bool uncompress(std::string_view data, std::string &out) = 0;
+};
+
+#ifdef CINATRA_ENABLE_GZIP
+// gzip and deflate, which differ only in how the stream is wrapped; HTTP's
+// "deflate" is the zlib format.
+class zlib_codec : public content_codec {
+public:
+  zlib_codec(std::string_view name, gzip_codec::deflate_format format)
+      : name_(name), format_(format) {}
+
+  std::string_view name() const override { return name_; }
+
+  bool compress(std::string_view data, std::string &out,
+                const codec_options &options) override {
+    gzip_codec::deflate_options deflate_options;
+    deflate_options.level = options.level;
+    deflate_options.strategy = options.strategy;
+    return gzip_codec::deflater::local(format_).compress(data, out,
+                                                         deflate_options);
+  }
+
+  bool uncompress(std::string_view data, std::string &out) override {
+    return gzip_codec::inflater::local(format_).uncompress(data, out);
+  }
+
+private:
+  std::string_view name_;
+  gzip_codec::deflate_format format_;
+};
+#endif
+
+// the codings available to the server, gzip and deflate when built with
+// CINATRA_ENABLE_GZIP. Others, zstd or br, are added with add() before the
+// server runs.
+class codec_registry {
+public:
+  static codec_registry &instance() {
+    static codec_registry instance;
+    return instance;
+  }
+
+  // replaces a codec of the same name
+  void add(std::shared_ptr<content_codec> codec) {
+    std::lock_guard lock(mtx_);
+    for (auto &c : codecs_) {
+      if (c->name() == codec->name()) {
+        c = std::move(codec);
+        return;
+      }
+    }
+    codecs_.push_back(std::move(codec));
+  }
+
+  // nullptr when there is none, names compare case-insensitively
+  std::shared_ptr<content_codec> find(std::string_view name) const {
+    std::lock_guard lock(mtx_);
+    for (auto &c : codecs_) {
+      auto n = c->name();
+      if (iequal(n.data(), n.size(), name.data(), name.size())) {
+        return c;
+      }
+    }
+    return nullptr;
+  }
+
+  std::vector<std::string> names() const {
+    std::lock_guard lock(mtx_);
+    std::vector<std::string> names;
+    for (auto &c : codecs_) {
+      names.emplace_back(c->name());
+    }
+    return names;
+  }
+
+private:
+  codec_registry() {
+#ifdef CINATRA_ENABLE_GZIP
+    codecs_.push_back(std::make_shared<zlib_codec>(
+        "gzip", gzip_codec::deflate_format::gzip));
+    codecs_.push_back(std::make_shared<zlib_codec>(
+        "deflate", gzip_codec::deflate_format::zlib));
+#endif
+  }
+
+  mutable std::mutex mtx_;
+  std::vector<std::shared_ptr<content_codec>> codecs_;
+};
+}  // namespace cinatra
@@ -0,0 +1,153 @@
+#pragma once
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <string_view>
+
+#include <sys/stat.h>
+
+#include "content_codec.hpp"
+#include "http_date.hpp"
+#include "utils.hpp"
+
+namespace cinatra {
+// the ETag and Last-Modified of a file version. Both are derived from its
+// metadata, a single stat() call, so no byte of the file is read.
+struct file_validators {
+  // strong tag, "<inode>-<size>-<mtime>" in hex
+  std::string etag;
+  std::string last_modified;
+  std::time_t mtime = 0;
+  int64_t size = 0;
+
+  // "ETag: ...\r\nLast-Modified: ...\r\n"
+  std::string to_headers() const {
+    std::string headers;
+    headers.append("ETag: ")
+        .append(etag)
+        .append("\r\nLast-Modified: ")
+        .append(last_modified)
+        .append("\r\n");
+    return headers;
+  }
+};
+
+// false when the file can't be stat'd.
+inline bool get_file_validators(const std::string &path, file_validators &v) {
+  auto to_hex = [](uint64_t n, std::string &out) {
+    char buf[16];
+    int len = 0;
+    do {
+      buf[len++] = "0123456789abcdef"[n & 0xf];
+      n >>= 4;
+    } while (n > 0);
+    while (len > 0) {
+      out.push_back(buf[--len]);
+    }
+  };
+
+#ifdef _WIN32
+  struct _stat64 st;
+  if (::_stat64(path.data(), &st) != 0) {
+    return false;
+  }
+  uint64_t mtime = uint64_t(st.st_mtime);
+#else
+  struct stat st;
+  if (::stat(path.data(), &st) != 0) {
+    return false;
+  }
+#if defined(__linux__)
+  uint64_t mtime =
+      uint64_t(st.st_mtim.tv_sec) * 1000000000 + uint64_t(st.st_mtim.tv_nsec);
+#else
+  uint64_t mtime = uint64_t(st.st_mtime);
+#endif
+#endif
+
+  v.etag.clear();
+  v.etag.push_back('"');
+  to_hex(uint64_t(st.st_ino), v.etag);
+  v.etag.push_back('-');
+  to_hex(uint64_t(st.st_size), v.etag);
+  v.etag.push_back('-');
+  to_hex(mtime, v.etag);
+  v.etag.push_back('"');
+
+  v.mtime = st.st_mtime;
+  v.size = int64_t(st.st_size);
+  v.last_modified.resize(http_date::imf_fixdate_size);
+  http_date::format_imf_fixdate(v.mtime, v.last_modified.data());
+  return true;
+}
+
+// the ETag of a compressed representation of the entity tagged etag,
+// "\"1-2-3\"" is "\"1-2-3-gz\"" for gzip.
+inline std::string coded_etag(std::string_view etag, std::string_view coding) {
+  std::string tag(etag);
+  if (tag.size() > 1 && tag.back() == '"') {
+    tag.insert(tag.size() - 1, coding == "gzip" ? std::string("-gz")
+                                                : "-" + std::string(coding));
+  }
+  return tag;
+}
+
+// whether tag is etag, or the tag coded_etag() gives a representation of
+// it compressed with gzip, br or a coding of codec_registry.
+inline bool is_tag_of(std::string_view tag, std::string_view etag) {
+  if (tag == etag) {
+    return true;
+  }
+  if (etag.size() < 2 || etag.back() != '"' || tag.size() <= etag.size() ||
+      tag.back() != '"' || !tag.starts_with(etag.substr(0, etag.size() - 1))) {
+    return false;
+  }
+  // "-gz", "-br" of the static file cache or "-<coding>"
+  auto suffix = tag.substr(etag.size() - 1, tag.size() - etag.size());
+  return suffix.size() > 1 && suffix[0] == '-' &&
+         (suffix == "-gz" || suffix == "-br" ||
+          codec_registry::instance().find(suffix.substr(1)) != nullptr);
+}
+
+// whether a GET with these headers can be answered with 304 Not Modified,
+// RFC 7232 section 6: If-Modified-Since is ignored when If-None-Match is
+// present. etag is compared weakly, as If-None-Match requires, a tag of a
+// compressed representation of the entity matches it too.
+inline bool is_not_modified(std::string_view if_none_match,
+                            std::string_view if_modified_since,
+                            std::string_view etag, std::time_t mtime) {
+  auto opaque = [](std::string_view tag) {
+    if (tag.size() > 2 && tag[0] == 'W' && tag[1] == '/') {
+      tag.remove_prefix(2);
+    }
+    return tag;
+  };
+
+  if (!if_none_match.empty()) {
+    if (trim(if_none_match) == "*") {
+      return true;
+    }
+
+    auto ours = opaque(etag);
+    while (!if_none_match.empty()) {
+      size_t pos = if_none_match.find(',');
+      auto tag = trim(if_none_match.substr(0, pos));
+      if (is_tag_of(opaque(tag), ours)) {
+        return true;
+      }
+      if (pos == std::string_view::npos) {
+        break;
+      }
+      if_none_match.remove_prefix(pos + 1);
+    }
+    return false;
+  }
+
+  if (!if_modified_since.empty()) {
+    auto [ok, since] = get_timestamp(std::string(trim(if_modified_since)));
+    return ok && mtime <= since;
+  }
+
+  return false;
+}
+}  // namespace cinatra
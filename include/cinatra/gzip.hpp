@@ -1,4 +1,6 @@
 #pragma once
+#include <fstream>
+#include <string>
 #include <string_view>
 #include <zlib.h>
 namespace cinatra::gzip_codec {
@@ -8,84 +10,358 @@ namespace cinatra::gzip_codec {
 #define windowBits 15
 #define GZIP_ENCODING 16
 
+// how a deflate stream is wrapped: the gzip and zlib formats are the
+// "gzip" and "deflate" content codings, raw has no header or trailer.
+enum class deflate_format { gzip, zlib, raw };
+
+inline int deflate_window_bits(deflate_format format) {
+  switch (format) {
+  case deflate_format::gzip:
+    return windowBits | GZIP_ENCODING;
+  case deflate_format::zlib:
+    return windowBits;
+  default:
+    return -windowBits;
+  }
+}
+
+struct deflate_options {
+  // -1 = default (6), 0 = no compression, 1 = fastest ... 9 = best
+  int level = Z_DEFAULT_COMPRESSION;
+  // Z_DEFAULT_STRATEGY, Z_FILTERED, Z_HUFFMAN_ONLY, Z_RLE or Z_FIXED
+  int strategy = Z_DEFAULT_STRATEGY;
+};
+
+// what compress() uses when the caller gives no options, responses
+// compressed by the server included. Set it before the server runs.
+inline deflate_options &default_options() {
+  static deflate_options options;
+  return options;
+}
+
+// A deflate stream kept for a whole thread. deflateInit2 allocates about
+// 256KB of state, far more work than compressing a small body, so every
+// call after the first only resets the stream.
+class deflater {
+public:
+  explicit deflater(deflate_format format) : format_(format) {}
+  deflater(const deflater &) = delete;
+  deflater &operator=(const deflater &) = delete;
+
+  ~deflater() { end(); }
+
+  // the deflater of the calling thread for format
+  static deflater &local(deflate_format format) {
+    thread_local deflater gzip(deflate_format::gzip);
+    thread_local deflater zlib(deflate_format::zlib);
+    thread_local deflater raw(deflate_format::raw);
+    switch (format) {
+    case deflate_format::gzip:
+      return gzip;
+    case deflate_format::zlib:
+      return zlib;
+    default:
+      return raw;
+    }
+  }
+
+  // compresses data as one whole stream, appended to out.
+  bool compress(std::string_view data, std::string &out,
+                const deflate_options &options) {
+    if (!prepare(options)) {
+      return false;
+    }
+
+    size_t old_size = out.size();
+    out.resize(old_size + deflateBound(&strm_, (uLong)data.length()));
+    strm_.next_in = (unsigned char *)data.data();
+    strm_.avail_in = (uInt)data.length();
+    strm_.next_out = (unsigned char *)out.data() + old_size;
+    strm_.avail_out = (uInt)(out.size() - old_size);
+    if (deflate(&strm_, Z_FINISH) != Z_STREAM_END) {
+      out.resize(old_size);
+      end();
+      return false;
+    }
+    out.resize(old_size + strm_.total_out);
+    return true;
+  }
+
+  bool initialized() const { return initialized_; }
+
+private:
+  bool prepare(const deflate_options &options) {
+    if (initialized_) {
+      if (deflateReset(&strm_) == Z_OK) {
+        if (options.level == level_ && options.strategy == strategy_) {
+          return true;
+        }
+        // nothing is pending right after a reset, so this just switches
+        if (deflateParams(&strm_, options.level, options.strategy) == Z_OK) {
+          level_ = options.level;
+          strategy_ = options.strategy;
+          return true;
+        }
+      }
+      end();
+    }
+
+    strm_.zalloc = Z_NULL;
+    strm_.zfree = Z_NULL;
+    strm_.opaque = Z_NULL;
+    if (deflateInit2(&strm_, options.level, Z_DEFLATED,
+                     deflate_window_bits(format_), 8,
+                     options.strategy) != Z_OK) {
+      return false;
+    }
+    initialized_ = true;
+    level_ = options.level;
+    strategy_ = options.strategy;
+    return true;
+  }
+
+  void end() {
+    if (initialized_) {
+      deflateEnd(&strm_);
+      initialized_ = false;
+    }
+  }
+
+  deflate_format format_;
+  z_stream strm_{};
+  bool initialized_ = false;
+  int level_ = 0;
+  int strategy_ = 0;
+};
+
+// the inflating counterpart of deflater.
+class inflater {
+public:
+  explicit inflater(deflate_format format) : format_(format) {}
+  inflater(const inflater &) = delete;
+  inflater &operator=(const inflater &) = delete;
+
+  ~inflater() { end(); }
+
+  static inflater &local(deflate_format format) {
+    thread_local inflater gzip(deflate_format::gzip);
+    thread_local inflater zlib(deflate_format::zlib);
+    thread_local inflater raw(deflate_format::raw);
+    switch (format) {
+    case deflate_format::gzip:
+      return gzip;
+    case deflate_format::zlib:
+      return zlib;
+    default:
+      return raw;
+    }
+  }
+
+  // decompresses one whole stream, appended to data.
+  bool uncompress(std::string_view compressed_data, std::string &data) {
+    if (!prepare()) {
+      return false;
+    }
+
+    unsigned char out[CHUNK];
+    strm_.avail_in = (uInt)compressed_data.length();
+    strm_.next_in = (unsigned char *)compressed_data.data();
+    int ret;
+    do {
+      strm_.avail_out = CHUNK;
+      strm_.next_out = out;
+      ret = inflate(&strm_, Z_NO_FLUSH);
+      switch (ret) {
+      case Z_NEED_DICT:
+      case Z_DATA_ERROR:
+      case Z_MEM_ERROR:
+      case Z_STREAM_ERROR:
+        end();
+        return false;
+      }
+      data.append((char *)out, CHUNK - strm_.avail_out);
+    } while (strm_.avail_out == 0 && ret != Z_STREAM_END);
+    return true;
+  }
+
+  bool initialized() const { return initialized_; }
+
+private:
+  bool prepare() {
+    if (initialized_) {
+      if (inflateReset(&strm_) == Z_OK) {
+        return true;
+      }
+      end();
+    }
+
+    strm_.zalloc = Z_NULL;
+    strm_.zfree = Z_NULL;
+    strm_.opaque = Z_NULL;
+    strm_.avail_in = 0;
+    strm_.next_in = Z_NULL;
+    // gzip: 16 + MAX_WBITS, the others as for deflate
+    int bits = format_ == deflate_format::gzip ? 16 + MAX_WBITS
+               : format_ == deflate_format::zlib ? MAX_WBITS
+                                                 : -MAX_WBITS;
+    if (inflateInit2(&strm_, bits) != Z_OK) {
+      return false;
+    }
+    initialized_ = true;
+    return true;
+  }
+
+  void end() {
+    if (initialized_) {
+      inflateEnd(&strm_);
+      initialized_ = false;
+    }
+  }
+
+  deflate_format format_;
+  z_stream strm_{};
+  bool initialized_ = false;
+};
+
 // GZip Compression
 // @param data - the data to compress (does not have to be string, can be binary
 // data)
 // @param compressed_data - the resulting gzip compressed data
+// @param options - level and strategy
+// @return - true on success, false on failure
+inline bool compress(std::string_view data, std::string &compressed_data,
+                     const deflate_options &options) {
+  return deflater::local(deflate_format::gzip)
+      .compress(data, compressed_data, options);
+}
+
 // @param level - the gzip compress level -1 = default, 0 = no compression, 1=
 // worst/fastest compression, 9 = best/slowest compression
-// @return - true on success, false on failure
 inline bool compress(std::string_view data, std::string &compressed_data,
-                     int level = -1) {
-  unsigned char out[CHUNK];
-  z_stream strm;
-  strm.zalloc = Z_NULL;
-  strm.zfree = Z_NULL;
-  strm.opaque = Z_NULL;
-  if (deflateInit2(&strm, level, Z_DEFLATED, windowBits | GZIP_ENCODING, 8,
-                   Z_DEFAULT_STRATEGY) != Z_OK) {
-    return false;
-  }
-  strm.next_in = (unsigned char *)data.data();
-  strm.avail_in = (uInt)data.length();
-  do {
-    int have;
-    strm.avail_out = CHUNK;
-    strm.next_out = out;
-    if (deflate(&strm, Z_FINISH) == Z_STREAM_ERROR) {
-      return false;
-    }
-    have = CHUNK - strm.avail_out;
-    compressed_data.append((char *)out, have);
-  } while (strm.avail_out == 0);
-  if (deflateEnd(&strm) != Z_OK) {
-    return false;
-  }
-  return true;
+                     int level) {
+  deflate_options options = default_options();
+  options.level = level;
+  return compress(data, compressed_data, options);
 }
 
+inline bool compress(std::string_view data, std::string &compressed_data) {
+  return compress(data, compressed_data, default_options());
+}
+
+// a bool would silently be taken as level 1
+bool compress(std::string_view, std::string &, bool) = delete;
+
 // GZip Decompression
 // @param compressed_data - the gzip compressed data
 // @param data - the resulting uncompressed data (may contain binary data)
 // @return - true on success, false on failure
 inline bool uncompress(std::string_view compressed_data, std::string &data) {
-  int ret;
-  unsigned have;
-  z_stream strm;
-  unsigned char out[CHUNK];
-
-  strm.zalloc = Z_NULL;
-  strm.zfree = Z_NULL;
-  strm.opaque = Z_NULL;
-  strm.avail_in = 0;
-  strm.next_in = Z_NULL;
-  if (inflateInit2(&strm, 16 + MAX_WBITS) != Z_OK) {
-    return false;
-  }
-
-  strm.avail_in = (uInt)compressed_data.length();
-  strm.next_in = (unsigned char *)compressed_data.data();
-  do {
-    strm.avail_out = CHUNK;
-    strm.next_out = out;
-    ret = inflate(&strm, Z_NO_FLUSH);
-    switch (ret) {
-    case Z_NEED_DICT:
-    case Z_DATA_ERROR:
-    case Z_MEM_ERROR:
-      inflateEnd(&strm);
+  return inflater::local(deflate_format::gzip).uncompress(compressed_data,
+                                                          data);
+}
+
+// Incremental gzip compression, for bodies that are produced piece by
+// piece: each call appends what deflate has ready to out, so neither the
+// whole body nor the whole result is ever held in memory. Like deflater,
+// the stream is allocated once and only reset for the next body.
+class compressor {
+public:
+  compressor() = default;
+  compressor(const compressor &) = delete;
+  compressor &operator=(const compressor &) = delete;
+
+  ~compressor() { release(); }
+
+  // starts a new gzip stream, an unfinished one is dropped.
+  // @param level - as for compress()
+  bool init(int level = -1) {
+    active_ = false;
+    if (initialized_) {
+      if (deflateReset(&strm_) == Z_OK &&
+          (level == level_ ||
+           deflateParams(&strm_, level, Z_DEFAULT_STRATEGY) == Z_OK)) {
+        level_ = level;
+        active_ = true;
+        return true;
+      }
+      release();
+    }
+
+    strm_.zalloc = Z_NULL;
+    strm_.zfree = Z_NULL;
+    strm_.opaque = Z_NULL;
+    if (deflateInit2(&strm_, level, Z_DEFLATED, windowBits | GZIP_ENCODING, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
       return false;
     }
-    have = CHUNK - strm.avail_out;
-    data.append((char *)out, have);
-  } while (strm.avail_out == 0);
+    initialized_ = true;
+    level_ = level;
+    active_ = true;
+    return true;
+  }
+
+  bool active() const { return active_; }
 
-  if (inflateEnd(&strm) != Z_OK) {
-    return false;
+  // @param flush - Z_NO_FLUSH lets deflate buffer, Z_SYNC_FLUSH pushes out
+  // everything given so far, so the peer can decode it already.
+  bool compress(std::string_view data, std::string &out,
+                int flush = Z_NO_FLUSH) {
+    if (!active_) {
+      return false;
+    }
+
+    strm_.next_in = (unsigned char *)data.data();
+    strm_.avail_in = (uInt)data.length();
+    return run(out, flush);
   }
 
-  return true;
-}
+  // writes the rest and the gzip trailer, the stream ends here.
+  bool finish(std::string &out) {
+    if (!active_) {
+      return false;
+    }
+
+    strm_.next_in = Z_NULL;
+    strm_.avail_in = 0;
+    bool r = run(out, Z_FINISH);
+    end();
+    return r;
+  }
+
+  // drops the stream, its state is kept for the next init().
+  void end() { active_ = false; }
+
+  // frees the state too.
+  void release() {
+    active_ = false;
+    if (initialized_) {
+      deflateEnd(&strm_);
+      initialized_ = false;
+    }
+  }
+
+  bool initialized() const { return initialized_; }
+
+private:
+  bool run(std::string &out, int flush) {
+    unsigned char buf[CHUNK];
+    do {
+      strm_.avail_out = CHUNK;
+      strm_.next_out = buf;
+      int ret = deflate(&strm_, flush);
+      if (ret == Z_STREAM_ERROR) {
+        return false;
+      }
+      out.append((char *)buf, CHUNK - strm_.avail_out);
+    } while (strm_.avail_out == 0);
+    return true;
+  }
+
+  z_stream strm_{};
+  bool initialized_ = false;
+  bool active_ = false;
+  int level_ = 0;
+};
 
 inline int compress_file(const char *src_file, const char *out_file_name) {
   char buf[BUFSIZ] = {0};
@@ -0,0 +1,290 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+#include "picohttpparser.h"
+
+namespace cinatra {
+// well-known request headers, each one has a fixed slot in header_index.
+enum class http_header : uint8_t {
+  host,
+  connection,
+  content_length,
+  content_type,
+  transfer_encoding,
+  content_encoding,
+  cookie,
+  upgrade,
+  range,
+  accept,
+  accept_encoding,
+  accept_language,
+  user_agent,
+  referer,
+  origin,
+  if_none_match,
+  if_modified_since,
+  if_range,
+  cache_control,
+  pragma,
+  authorization,
+  expect,
+  x_forwarded_for,
+  sec_websocket_key,
+  sec_websocket_version,
+  sec_websocket_protocol,
+  sec_websocket_extensions,
+  upgrade_insecure_requests,
+  dnt,
+  sec_fetch_site,
+  sec_fetch_mode,
+  sec_fetch_dest,
+  sec_fetch_user,
+  sec_ch_ua,
+  sec_ch_ua_mobile,
+  sec_ch_ua_platform,
+  count
+};
+
+namespace detail {
+// lower case, in the order of http_header.
+inline constexpr std::string_view known_header_names[] = {
+    "host",
+    "connection",
+    "content-length",
+    "content-type",
+    "transfer-encoding",
+    "content-encoding",
+    "cookie",
+    "upgrade",
+    "range",
+    "accept",
+    "accept-encoding",
+    "accept-language",
+    "user-agent",
+    "referer",
+    "origin",
+    "if-none-match",
+    "if-modified-since",
+    "if-range",
+    "cache-control",
+    "pragma",
+    "authorization",
+    "expect",
+    "x-forwarded-for",
+    "sec-websocket-key",
+    "sec-websocket-version",
+    "sec-websocket-protocol",
+    "sec-websocket-extensions",
+    "upgrade-insecure-requests",
+    "dnt",
+    "sec-fetch-site",
+    "sec-fetch-mode",
+    "sec-fetch-dest",
+    "sec-fetch-user",
+    "sec-ch-ua",
+    "sec-ch-ua-mobile",
+    "sec-ch-ua-platform",
+};
+static_assert(std::size(known_header_names) == size_t(http_header::count));
+
+// header names are tokens, for them c | 0x20 only folds the letters.
+constexpr char fold(char c) { return char(c | 0x20); }
+
+inline constexpr uint32_t known_bits = 7;
+
+// looks at the length and four characters only, the slot still has to be
+// confirmed by comparing the name.
+constexpr uint32_t known_slot(const char *s, size_t len, uint32_t seed) {
+  uint32_t h = uint32_t(len);
+  h = h * 131 + uint8_t(fold(s[0]));
+  h = h * 131 + uint8_t(fold(s[len / 2]));
+  h = h * 131 + uint8_t(fold(s[len - 1]));
+  h = h * 131 + uint8_t(fold(s[len - 2]));
+  return (h * seed) >> (32 - known_bits);
+}
+
+constexpr bool is_perfect_seed(uint32_t seed) {
+  bool used[1 << known_bits] = {};
+  for (auto name : known_header_names) {
+    auto slot = known_slot(name.data(), name.size(), seed);
+    if (used[slot]) {
+      return false;
+    }
+    used[slot] = true;
+  }
+  return true;
+}
+
+// the smallest odd seed without collisions, searching for it at compile
+// time is too slow. Look for a new one when changing known_header_names.
+inline constexpr uint32_t known_seed = 37823;
+static_assert(is_perfect_seed(known_seed),
+              "known_seed has collisions, pick another one");
+
+// slot -> http_header + 1, 0 for an empty slot.
+inline constexpr auto known_slots = [] {
+  std::array<uint8_t, 1 << known_bits> slots{};
+  for (size_t i = 0; i < std::size(known_header_names); ++i) {
+    auto name = known_header_names[i];
+    slots[known_slot(name.data(), name.size(), known_seed)] = uint8_t(i + 1);
+  }
+  return slots;
+}();
+
+// compare with a lower case name.
+inline bool equal_folded(const char *s, const char *lower, size_t len) {
+  for (size_t i = 0; i < len; ++i) {
+    if (fold(s[i]) != lower[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// -1 when name is not a well-known header.
+inline int known_header_id(const char *name, size_t len) {
+  if (len < 2) {
+    return -1;
+  }
+
+  int id = known_slots[known_slot(name, len, known_seed)] - 1;
+  if (id < 0) {
+    return -1;
+  }
+
+  auto known = known_header_names[id];
+  if (known.size() != len || !equal_folded(name, known.data(), len)) {
+    return -1;
+  }
+  return id;
+}
+}  // namespace detail
+
+// index of the parsed request headers, built once per request. Well-known
+// headers are found through a compile time perfect hash, the others
+// through a small open addressing table. Both refer to entries of the
+// phr_header array, so they survive moving the headers to other storage.
+class header_index {
+ public:
+  void build(const phr_header *headers, size_t num_headers) {
+    clear();
+    headers_ = headers;
+    num_headers_ = num_headers;
+    for (size_t i = 0; i < num_headers; ++i) {
+      add(i);
+    }
+  }
+
+  void clear() {
+    if (num_headers_ == 0) {
+      return;
+    }
+
+    std::memset(known_, 0, sizeof(known_));
+    if (has_others_) {
+      std::memset(others_, 0, sizeof(others_));
+      has_others_ = false;
+    }
+    num_headers_ = 0;
+  }
+
+  std::string_view get(http_header id) const {
+    return value(known_[size_t(id)]);
+  }
+
+  std::string_view find(std::string_view name) const {
+    if (num_headers_ == 0) {
+      return {};
+    }
+
+    int id = detail::known_header_id(name.data(), name.size());
+    if (id >= 0) {
+      return value(known_[id]);
+    }
+
+    if (!has_others_) {
+      return {};
+    }
+
+    for (size_t slot = other_hash(name.data(), name.size());;
+         slot = (slot + 1) & (other_slots - 1)) {
+      uint8_t pos = others_[slot];
+      if (pos == 0) {
+        return {};
+      }
+
+      auto &h = headers_[pos - 1];
+      if (h.name_len == name.size() &&
+          iequal_name(h.name, name.data(), name.size())) {
+        return {h.value, h.value_len};
+      }
+    }
+  }
+
+ private:
+  static constexpr size_t other_slots = 128;
+
+  static size_t other_hash(const char *s, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; ++i) {
+      h = (h ^ uint8_t(detail::fold(s[i]))) * 16777619u;
+    }
+    return h & (other_slots - 1);
+  }
+
+  static bool iequal_name(const char *a, const char *b, size_t len) {
+    for (size_t i = 0; i < len; ++i) {
+      if (detail::fold(a[i]) != detail::fold(b[i])) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void add(size_t pos) {
+    auto &h = headers_[pos];
+    int id = detail::known_header_id(h.name, h.name_len);
+    if (id >= 0) {
+      // the first one wins, like a linear scan.
+      if (known_[id] == 0) {
+        known_[id] = uint8_t(pos + 1);
+      }
+      return;
+    }
+
+    has_others_ = true;
+    for (size_t slot = other_hash(h.name, h.name_len);;
+         slot = (slot + 1) & (other_slots - 1)) {
+      uint8_t other = others_[slot];
+      if (other == 0) {
+        others_[slot] = uint8_t(pos + 1);
+        return;
+      }
+
+      auto &o = headers_[other - 1];
+      if (o.name_len == h.name_len &&
+          iequal_name(o.name, h.name, h.name_len)) {
+        return;
+      }
+    }
+  }
+
+  std::string_view value(uint8_t pos) const {
+    if (pos == 0) {
+      return {};
+    }
+
+    auto &h = headers_[pos - 1];
+    return {h.value, h.value_len};
+  }
+
+  const phr_header *headers_ = nullptr;
+  size_t num_headers_ = 0;
+  bool has_others_ = false;
+  uint8_t known_[size_t(http_header::count)] = {};
+  uint8_t others_[other_slots] = {};
+};
+}  // namespace cinatra
@@ -63,7 +63,8 @@ public:
     if (need_cache_) {
       return need_cache_;
     } else {
-      return need_single_cache_.find(key) != need_single_cache_.end();
+      return !need_single_cache_.empty() &&
+             need_single_cache_.find(key) != need_single_cache_.end();
     }
   }
 
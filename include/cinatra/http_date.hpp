@@ -0,0 +1,125 @@
+#pragma once
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <string_view>
+
+#include "use_asio.hpp"
+
+namespace cinatra {
+// per io_context "Date: <IMF-fixdate>\r\n" header line, formatted once a
+// second by a tick instead of by every response. The tick only runs while
+// the line is being used. Not thread safe, use it from its io_context only.
+class http_date : public asio::execution_context::service {
+ public:
+  inline static asio::execution_context::id id;
+
+  // "Date: Sun, 06 Nov 1994 08:49:37 GMT\r\n"
+  static constexpr size_t line_size = 37;
+
+  explicit http_date(asio::io_context &ctx)
+      : asio::execution_context::service(ctx), timer_(ctx) {}
+
+  // the returned line is double buffered, it stays valid until the second
+  // tick after this call, long enough for the write it is used by.
+  std::string_view line() {
+    used_ = true;
+    if (!running_) {
+      refresh();
+      running_ = true;
+      arm();
+    }
+    return {lines_[current_], line_size};
+  }
+
+  // "Sun, 06 Nov 1994 08:49:37 GMT"
+  static constexpr size_t imf_fixdate_size = 29;
+
+  static void format(std::time_t t, char *out) {
+    std::memcpy(out, "Date: ", 6);
+    format_imf_fixdate(t, out + 6);
+    std::memcpy(out + 6 + imf_fixdate_size, "\r\n", 2);
+  }
+
+  // writes imf_fixdate_size characters, without a '\0'.
+  static void format_imf_fixdate(std::time_t t, char *out) {
+    static constexpr const char *days[] = {"Sun", "Mon", "Tue", "Wed",
+                                           "Thu", "Fri", "Sat"};
+    static constexpr const char *months[] = {"Jan", "Feb", "Mar", "Apr",
+                                             "May", "Jun", "Jul", "Aug",
+                                             "Sep", "Oct", "Nov", "Dec"};
+    std::tm tm;
+#ifdef _WIN32
+    gmtime_s(&tm, &t);
+#else
+    gmtime_r(&t, &tm);
+#endif
+
+    auto two_digits = [&out](int n) {
+      *out++ = char('0' + n / 10);
+      *out++ = char('0' + n % 10);
+    };
+    auto append = [&out](std::string_view str) {
+      for (char c : str) {
+        *out++ = c;
+      }
+    };
+
+    append(days[tm.tm_wday]);
+    append(", ");
+    two_digits(tm.tm_mday);
+    *out++ = ' ';
+    append(months[tm.tm_mon]);
+    *out++ = ' ';
+    int year = tm.tm_year + 1900;
+    two_digits(year / 100);
+    two_digits(year % 100);
+    *out++ = ' ';
+    two_digits(tm.tm_hour);
+    *out++ = ':';
+    two_digits(tm.tm_min);
+    *out++ = ':';
+    two_digits(tm.tm_sec);
+    append(" GMT");
+  }
+
+ private:
+  void shutdown() override {
+    std::error_code ec;
+    timer_.cancel(ec);
+  }
+
+  void refresh() {
+    current_ ^= 1;
+    format(std::chrono::system_clock::to_time_t(
+               std::chrono::system_clock::now()),
+           lines_[current_]);
+  }
+
+  void arm() {
+    // wake up right after the next second starts
+    auto now = std::chrono::system_clock::now().time_since_epoch();
+    auto next = std::chrono::ceil<std::chrono::seconds>(now);
+    if (next == now) {
+      next += std::chrono::seconds(1);
+    }
+    timer_.expires_after(next - now);
+    timer_.async_wait([this](const std::error_code &ec) {
+      if (ec || !used_) {
+        running_ = false;
+        return;
+      }
+
+      used_ = false;
+      refresh();
+      arm();
+    });
+  }
+
+  asio::steady_timer timer_;
+  char lines_[2][line_size];
+  int current_ = 0;
+  bool used_ = false;
+  bool running_ = false;
+};
+}  // namespace cinatra
@@ -1,12 +1,17 @@
 #pragma once
-#include <map>
+#include <array>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <string_view>
-#include <unordered_map>
 #include <vector>
 
+#include "async_simple/coro/Lazy.h"
 #include "function_traits.hpp"
 #include "mime_types.hpp"
+#include "radix_tree.hpp"
 #include "request.hpp"
 #include "response.hpp"
 #include "session.hpp"
@@ -18,8 +23,21 @@ constexpr char SLASH = '/';
 constexpr std::string_view INDEX = "index";
 }  // namespace
 
+template <typename T>
+constexpr bool is_lazy_v = false;
+
+template <typename T>
+constexpr bool is_lazy_v<async_simple::coro::Lazy<T>> = true;
+
 class http_router {
  public:
+  http_router() : current_(new route_snapshot{}) {}
+
+  ~http_router() { delete current_.load(std::memory_order_relaxed); }
+
+  http_router(const http_router &) = delete;
+  http_router &operator=(const http_router &) = delete;
+
   template <http_method... Is, typename Function, typename... Ap>
   std::enable_if_t<!std::is_member_function_pointer_v<Function>>
   register_handler(std::string_view name, Function &&f, const Ap &...ap) {
@@ -47,66 +65,169 @@ class http_router {
     (register_handler_impl(name, method_name(Is), f, (T *)nullptr, ap...), ...);
   }
 
-  void remove_handler(std::string name) { this->map_invokers_.erase(name); }
+  // name as "METHOD /path", the pattern it was registered with
+  void remove_handler(std::string name) {
+    update([&name](route_snapshot &routes) {
+      if (name == STATIC_RESOURCE) {
+        routes.static_invoker = {};
+        return;
+      }
+      auto pos = name.find(' ');
+      if (pos == std::string::npos) {
+        return;
+      }
+      std::string_view key(name);
+      if (auto tree = routes.routes_of(key.substr(0, pos))) {
+        tree->erase(key.substr(pos + 1));
+      }
+      if (auto tree = routes.stream_routes_of(key.substr(0, pos))) {
+        tree->erase(key.substr(pos + 1));
+      }
+    });
+  }
+
+  // the body of a request to name, "METHOD /path", is given to its handler
+  // in pieces as it arrives, see stream_body
+  void add_stream_route(std::string_view name) {
+    auto pos = name.find(' ');
+    if (pos == std::string_view::npos) {
+      return;
+    }
+    update([method = name.substr(0, pos),
+            path = name.substr(pos + 1)](route_snapshot &routes) {
+      auto tree = routes.stream_routes_of(method);
+      if (tree == nullptr) {
+        tree = &routes.stream_routes
+                    .emplace_back(std::string(method), radix_tree<bool>{})
+                    .second;
+      }
+      tree->insert(path, true);
+    });
+  }
+
+  // the captures are left in the path params of req, route() sets them
+  // again.
+  bool is_stream_route(request &req) const {
+    auto routes = current_.load(std::memory_order_acquire);
+    auto tree = routes->stream_routes_of(req.get_method());
+    return tree != nullptr &&
+           tree->find(req.get_url(), req.get_path_params()) != nullptr;
+  }
 
   // elimate exception, resut type bool: true, success, false, failed
   bool route(std::string_view method, std::string_view url, request &req,
-             response &res, bool wild_card = false) {
-    std::string str(method);
-    std::string_view key =
-        wild_card ? url
-                  : (!req.has_resize()
-                         ? std::string_view{method.data(),
-                                            method.size() + url.size() + 1}
-                         : str.append(" ").append(url));
-    auto it = map_invokers_.find(std::string(key));
-    if (it != map_invokers_.end()) {
-      auto &pair = it->second;
-      if (method[0] < 'A' || method[0] > 'Z')
-        return false;
-
-      if (pair.first[method[0] - 65] == 0) {
-        return false;
+             response &res) {
+    // stays valid until this io thread is done with the request, see
+    // reclaim()
+    auto routes = current_.load(std::memory_order_acquire);
+    if (auto tree = routes->routes_of(method)) {
+      if (auto handler = tree->find(url, req.get_path_params())) {
+        (*handler)(req, res);
+        return true;
       }
-
-      pair.second(req, res);
-      return true;
     }
-    else {
-      bool is_wild_card = get_wildcard_function(key, req, res);
-      if (!is_wild_card) {
-        return route(method, STATIC_RESOURCE, req, res, true);
-      }
 
-      return is_wild_card;
+    // anything else may be a file
+    auto &[arr, handler] = routes->static_invoker;
+    if (!handler || method.empty() || method[0] < 'A' || method[0] > 'Z' ||
+        arr[method[0] - 65] == 0) {
+      return false;
     }
+    handler(req, res);
+    return true;
+  }
+
+  // bumped by every change of the routes
+  uint64_t version() const {
+    std::lock_guard lock(write_mtx_);
+    return version_;
+  }
+
+  // frees the routes replaced up to version. The caller makes sure that no
+  // route() started before then is still running: every io thread has run
+  // a handler posted after the change, or none runs yet.
+  void reclaim(uint64_t version) {
+    std::lock_guard lock(write_mtx_);
+    std::erase_if(retired_, [version](auto &retired) {
+      return retired.first <= version;
+    });
   }
 
  private:
-  bool get_wildcard_function(std::string_view key, request &req,
-                             response &res) {
-    for (auto &pair : wildcard_invokers_) {
-      if (key.find(pair.first) != std::string::npos) {
-        auto &t = pair.second;
-        t.second(req, res);
-        return true;
+  using handler_type = std::function<void(request &, response &)>;
+
+  // the routes route() reads, never changed once published: a change is
+  // made to a copy that replaces it, readers load it with one acquire.
+  struct route_snapshot {
+    // a tree of the routes of each method, in the order they were added
+    std::vector<std::pair<std::string, radix_tree<handler_type>>> routes;
+    // the handler of STATIC_RESOURCE, for the methods set in the array
+    std::pair<std::array<char, 26>, handler_type> static_invoker{};
+    // the paths of the stream_body routes, by method as well
+    std::vector<std::pair<std::string, radix_tree<bool>>> stream_routes;
+
+    radix_tree<handler_type> *routes_of(std::string_view method) {
+      return tree_of(routes, method);
+    }
+
+    const radix_tree<handler_type> *routes_of(std::string_view method) const {
+      return const_cast<route_snapshot *>(this)->routes_of(method);
+    }
+
+    radix_tree<bool> *stream_routes_of(std::string_view method) {
+      return tree_of(stream_routes, method);
+    }
+
+    const radix_tree<bool> *stream_routes_of(std::string_view method) const {
+      return const_cast<route_snapshot *>(this)->stream_routes_of(method);
+    }
+
+    template <typename Tree>
+    static Tree *tree_of(std::vector<std::pair<std::string, Tree>> &trees,
+                         std::string_view method) {
+      for (auto &[name, tree] : trees) {
+        if (name == method) {
+          return &tree;
+        }
       }
+      return nullptr;
     }
-    return false;
+  };
+
+  template <typename F>
+  void update(F &&change) {
+    std::lock_guard lock(write_mtx_);
+    auto old = current_.load(std::memory_order_relaxed);
+    auto next = std::make_unique<route_snapshot>(*old);
+    change(*next);
+    current_.store(next.release(), std::memory_order_release);
+    retired_.emplace_back(++version_,
+                          std::unique_ptr<const route_snapshot>(old));
+  }
+
+  void add_route(std::string_view method, std::string_view name,
+                 const std::array<char, 26> &arr, handler_type handler) {
+    update([&](route_snapshot &routes) {
+      if (name == STATIC_RESOURCE) {
+        routes.static_invoker = {arr, std::move(handler)};
+        return;
+      }
+      auto tree = routes.routes_of(method);
+      if (tree == nullptr) {
+        tree = &routes.routes
+                    .emplace_back(std::string(method),
+                                  radix_tree<handler_type>{})
+                    .second;
+      }
+      tree->insert(name, std::move(handler));
+    });
   }
 
   template <http_method... Is, class T, class Type, typename T1, typename... Ap>
   void register_handler_impl(std::string_view name, std::string_view methd_name,
                              Type T::*f, T1 t, const Ap &...ap) {
     auto arr = get_method_arr<Is...>();
-    std::string key;
-    key.append(methd_name).append(" ").append(name);
-    if constexpr (sizeof...(Is) > 0) {
-      register_member_func(key, arr, f, t, ap...);
-    }
-    else {
-      register_member_func(key, arr, f, t, ap...);
-    }
+    register_member_func(name, methd_name, arr, f, t, ap...);
   }
 
   template <typename Function, typename... AP>
@@ -114,26 +235,10 @@ class http_router {
                                std::string_view methd_name,
                                const std::array<char, 26> &arr, Function f,
                                const AP &...ap) {
-    std::string key;
-    if (raw_name == STATIC_RESOURCE) {
-      key = STATIC_RESOURCE;
-    }
-    else {
-      key.append(methd_name).append(" ").append(raw_name);
-    }
-
-    if (raw_name.back() == '*') {
-      this->wildcard_invokers_[key.substr(0, key.length() - 1)] = {
-          arr, std::bind(&http_router::invoke<Function, AP...>, this,
-                         std::placeholders::_1, std::placeholders::_2,
-                         std::move(f), ap...)};
-    }
-    else {
-      this->map_invokers_[key] = {
-          arr, std::bind(&http_router::invoke<Function, AP...>, this,
-                         std::placeholders::_1, std::placeholders::_2,
-                         std::move(f), ap...)};
-    }
+    add_route(methd_name, raw_name, arr,
+              std::bind(&http_router::invoke<Function, AP...>, this,
+                        std::placeholders::_1, std::placeholders::_2,
+                        std::move(f), ap...));
   }
 
   template <typename Function, typename... AP>
@@ -151,6 +256,12 @@ class http_router {
       // after
       do_void_after(req, res, tp);
     }
+    else if constexpr (is_lazy_v<result_type>) {
+      static_assert(std::is_void_v<typename result_type::ValueType>,
+                    "a coroutine handler must return Lazy<void>");
+      req.set_lazy_handler(
+          invoke_lazy(std::move(f), req, res, std::move(tp)));
+    }
     else {
       // business
       result_type result = f(req, res);
@@ -160,21 +271,14 @@ class http_router {
   }
 
   template <typename Function, typename Self, typename... AP>
-  void register_member_func(const std::string &raw_name,
+  void register_member_func(std::string_view raw_name,
+                            std::string_view methd_name,
                             const std::array<char, 26> &arr, Function f,
                             Self self, const AP &...ap) {
-    if (raw_name.back() == '*') {
-      this->wildcard_invokers_[raw_name.substr(0, raw_name.length() - 1)] = {
-          arr, std::bind(&http_router::invoke_mem<Function, Self, AP...>, this,
-                         std::placeholders::_1, std::placeholders::_2, f, self,
-                         ap...)};
-    }
-    else {
-      this->map_invokers_[raw_name] = {
-          arr, std::bind(&http_router::invoke_mem<Function, Self, AP...>, this,
-                         std::placeholders::_1, std::placeholders::_2, f, self,
-                         ap...)};
-    }
+    add_route(methd_name, raw_name, arr,
+              std::bind(&http_router::invoke_mem<Function, Self, AP...>, this,
+                        std::placeholders::_1, std::placeholders::_2, f, self,
+                        ap...));
   }
 
   template <typename Function, typename Self, typename... AP>
@@ -196,6 +300,22 @@ class http_router {
       // after
       do_void_after(req, res, tp);
     }
+    else if constexpr (is_lazy_v<result_type>) {
+      static_assert(std::is_void_v<typename result_type::ValueType>,
+                    "a coroutine handler must return Lazy<void>");
+      auto call = [f, self](request &req,
+                            response &res) -> async_simple::coro::Lazy<void> {
+        if (self) {
+          co_await (*self.*f)(req, res);
+        }
+        else {
+          nonpointer_type obj{};
+          co_await (obj.*f)(req, res);
+        }
+      };
+      req.set_lazy_handler(
+          invoke_lazy(std::move(call), req, res, std::move(tp)));
+    }
     else {
       // business
       result_type result;
@@ -208,6 +328,15 @@ class http_router {
     }
   }
 
+  // the frame holds the handler, and with it whatever it captured, until it
+  // is done; the after aspects run then.
+  template <typename Function, typename Tuple>
+  async_simple::coro::Lazy<void> invoke_lazy(Function f, request &req,
+                                             response &res, Tuple tp) {
+    co_await f(req, res);
+    do_void_after(req, res, tp);
+  }
+
   template <typename Tuple>
   bool do_ap_before(request &req, response &res, Tuple &tp) {
     bool r = true;
@@ -260,28 +389,12 @@ class http_router {
         std::make_index_sequence<std::tuple_size_v<Tuple>>{});
   }
 
-  typedef std::pair<std::array<char, 26>,
-                    std::function<void(request &, response &)>>
-      invoker_function;
-
-  struct string_hash {
-    using hash_type = std::hash<std::string_view>;
-    using is_transparent = void;
-
-    std::size_t operator()(const char *str) const { return hash_type{}(str); }
-    std::size_t operator()(std::string_view str) const {
-      return hash_type{}(str);
-    }
-    std::size_t operator()(std::string const &str) const {
-      return hash_type{}(str);
-    }
-  };
-
-  std::unordered_map<std::string, invoker_function, string_hash,
-                     std::equal_to<>>
-      map_invokers_;
-  std::unordered_map<std::string, invoker_function, string_hash,
-                     std::equal_to<>>
-      wildcard_invokers_;  // for url/*
+  std::atomic<const route_snapshot *> current_;
+  // replaced routes, with the version that replaced them
+  std::vector<std::pair<uint64_t, std::unique_ptr<const route_snapshot>>>
+      retired_;
+  uint64_t version_ = 0;
+  // serializes the writers
+  mutable std::mutex write_mtx_;
 };
 }  // namespace cinatra
@@ -1,18 +1,29 @@
 #pragma once
+#include <atomic>
 #include <string>
 #include <string_view>
 #include <vector>
 
 #include "connection.hpp"
+#include "content_codec.hpp"
 #include "cookie.hpp"
+#include "file_validators.hpp"
 #include "function_traits.hpp"
 #include "http_cache.hpp"
 #include "http_router.hpp"
 #include "io_service_pool.hpp"
+#include "offload_pool.hpp"
+#include "precompressed.hpp"
+#include "route_table.hpp"
 #include "router.hpp"
 #include "session_manager.hpp"
+#include "static_file_cache.hpp"
 #include "url_encode_decode.hpp"
 #include "use_asio.hpp"
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 namespace cinatra {
 
@@ -23,17 +34,39 @@ struct enable_cache {
   T value;
 };
 
+// passed to set_http_handler, the request body is not buffered but handed
+// to the handler as it is read, see connection::handle_stream_body. Such a
+// body has no size limit.
+struct stream_body {};
+
+// passed to set_http_handler, the handler runs on a worker of pool, or of
+// the offload pool of the server when it is null, and the io thread goes
+// on with other connections meanwhile. The response is written by the io
+// thread; a request finding the queue full is answered with 503.
+struct offload {
+  std::shared_ptr<offload_pool> pool;
+};
+
 template <typename ScoketType, class service_pool_policy = io_service_pool>
 class http_server_ : private noncopyable {
  public:
   using type = ScoketType;
   template <class... Args>
   explicit http_server_(Args &&...args)
-      : io_service_pool_(std::forward<Args>(args)...) {
+      : io_service_pool_(std::forward<Args>(args)...),
+        conn_shards_(io_service_pool_.size()) {
     http_cache::get().set_cache_max_age(86400);
+    compression_policy_.resolve();
     init_conn_callback();
   }
 
+  ~http_server_() {
+    stopped_ = true;
+    if (sidecar_thread_.joinable()) {
+      sidecar_thread_.join();
+    }
+  }
+
   void enable_http_cache(bool b) { http_cache::get().enable_cache(b); }
 
   void set_ssl_conf(ssl_configure conf) { ssl_conf_ = std::move(conf); }
@@ -99,68 +132,123 @@ class http_server_ : private noncopyable {
     asio::ip::tcp::resolver::iterator endpoints = resolver.resolve(query);
 
     bool r = false;
+    bool per_thread = false;
     std::string err_msg;
     for (; endpoints != asio::ip::tcp::resolver::iterator(); ++endpoints) {
       asio::ip::tcp::endpoint endpoint = *endpoints;
 
-      acceptor_ = std::make_shared<asio::ip::tcp::acceptor>(
-          io_service_pool_.get_io_service());
-      acceptor_->open(endpoint.protocol());
-      acceptor_->set_option(asio::ip::tcp::acceptor::reuse_address(true));
-
+      size_t opened = acceptors_.size();
       try {
-        acceptor_->bind(endpoint);
-        acceptor_->listen();
-        start_accept();
+        if (reuse_port_ && reuse_port_supported(endpoint)) {
+          for (size_t i = 0; i < io_service_pool_.size(); ++i) {
+            auto acceptor = open_acceptor(io_service_pool_.get_io_service(i),
+                                          endpoint, i, true);
+            start_accept(std::move(acceptor), i);
+          }
+          per_thread = true;
+        }
+        else {
+          // without SO_REUSEPORT a second bind to the port fails
+          auto acceptor = open_acceptor(io_service_pool_.get_io_service(),
+                                        endpoint, 0, false);
+          start_accept(std::move(acceptor));
+        }
         r = true;
       } catch (const std::exception &ex) {
         err_msg = ex.what();
+        // those of the io_contexts before the failed one accept already
+        close_acceptors(opened);
 #ifdef DEBUG
         std::cout << ex.what() << "\n";
 #endif  // DEBUG
       }
     }
 
+#ifdef SO_INCOMING_CPU
+    if (per_thread && incoming_cpu_ && !pinned_) {
+      // the thread running io_context i goes to the cpu its acceptor asks
+      // the connections from, see open_acceptor
+      pinned_ = true;
+      auto cpus = std::max(1u, std::thread::hardware_concurrency());
+      for (size_t i = 0; i < io_service_pool_.size(); ++i) {
+        asio::post(io_service_pool_.get_io_service(i), [cpu = i % cpus] {
+          pin_thread(cpu);
+        });
+      }
+    }
+#else
+    (void)per_thread;
+#endif
+
     return {r, std::move(err_msg)};
   }
 
   void close_acceptor() {
-    asio::dispatch(acceptor_->get_executor(), [this]() {
-      asio::error_code ec;
-      acceptor_->cancel(ec);
-      acceptor_->close(ec);
-    });
+    for (auto &acceptor : acceptors_) {
+      asio::dispatch(acceptor->get_executor(), [acceptor]() {
+        asio::error_code ec;
+        acceptor->cancel(ec);
+        acceptor->close(ec);
+      });
+    }
   }
 
   void stop() {
     close_acceptor();
 
-    {
-      std::unique_lock lock(conns_mtx_);
-      for (auto &conn : conns_) {
-        if (!conn.second->has_close()) {
-          conn.second->async_close();
+    // each shard is only touched by its own io_context, so close its
+    // connections from there.
+    stopped_ = true;
+    for (size_t i = 0; i < conn_shards_.size(); ++i) {
+      asio::post(io_service_pool_.get_io_service(i), [this, i] {
+        auto conns = std::move(conn_shards_[i].conns);
+        conn_shards_[i].conns.clear();
+        for (auto &conn : conns) {
+          if (!conn.second->has_close()) {
+            conn.second->async_close();
+          }
         }
-      }
-
-      conns_.clear();
+      });
     }
+    asio::post(io_service_pool_.get_io_service(0), [this] {
+      static_cache_.unwatch();
+    });
 
     io_service_pool_.stop();
+    if (sidecar_thread_.joinable()) {
+      sidecar_thread_.join();
+    }
   }
 
   void run() {
     init_dir(static_dir_);
     init_dir(upload_dir_);
+#ifdef CINATRA_ENABLE_GZIP
+    if (generate_sidecars_ && !sidecar_thread_.joinable()) {
+      sidecar_thread_ = std::thread([this] {
+        generate_gzip_sidecars(static_dir_, stopped_);
+      });
+    }
+#endif
 
+    started_ = true;
     io_service_pool_.run();
   }
 
-  intptr_t run_one() { return io_service_pool_.run_one(); }
+  intptr_t run_one() {
+    started_ = true;
+    return io_service_pool_.run_one();
+  }
 
-  intptr_t poll() { return io_service_pool_.poll(); }
+  intptr_t poll() {
+    started_ = true;
+    return io_service_pool_.poll();
+  }
 
-  intptr_t poll_one() { return io_service_pool_.poll_one(); }
+  intptr_t poll_one() {
+    started_ = true;
+    return io_service_pool_.poll_one();
+  }
 
   asio::io_service &get_io_service() {
     return io_service_pool_.get_io_service();
@@ -183,6 +271,67 @@ class http_server_ : private noncopyable {
 
   void set_keep_alive_timeout(long seconds) { keep_alive_timeout_ = seconds; }
 
+  // routes with fixed paths served before the router, see route_table.
+  // One call through a std::function picks the table, the handler is then
+  // called directly. Unlike set_http_handler, only before run().
+  template <typename... Routes>
+  void set_route_table(route_table<Routes...> table) {
+    route_table_ = [table = std::move(table)](request &req,
+                                              response &res) mutable {
+      return table.dispatch(req.get_method(), req.get_url(), req, res);
+    };
+  }
+
+  // Routes replaced by a change are freed once every io thread has run a
+  // handler posted after it, a route() that read them is over then. One
+  // such round is pending at a time, it takes all changes made meanwhile
+  // along. Before the io threads run, nothing is routing.
+  void reclaim_routes() {
+    if (!started_) {
+      http_router_.reclaim(http_router_.version());
+      return;
+    }
+    if (reclaim_pending_.exchange(true)) {
+      return;
+    }
+
+    auto version = http_router_.version();
+    auto left = std::make_shared<std::atomic<size_t>>(io_service_pool_.size());
+    for (size_t i = 0; i < io_service_pool_.size(); ++i) {
+      asio::post(io_service_pool_.get_io_service(i), [this, left, version] {
+        if (--*left > 0) {
+          return;
+        }
+        http_router_.reclaim(version);
+        reclaim_pending_ = false;
+        if (http_router_.version() != version) {
+          reclaim_routes();
+        }
+      });
+    }
+  }
+
+  template <typename T>
+  void offload_pool_of(const T &t, std::shared_ptr<offload_pool> &pool) {
+    if constexpr (std::is_same_v<std::decay_t<T>, offload>) {
+      pool = t.pool;
+    }
+  }
+
+  // the pool of offload routes without one of their own, to be set before
+  // those are added. It is made with the defaults of offload_pool on first
+  // use otherwise.
+  void set_offload_pool(std::shared_ptr<offload_pool> pool) {
+    offload_pool_ = std::move(pool);
+  }
+
+  std::shared_ptr<offload_pool> get_offload_pool() {
+    if (!offload_pool_) {
+      offload_pool_ = std::make_shared<offload_pool>();
+    }
+    return offload_pool_;
+  }
+
   template <typename T>
   bool need_cache(T &&t) {
     if constexpr (std::is_same_v<T, enable_cache<bool>>) {
@@ -196,7 +345,64 @@ class http_server_ : private noncopyable {
   // set http handlers
   template <http_method... Is, typename Function, typename... AP>
   void set_http_handler(std::string_view name, Function &&f, AP &&...ap) {
-    if constexpr (has_type<enable_cache<bool>,
+    if constexpr (has_type<stream_body,
+                           std::tuple<std::decay_t<AP>...>>::value) {
+      static_assert(sizeof...(Is) > 0, "stream_body needs the methods");
+      static_assert(!has_type<offload, std::tuple<std::decay_t<AP>...>>::value,
+                    "stream_body handlers can't be offloaded");
+      if constexpr (!std::is_member_function_pointer_v<
+                        std::decay_t<Function>>) {
+        // pieces of the body live no longer than the handler call
+        static_assert(!is_lazy_v<std::invoke_result_t<Function, request &,
+                                                      response &>>,
+                      "stream_body handlers can't be coroutines");
+      }
+      (http_router_.add_stream_route(
+           std::string(method_name(Is)).append(" ").append(name)),
+       ...);
+      auto tp = filter<stream_body>(std::forward<AP>(ap)...);
+      auto lm = [this, name, &f](auto... ap) {
+        set_http_handler<Is...>(name, std::forward<Function>(f),
+                                std::move(ap)...);
+      };
+      std::apply(lm, std::move(tp));
+    }
+    else if constexpr (has_type<offload,
+                                std::tuple<std::decay_t<AP>...>>::value) {
+      static_assert(!std::is_member_function_pointer_v<std::decay_t<Function>>,
+                    "offload takes a callable handler");
+      if constexpr (!std::is_member_function_pointer_v<
+                        std::decay_t<Function>>) {
+        static_assert(std::is_void_v<std::invoke_result_t<Function, request &,
+                                                          response &>>,
+                      "an offloaded handler must return void");
+      }
+      std::shared_ptr<offload_pool> pool;
+      (offload_pool_of(ap, pool), ...);
+      if (!pool) {
+        pool = get_offload_pool();
+      }
+      auto tp = filter<offload>(std::forward<AP>(ap)...);
+      // an lvalue handler is copied, not moved from
+      auto lm = [this, name, pool,
+                 f = std::forward<Function>(f)](auto... ap) mutable {
+        set_http_handler<Is...>(
+            name,
+            [pool, f = std::move(f)](
+                request &req,
+                response &res) mutable -> async_simple::coro::Lazy<void> {
+              if (!co_await pool->run([&] {
+                    f(req, res);
+                  })) {
+                res.set_status_and_content(status_type::service_unavailable,
+                                           "server is busy");
+              }
+            },
+            std::move(ap)...);
+      };
+      std::apply(lm, std::move(tp));
+    }
+    else if constexpr (has_type<enable_cache<bool>,
                            std::tuple<std::decay_t<AP>...>>::value) {  // for
                                                                        // cache
       bool b = false;
@@ -213,15 +419,66 @@ class http_server_ : private noncopyable {
                                              std::move(ap)...);
       };
       std::apply(lm, std::move(tp));
+      reclaim_routes();
     }
     else {
       http_router_.register_handler<Is...>(name, std::forward<Function>(f),
                                            std::forward<AP>(ap)...);
+      reclaim_routes();
     }
   }
 
+  // like set_http_handler, safe while the server runs; requests already
+  // routed finish with the old handler.
+  template <http_method... Is>
+  void remove_http_handler(std::string_view name) {
+    static_assert(sizeof...(Is) > 0, "remove_http_handler needs the methods");
+    (http_router_.remove_handler(
+         std::string(method_name(Is)).append(" ").append(name)),
+     ...);
+    reclaim_routes();
+  }
+
   void set_res_cache_max_age(std::time_t seconds) {
     static_res_cache_max_age_ = seconds;
+    static_cache_.set_extra_headers(
+        seconds > 0 ? "Cache-Control: max-age=" + std::to_string(seconds) +
+                          "\r\n"
+                    : "");
+  }
+
+  // keeps up to bytes of static files in memory with their headers, 0, the
+  // default, turns it off. On Linux changed files are dropped through
+  // inotify, elsewhere the cache has to be cleared by hand.
+  void set_static_cache_max_bytes(size_t bytes) {
+    if (bytes > 0) {
+      static_cache_.watch(io_service_pool_.get_io_service(0));
+    }
+    static_cache_.set_max_bytes(bytes);
+  }
+
+  static_file_cache &static_cache() { return static_cache_; }
+
+  // serves the "<file>.br" or "<file>.gz" sibling of a static file to
+  // clients accepting it, with Vary: Accept-Encoding. With generate, and
+  // gzip enabled, missing .gz siblings of compressible files are written
+  // by a background thread once run() starts.
+  void set_static_sidecars(bool enable, bool generate = false) {
+    static_sidecars_ = enable;
+    generate_sidecars_ = generate;
+    static_cache_.set_sidecars(enable);
+  }
+
+  // which responses are compressed on the fly, see compression_policy.
+  // Handlers that set Content-Encoding themselves are left alone. The
+  // codecs are looked up here, register custom ones before.
+  void set_compression_policy(compression_policy policy) {
+    compression_policy_ = std::move(policy);
+    compression_policy_.resolve();
+  }
+
+  const compression_policy &get_compression_policy() const {
+    return compression_policy_;
   }
 
   std::time_t get_res_cache_max_age() { return static_res_cache_max_age_; }
@@ -266,25 +523,133 @@ class http_server_ : private noncopyable {
 
   void enable_timeout(bool enable) { enable_timeout_ = enable; }
 
+  // connections give their read buffer back to the thread's buffer_pool
+  // while waiting for an idle peer. Off by default, the extra non-blocking
+  // read per request costs throughput; it pays with many idle connections.
+  void set_release_idle_buffer(bool release) {
+    release_idle_buffer_ = release;
+  }
+
+  // max pipelined responses a connection batches into one write.
+  void set_max_pipeline_depth(size_t depth) { max_pipeline_depth_ = depth; }
+
   void enable_response_time(bool enable) { need_response_time_ = enable; }
 
+  // use the coroutine connection engine, see connection::coro_loop.
+  void enable_coro_connection(bool enable) { enable_coro_ = enable; }
+
+  // every io_context owns a SO_REUSEPORT acceptor, the kernel spreads the
+  // accepts and a connection stays on the thread which accepted it. with
+  // incoming_cpu the acceptor of the io_context i takes the connections
+  // handled by cpu i % cpus, SO_INCOMING_CPU, and the thread running the
+  // io_context is pinned to that cpu. Where SO_REUSEPORT is missing there
+  // is one acceptor as without it. should be called before listen.
+  void enable_reuse_port(bool enable, bool incoming_cpu = false) {
+    reuse_port_ = enable;
+    incoming_cpu_ = incoming_cpu;
+  }
+
   void set_transfer_type(transfer_type type) { transfer_type_ = type; }
 
+  // static files of at least size bytes are sent with sendfile(2) on plain
+  // tcp connections, 64KB by default.
+  void set_sendfile_min_size(int64_t size) { sendfile_min_size_ = size; }
+
   void on_connection(
       std::function<bool(std::shared_ptr<connection<ScoketType>>)> on_conn) {
     on_conn_ = std::move(on_conn);
   }
 
  private:
-  void start_accept() {
-    auto new_conn = std::make_shared<connection<ScoketType>>(
-        io_service_pool_.get_io_service(), ssl_conf_, max_req_buf_size_,
-        keep_alive_timeout_, http_handler_, upload_dir_,
-        upload_check_ ? &upload_check_ : nullptr);
+  // SO_REUSEPORT may be missing at compile time or refused by the kernel
+  static bool reuse_port_supported(const asio::ip::tcp::endpoint &endpoint) {
+#ifdef SO_REUSEPORT
+    asio::io_service svc;
+    asio::ip::tcp::acceptor probe(svc);
+    std::error_code ec;
+    probe.open(endpoint.protocol(), ec);
+    if (!ec) {
+      probe.set_option(
+          asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>(
+              true),
+          ec);
+    }
+    return !ec;
+#else
+    (void)endpoint;
+    return false;
+#endif
+  }
 
-    acceptor_->async_accept(
-        new_conn->tcp_socket(), [this, new_conn](const std::error_code &e) {
-          if (!acceptor_->is_open()) {
+  static void pin_thread(size_t cpu) {
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void)cpu;
+#endif
+  }
+
+  std::shared_ptr<asio::ip::tcp::acceptor> open_acceptor(
+      asio::io_service &io_service, const asio::ip::tcp::endpoint &endpoint,
+      size_t index, bool reuse_port) {
+    auto acceptor = std::make_shared<asio::ip::tcp::acceptor>(io_service);
+    acceptor->open(endpoint.protocol());
+    acceptor->set_option(asio::ip::tcp::acceptor::reuse_address(true));
+    if (reuse_port) {
+#ifdef SO_REUSEPORT
+      acceptor->set_option(
+          asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>(
+              true));
+#endif
+#ifdef SO_INCOMING_CPU
+      if (incoming_cpu_) {
+        auto cpus = std::max(1u, std::thread::hardware_concurrency());
+        acceptor->set_option(
+            asio::detail::socket_option::integer<SOL_SOCKET, SO_INCOMING_CPU>(
+                int(index % cpus)));
+      }
+#endif
+    }
+
+    acceptor->bind(endpoint);
+    acceptor->listen();
+    acceptors_.push_back(acceptor);
+    return acceptor;
+  }
+
+  // closes the acceptors from acceptors_[from] on and forgets them.
+  void close_acceptors(size_t from) {
+    for (size_t i = from; i < acceptors_.size(); ++i) {
+      asio::dispatch(acceptors_[i]->get_executor(),
+                     [acceptor = acceptors_[i]]() {
+                       asio::error_code ec;
+                       acceptor->cancel(ec);
+                       acceptor->close(ec);
+                     });
+    }
+    acceptors_.resize(from);
+  }
+
+  // own_index: accept into the acceptor's own io_context, or npos to spread
+  // the connections over the pool.
+  void start_accept(std::shared_ptr<asio::ip::tcp::acceptor> acceptor,
+                    size_t own_index = std::string::npos) {
+    size_t index =
+        own_index == std::string::npos ? io_service_pool_.next_index()
+                                       : own_index;
+    auto &io_service = io_service_pool_.get_io_service(index);
+    auto new_conn = std::make_shared<connection<ScoketType>>(
+        io_service, ssl_conf_, max_req_buf_size_, keep_alive_timeout_,
+        http_handler_, upload_dir_, upload_check_ ? &upload_check_ : nullptr);
+
+    auto &socket = new_conn->tcp_socket();
+    acceptor->async_accept(
+        socket, [this, acceptor, own_index, index, &io_service,
+                 new_conn](const std::error_code &e) mutable {
+          if (!acceptor->is_open()) {
             return;
           }
 
@@ -295,33 +660,24 @@ class http_server_ : private noncopyable {
             }
 
             new_conn->enable_response_time(need_response_time_);
+            new_conn->set_compression_policy(&compression_policy_);
+            // stream_body routes may be added while the server runs
+            new_conn->set_stream_body_check([this](request &req) {
+              return http_router_.is_stream_route(req);
+            });
             new_conn->enable_timeout(enable_timeout_);
-
-            int64_t conn_id = ++conn_id_;
-            {
-              std::unique_lock lock(conns_mtx_);
-              conns_.emplace(conn_id, new_conn);
-            }
-
-            new_conn->set_quit_callback(
-                [this](const uint64_t &id) {
-                  std::unique_lock lock(conns_mtx_);
-                  conns_.erase(id);
-                },
-                conn_id);
+            new_conn->enable_coro(enable_coro_);
+            new_conn->set_max_pipeline_depth(max_pipeline_depth_);
+            new_conn->set_release_idle_buffer(release_idle_buffer_);
 
             if (check_headers_) {
               new_conn->set_validate(max_header_len_, check_headers_);
             }
 
-            if (!on_conn_) {
-              new_conn->start();
-            }
-            else {
-              if (on_conn_(new_conn)) {
-                new_conn->start();
-              }
-            }
+            asio::dispatch(io_service, [this, index,
+                                        new_conn = std::move(new_conn)] {
+              register_conn(index, new_conn);
+            });
           }
           else {
             if (e == asio::error::operation_aborted) {
@@ -330,10 +686,37 @@ class http_server_ : private noncopyable {
             // LOG_INFO << "server::handle_accept: " << e.message();
           }
 
-          start_accept();
+          start_accept(std::move(acceptor), own_index);
         });
   }
 
+  // runs on the connection's own io_context.
+  void register_conn(size_t index,
+                     const std::shared_ptr<connection<ScoketType>> &conn) {
+    if (stopped_) {
+      conn->async_close();
+      return;
+    }
+
+    auto &shard = conn_shards_[index];
+    uint64_t conn_id = ++shard.conn_id;
+    shard.conns.emplace(conn_id, conn);
+    conn->set_quit_callback(
+        [this, index](const uint64_t &id) {
+          conn_shards_[index].conns.erase(id);
+        },
+        conn_id);
+
+    if (!on_conn_) {
+      conn->start();
+    }
+    else {
+      if (on_conn_(conn)) {
+        conn->start();
+      }
+    }
+  }
+
   void set_static_res_handler() {
     set_http_handler<POST, GET>(
         STATIC_RESOURCE,
@@ -356,7 +739,56 @@ class http_server_ : private noncopyable {
 
               std::string fullpath = static_dir_ + relative_file_name;
 
+              if (static_cache_.max_bytes() > 0 &&
+                  req.get_header_value(http_header::range).empty() &&
+                  req.get_header_value("cinatra_start_pos").empty()) {
+                if (auto file = static_cache_.get(fullpath)) {
+                  send_cached_file(req, res, file);
+                  return;
+                }
+              }
+
+              file_validators validators;
+              auto *v = get_file_validators(fullpath, validators) ? &validators
+                                                                   : nullptr;
+              sidecar side;
+              if (v && static_sidecars_ &&
+                  req.get_header_value(http_header::range).empty() &&
+                  find_sidecar(
+                      fullpath, *v,
+                      req.get_header_value(http_header::accept_encoding),
+                      side)) {
+                send_sidecar(req, res, side, req.get_mime(relative_file_name));
+                return;
+              }
+              if (v && is_not_modified_request(req, v->etag, v->mtime)) {
+                send_not_modified(res, v->etag, v->last_modified);
+                return;
+              }
+
+              if (v) {
+                req.save_request_static_file_size(v->size);
+                auto range_header = req.get_header_value(http_header::range);
+                if (!range_header.empty() && req.get_method() == "GET" &&
+                    is_if_range_fresh(req, *v) &&
+                    req.set_ranges(range_header, v->size) ==
+                        range_result::unsatisfiable) {
+                  res.add_header("Content-Range",
+                                 "bytes */" + std::to_string(v->size));
+                  res.set_status_and_content(
+                      status_type::range_not_satisfiable);
+                  return;
+                }
+              }
+
               auto mime = req.get_mime(relative_file_name);
+#ifdef CINATRA_HAS_SENDFILE
+              if constexpr (std::is_same_v<ScoketType, NonSSL>) {
+                if (send_file(req, fullpath, relative_file_name, mime, v)) {
+                  return;
+                }
+              }
+#endif
               auto in = std::make_shared<std::ifstream>(fullpath,
                                                         std::ios_base::binary);
               if (!in->is_open()) {
@@ -383,20 +815,39 @@ class http_server_ : private noncopyable {
 
               req.get_conn<ScoketType>()->set_tag(in);
 
-              if (is_small_file(in.get(), req)) {
-                send_small_file(res, in.get(), mime);
+              if (req.is_range() && req.get_ranges().size() > 1) {
+                int64_t length = 0;
+                for (auto &range : req.get_ranges()) {
+                  length += range.length();
+                }
+                if (length > 5 * 1024 * 1024) {
+                  // too much to be held in memory, the whole file is
+                  // streamed with a 200 instead
+                  req.clear_ranges();
+                }
+              }
+
+              if (req.is_range() &&
+                  (req.get_ranges().size() > 1 ||
+                   req.get_ranges()[0].length() <= 5 * 1024 * 1024)) {
+                send_ranges(req, res, *in, mime, v);
                 return;
               }
 
-              if (transfer_type_ == transfer_type::CHUNKED)
-                write_chunked_header(req, in, mime);
+              if (!req.is_range() && is_small_file(in.get(), req)) {
+                send_small_file(res, in.get(), mime, v);
+                return;
+              }
+
+              if (transfer_type_ == transfer_type::CHUNKED || req.is_range())
+                write_chunked_header(req, in, mime, v);
               else
                 write_ranges_header(
                     req, mime, fs::path(relative_file_name).filename().string(),
                     std::to_string(fs::file_size(fullpath)));
             } break;
             case cinatra::data_proc_state::data_continue: {
-              if (transfer_type_ == transfer_type::CHUNKED)
+              if (transfer_type_ == transfer_type::CHUNKED || req.is_range())
                 write_chunked_body(req);
               else
                 write_ranges_data(req);
@@ -420,6 +871,288 @@ class http_server_ : private noncopyable {
         enable_cache{false});
   }
 
+#ifdef CINATRA_HAS_SENDFILE
+  bool use_sendfile(int64_t file_size) const {
+#ifdef CINATRA_ENABLE_GZIP
+    // small files are sent compressed
+    return file_size > 5 * 1024 * 1024;
+#else
+    return file_size >= sendfile_min_size_;
+#endif
+  }
+
+  // sends the file with sendfile(2), false to fall back to reading it.
+  // Range requests always take this path, so the ranges never pass
+  // through user space.
+  bool send_file(request &req, const std::string &fullpath,
+                 std::string_view relative_file_name, std::string_view mime,
+                 const file_validators *validators) {
+    std::error_code ec;
+    if (!fs::is_regular_file(fullpath, ec)) {
+      return false;
+    }
+    int64_t file_size = fs::file_size(fullpath, ec);
+    if (ec || (!req.is_range() && !use_sendfile(file_size))) {
+      return false;
+    }
+#ifdef CINATRA_ENABLE_GZIP
+    // sendfile(2) can't compress, the chunked path can
+    if (transfer_type_ == transfer_type::CHUNKED &&
+        gzip_while_read(req, mime, file_size)) {
+      return false;
+    }
+#endif
+
+    int fd = ::open(fullpath.data(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      return false;
+    }
+
+    int64_t start = 0;
+    auto start_sv = req.get_header_value("cinatra_start_pos");
+    if (!start_sv.empty() && !req.is_range()) {
+      start = (int64_t)atoll(std::string(start_sv).data());
+    }
+    if (start < 0 || start > file_size) {
+      start = 0;
+    }
+    req.save_request_static_file_size(file_size);
+
+    std::string header_str = req.is_range() ? "HTTP/1.1 206 Partial Content\r\n"
+                                            : "HTTP/1.1 200 OK\r\n";
+    header_str.append(
+        "Access-Control-Allow-origin: *\r\nAccept-Ranges: bytes\r\n");
+    if (transfer_type_ == transfer_type::ACCEPT_RANGES &&
+        file_size > 5 * 1024 * 1024) {
+      header_str.append("Content-Disposition: attachment;filename=")
+          .append(fs::path(relative_file_name).filename().string())
+          .append("\r\n");
+    }
+    if (static_res_cache_max_age_ > 0) {
+      header_str.append("Cache-Control: max-age=")
+          .append(std::to_string(static_res_cache_max_age_))
+          .append("\r\n");
+    }
+    if (validators) {
+      header_str.append(validators->to_headers());
+    }
+    if (varies_by_encoding()) {
+      header_str.append("Vary: Accept-Encoding\r\n");
+    }
+
+    auto &ranges = req.get_ranges();
+    if (ranges.size() > 1) {
+      auto layout = make_byteranges_layout(ranges, file_size, mime);
+      header_str.append("Content-Type: multipart/byteranges; boundary=")
+          .append(layout.boundary)
+          .append("\r\nContent-Length: ")
+          .append(std::to_string(layout.content_length))
+          .append("\r\nServer: cinatra\r\n\r\n");
+
+      std::vector<sendfile_part> parts;
+      parts.reserve(ranges.size() + 1);
+      for (size_t i = 0; i < ranges.size(); ++i) {
+        parts.push_back({std::move(layout.parts[i]), ranges[i].first,
+                         ranges[i].length()});
+      }
+      parts[0].head.insert(0, header_str);
+      parts.push_back({std::move(layout.closing), 0, 0});
+      req.get_conn<ScoketType>()->write_file(std::move(parts), fd);
+      return true;
+    }
+
+    int64_t count = file_size - start;
+    header_str.append("Content-Type: ").append(mime).append(
+        "; charset=utf8\r\n");
+    if (req.is_range()) {
+      start = ranges[0].first;
+      count = ranges[0].length();
+      header_str.append("Content-Range: ")
+          .append(content_range(ranges[0], file_size))
+          .append("\r\n");
+    }
+    header_str.append("Content-Length: ")
+        .append(std::to_string(count))
+        .append("\r\nServer: cinatra\r\n\r\n");
+
+    req.get_conn<ScoketType>()->write_file(std::move(header_str), fd, start,
+                                           count);
+    return true;
+  }
+#endif
+
+  void send_cached_file(request &req, response &res,
+                        const std::shared_ptr<const static_file> &file) {
+    auto &validators = file->validators;
+    auto accept = req.get_header_value(http_header::accept_encoding);
+    int br_q = file->br_body.empty() ? 0 : accept_encoding_q(accept, "br");
+    int gzip_q =
+        file->gzip_body.empty() ? 0 : accept_encoding_q(accept, "gzip");
+    const std::string *etag = &validators.etag;
+    const std::string *header = &file->header;
+    std::string_view body = file->body;
+    if (br_q > 0 && br_q >= gzip_q) {
+      etag = &file->br_etag;
+      header = &file->br_header;
+      body = file->br_body;
+    }
+    else if (gzip_q > 0) {
+      etag = &file->gzip_etag;
+      header = &file->gzip_header;
+      body = file->gzip_body;
+    }
+
+    if (is_not_modified_request(req, *etag, validators.mtime)) {
+      send_not_modified(res, *etag, validators.last_modified);
+      return;
+    }
+    res.set_prebuilt_response(*header, body, file);
+  }
+
+  void send_sidecar(request &req, response &res, const sidecar &side,
+                    std::string_view mime) {
+    auto &validators = side.validators;
+    if (is_not_modified_request(req, validators.etag, validators.mtime)) {
+      send_not_modified(res, validators.etag, validators.last_modified);
+      return;
+    }
+
+    std::string head = "HTTP/1.1 200 OK\r\n";
+    head.append("Access-Control-Allow-origin: *\r\nContent-Type: ")
+        .append(mime)
+        .append("; charset=utf8\r\nContent-Encoding: ")
+        .append(side.encoding)
+        .append("\r\nVary: Accept-Encoding\r\n");
+    if (static_res_cache_max_age_ > 0) {
+      head.append("Cache-Control: max-age=")
+          .append(std::to_string(static_res_cache_max_age_))
+          .append("\r\n");
+    }
+    head.append(validators.to_headers())
+        .append("Content-Length: ")
+        .append(std::to_string(validators.size))
+        .append("\r\nServer: cinatra\r\n");
+
+#ifdef CINATRA_HAS_SENDFILE
+    if constexpr (std::is_same_v<ScoketType, NonSSL>) {
+      int fd = ::open(side.path.data(), O_RDONLY | O_CLOEXEC);
+      if (fd >= 0) {
+        req.get_conn<ScoketType>()->write_file(head.append("\r\n"), fd, 0,
+                                               validators.size);
+        return;
+      }
+    }
+#endif
+    // the head and the body live until the response is written
+    auto data = std::make_shared<std::pair<std::string, std::string>>();
+    data->first = std::move(head);
+    std::ifstream in(side.path, std::ios::binary);
+    data->second.resize(size_t(validators.size));
+    in.read(data->second.data(), validators.size);
+    if (size_t(in.gcount()) != data->second.size()) {
+      res.set_status_and_content(status_type::internal_server_error);
+      return;
+    }
+    res.set_prebuilt_response(data->first, data->second, data);
+  }
+
+  // whether a static file can be sent in more than one content coding.
+  bool varies_by_encoding() const {
+#ifdef CINATRA_ENABLE_GZIP
+    return true;
+#else
+    return static_sidecars_ || compression_policy_.enabled;
+#endif
+  }
+
+  // If-Range, RFC 7233 section 3.2: the ranges are only sent when the
+  // validator still matches, strongly for an ETag, otherwise the whole
+  // file is.
+  bool is_if_range_fresh(request &req, const file_validators &validators) {
+    auto if_range = trim(req.get_header_value(http_header::if_range));
+    if (if_range.empty()) {
+      return true;
+    }
+    if (if_range[0] == '"') {
+      return if_range == validators.etag;
+    }
+    if (if_range.size() > 2 && if_range[0] == 'W' && if_range[1] == '/') {
+      return false;
+    }
+    auto [ok, date] = get_timestamp(std::string(if_range));
+    return ok && date == validators.mtime;
+  }
+
+  // answers a range request from memory, one range or a
+  // multipart/byteranges body of several.
+  void send_ranges(request &req, response &res, std::ifstream &in,
+                   std::string_view mime, const file_validators *validators) {
+    auto &ranges = req.get_ranges();
+    int64_t size = req.get_request_static_file_size();
+    auto read_range = [&in](const byte_range &range, std::string &out) {
+      size_t pos = out.size();
+      out.resize(pos + size_t(range.length()));
+      in.clear();
+      in.seekg(range.first);
+      in.read(out.data() + pos, range.length());
+      out.resize(pos + size_t(in.gcount()));
+    };
+
+    res.add_header("Access-Control-Allow-origin", "*");
+    res.add_header("Accept-Ranges", "bytes");
+    if (static_res_cache_max_age_ > 0) {
+      res.add_header("Cache-Control",
+                     "max-age=" + std::to_string(static_res_cache_max_age_));
+    }
+    if (validators) {
+      res.add_header("ETag", std::string(validators->etag));
+      res.add_header("Last-Modified", std::string(validators->last_modified));
+    }
+
+    std::string body;
+    if (ranges.size() == 1) {
+      res.add_header("Content-Type", std::string(mime) + "; charset=utf8");
+      res.add_header("Content-Range", content_range(ranges[0], size));
+      read_range(ranges[0], body);
+    }
+    else {
+      auto layout = make_byteranges_layout(ranges, size, mime);
+      res.add_header("Content-Type",
+                     "multipart/byteranges; boundary=" + layout.boundary);
+      body.reserve(size_t(layout.content_length));
+      for (size_t i = 0; i < ranges.size(); ++i) {
+        body.append(layout.parts[i]);
+        read_range(ranges[i], body);
+      }
+      body.append(layout.closing);
+    }
+    res.set_status_and_content(status_type::partial_content, std::move(body));
+  }
+
+  bool is_not_modified_request(request &req, std::string_view etag,
+                               std::time_t mtime) const {
+    return req.get_method() == "GET" &&
+           is_not_modified(req.get_header_value(http_header::if_none_match),
+                           req.get_header_value(http_header::if_modified_since),
+                           etag, mtime);
+  }
+
+  // 304 without a body, with the headers a 200 would have had to update
+  // the cached response.
+  void send_not_modified(response &res, std::string_view etag,
+                         std::string_view last_modified) {
+    res.add_header("ETag", std::string(etag));
+    res.add_header("Last-Modified", std::string(last_modified));
+    if (varies_by_encoding()) {
+      res.add_header("Vary", "Accept-Encoding");
+    }
+    if (static_res_cache_max_age_ > 0) {
+      res.add_header("Cache-Control",
+                     "max-age=" + std::to_string(static_res_cache_max_age_));
+    }
+    res.set_status_and_content(status_type::not_modified);
+  }
+
   bool is_small_file(std::ifstream *in, request &req) const {
     auto file_begin = in->tellg();
     in->seekg(0, std::ios_base::end);
@@ -429,11 +1162,17 @@ class http_server_ : private noncopyable {
     return file_size <= 5 * 1024 * 1024;
   }
 
+  // compressed by the response as the compression policy says, the ETag
+  // of the compressed representation gets a suffix.
   void send_small_file(response &res, std::ifstream *in,
-                       std::string_view mime) {
+                       std::string_view mime,
+                       const file_validators *validators) {
     res.add_header("Access-Control-Allow-origin", "*");
     res.add_header("Content-type",
                    std::string(mime.data(), mime.size()) + "; charset=utf8");
+    if (varies_by_encoding()) {
+      res.add_header("Vary", "Accept-Encoding");
+    }
     std::stringstream file_buffer;
     file_buffer << in->rdbuf();
     if (static_res_cache_max_age_ > 0) {
@@ -441,20 +1180,27 @@ class http_server_ : private noncopyable {
           std::string("max-age=") + std::to_string(static_res_cache_max_age_);
       res.add_header("Cache-Control", max_age.data());
     }
-#ifdef CINATRA_ENABLE_GZIP
-    res.set_status_and_content(status_type::ok, file_buffer.str(),
-                               req_content_type::none, content_encoding::gzip);
-#else
+    if (validators) {
+      res.add_header("ETag", std::string(validators->etag));
+      res.add_header("Last-Modified", std::string(validators->last_modified));
+    }
     res.set_status_and_content(status_type::ok, file_buffer.str());
-#endif
   }
 
-  void write_chunked_header(request &req, std::shared_ptr<std::ifstream> in,
-                            std::string_view mime) {
-    auto range_header = req.get_header_value("range");
-    req.set_range_flag(!range_header.empty());
-    req.set_range_start_pos(range_header);
+#ifdef CINATRA_ENABLE_GZIP
+  // whether a static file too big to be held in memory is sent chunked and
+  // gzip'ed
+  bool gzip_while_read(request &req, std::string_view mime,
+                       int64_t size) const {
+    return !req.is_range() && compression_policy_.compressible(mime, size) &&
+           accepts_encoding(req.get_header_value(http_header::accept_encoding),
+                            "gzip");
+  }
+#endif
 
+  void write_chunked_header(request &req, std::shared_ptr<std::ifstream> in,
+                            std::string_view mime,
+                            const file_validators *validators) {
     std::string res_content_header =
         std::string(mime.data(), mime.size()) + "; charset=utf8";
     res_content_header +=
@@ -467,16 +1213,32 @@ class http_server_ : private noncopyable {
       res_content_header +=
           std::string("\r\n") + std::string("Cache-Control: ") + max_age;
     }
+    std::string_view coding;
+#ifdef CINATRA_ENABLE_GZIP
+    // compressed while it is read, without holding the file in memory
+    if (gzip_while_read(req, mime, req.get_request_static_file_size()) &&
+        req.get_conn<ScoketType>()->enable_chunked_gzip()) {
+      coding = "gzip";
+    }
+#endif
+    if (varies_by_encoding()) {
+      res_content_header += "\r\nVary: Accept-Encoding";
+    }
+    if (validators) {
+      // is_not_modified() matches the gzip tag against validators->etag
+      res_content_header += "\r\nETag: " +
+                            (coding.empty()
+                                 ? validators->etag
+                                 : coded_etag(validators->etag, coding)) +
+                            "\r\nLast-Modified: " + validators->last_modified;
+    }
 
     if (req.is_range()) {
-      std::int64_t file_pos = req.get_range_start_pos();
-      in->seekg(file_pos);
-      auto end_str = std::to_string(req.get_request_static_file_size());
+      auto &range = req.get_ranges()[0];
+      in->seekg(range.first);
       res_content_header +=
-          std::string("\r\n") + std::string("Content-Range: bytes ") +
-          std::to_string(file_pos) + std::string("-") +
-          std::to_string(req.get_request_static_file_size() - 1) +
-          std::string("/") + end_str;
+          "\r\nContent-Range: " +
+          content_range(range, req.get_request_static_file_size());
     }
     req.get_conn<ScoketType>()->write_chunked_header(
         std::string_view(res_content_header), req.is_range());
@@ -515,11 +1277,18 @@ class http_server_ : private noncopyable {
   std::string get_send_data(request &req, const size_t len) {
     auto conn = req.get_conn<ScoketType>();
     auto in = std::any_cast<std::shared_ptr<std::ifstream>>(conn->get_tag());
+    size_t to_read = len;
+    if (req.is_range()) {
+      // up to the end of the range
+      int64_t left = req.get_ranges()[0].last + 1 - int64_t(in->tellg());
+      to_read = size_t((std::max)(left, int64_t(0)));
+      to_read = (std::min)(to_read, len);
+    }
     std::string str;
-    str.resize(len);
-    in->read(&str[0], len);
+    str.resize(to_read);
+    in->read(&str[0], to_read);
     size_t read_len = (size_t)in->gcount();
-    if (read_len != len) {
+    if (read_len != to_read) {
       str.resize(read_len);
     }
 
@@ -529,9 +1298,10 @@ class http_server_ : private noncopyable {
   void init_conn_callback() {
     set_static_res_handler();
     http_handler_ = [this](request &req, response &res) {
-      res.set_headers(req.get_headers());
+      res.set_headers(req.get_header_index());
       try {
         bool success =
+            (route_table_ && route_table_(req, res)) ||
             http_router_.route(req.get_method(), req.get_url(), req, res);
         if (!success) {
           if (not_found_) {
@@ -588,17 +1358,26 @@ class http_server_ : private noncopyable {
   }
 
   service_pool_policy io_service_pool_;
+  // after io_service_pool_, its inotify descriptor is bound to an io_context
+  static_file_cache static_cache_;
+  bool static_sidecars_ = false;
+  bool generate_sidecars_ = false;
+  std::thread sidecar_thread_;
 
   std::size_t max_req_buf_size_ =
       3 * 1024 * 1024;            // max request buffer size 3M
   long keep_alive_timeout_ = 60;  // max request timeout 60s
 
   http_router http_router_;
+  std::function<bool(request &, response &)> route_table_;
   std::string static_dir_ = fs::absolute("www").string();  // default
+  int64_t sendfile_min_size_ = 64 * 1024;
   std::string upload_dir_ = fs::absolute("www").string();  // default
   std::time_t static_res_cache_max_age_ = 0;
 
   bool enable_timeout_ = true;
+  size_t max_pipeline_depth_ = 16;
+  bool release_idle_buffer_ = false;
   http_handler http_handler_ = nullptr;
   std::function<bool(request &req, response &res)> download_check_;
   std::vector<std::string> relate_paths_;
@@ -615,11 +1394,24 @@ class http_server_ : private noncopyable {
   transfer_type transfer_type_ = transfer_type::CHUNKED;
   ssl_configure ssl_conf_;
   bool need_response_time_ = false;
-  std::shared_ptr<asio::ip::tcp::acceptor> acceptor_;
-
-  uint64_t conn_id_ = 0;
-  std::unordered_map<uint64_t, std::shared_ptr<connection<ScoketType>>> conns_;
-  std::mutex conns_mtx_;
+  compression_policy compression_policy_;
+  std::shared_ptr<offload_pool> offload_pool_;
+  bool enable_coro_ = false;
+  bool reuse_port_ = false;
+  bool incoming_cpu_ = false;
+  bool pinned_ = false;
+  std::vector<std::shared_ptr<asio::ip::tcp::acceptor>> acceptors_;
+
+  // live connections of one io_context, only touched by that io_context.
+  struct alignas(64) conn_shard {
+    uint64_t conn_id = 0;
+    std::unordered_map<uint64_t, std::shared_ptr<connection<ScoketType>>>
+        conns;
+  };
+  std::vector<conn_shard> conn_shards_;
+  std::atomic<bool> stopped_ = false;
+  std::atomic<bool> started_ = false;
+  std::atomic<bool> reclaim_pending_ = false;
 };
 
 template <typename T>
@@ -65,6 +65,21 @@ class io_service_pool {
     return io_service;
   }
 
+  std::size_t size() const { return io_contexts_.size(); }
+
+  // round robin index of the next io_context, for get_io_service(index).
+  std::size_t next_index() {
+    std::size_t index = next_io_context_;
+    ++next_io_context_;
+    if (next_io_context_ == io_contexts_.size())
+      next_io_context_ = 0;
+    return index;
+  }
+
+  asio::io_service &get_io_service(std::size_t index) {
+    return *io_contexts_[index];
+  }
+
  private:
   using io_context_ptr = std::shared_ptr<asio::io_context>;
   using work_ptr = std::shared_ptr<asio::io_context::work>;
@@ -90,15 +105,18 @@ class io_service_inplace : private noncopyable {
 
   intptr_t poll_one() { return io_services_->poll_one(); }
 
-  void stop() {
-    work_ = nullptr;
-
-    if (io_services_)
-      io_services_->stop();
-  }
+  // run() returns once the handlers posted before, e.g. those closing the
+  // connections, are done, as with io_service_pool.
+  void stop() { work_ = nullptr; }
 
   asio::io_service &get_io_service() { return *io_services_; }
 
+  std::size_t size() const { return 1; }
+
+  std::size_t next_index() { return 0; }
+
+  asio::io_service &get_io_service(std::size_t) { return *io_services_; }
+
  private:
   using io_service_ptr = std::shared_ptr<asio::io_service>;
   using work_ptr = std::shared_ptr<asio::io_service::work>;
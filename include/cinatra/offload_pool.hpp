@@ -0,0 +1,136 @@
+#pragma once
+#include <algorithm>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "utils.hpp"
+
+namespace cinatra {
+// Worker threads for handlers too heavy for an io thread, rendering,
+// resizing images, encoding large documents. The queue is bounded: a job
+// that finds it full is refused, the server answers 503 then instead of
+// letting the latency of every queued request grow without end.
+class offload_pool : private noncopyable {
+ public:
+  explicit offload_pool(
+      size_t threads = (std::max)(std::thread::hardware_concurrency(), 1u),
+      size_t max_queue = 1024)
+      : max_queue_(max_queue == 0 ? 1 : max_queue) {
+    if (threads == 0) {
+      threads = 1;
+    }
+    for (size_t i = 0; i < threads; ++i) {
+      workers_.emplace_back([this] {
+        work();
+      });
+    }
+  }
+
+  // the queued jobs are run before the threads quit
+  ~offload_pool() {
+    {
+      std::lock_guard lock(mtx_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    for (auto &t : workers_) {
+      t.join();
+    }
+  }
+
+  // false when the queue is full
+  bool try_post(std::function<void()> job) {
+    {
+      std::lock_guard lock(mtx_);
+      if (stop_ || jobs_.size() >= max_queue_) {
+        return false;
+      }
+      jobs_.push_back(std::move(job));
+    }
+    cv_.notify_one();
+    return true;
+  }
+
+  // co_await pool.run(f) calls f on a worker; the result is false, and f
+  // is not called, when the queue is full. What f throws is thrown by the
+  // co_await. A Lazy resumes on its executor.
+  template <typename F>
+  auto run(F f) {
+    struct awaiter {
+      awaiter(offload_pool &pool, F f) : pool(pool), f(std::move(f)) {}
+
+      offload_pool &pool;
+      F f;
+      bool accepted = false;
+      std::exception_ptr error = nullptr;
+
+      bool await_ready() const noexcept { return false; }
+      bool await_suspend(std::coroutine_handle<> handle) {
+        // the awaiter may be gone once the job is posted
+        accepted = true;
+        bool posted = pool.try_post([this, handle] {
+          try {
+            f();
+          } catch (...) {
+            error = std::current_exception();
+          }
+          handle.resume();
+        });
+        if (!posted) {
+          accepted = false;
+        }
+        return posted;
+      }
+      bool await_resume() {
+        if (error) {
+          std::rethrow_exception(error);
+        }
+        return accepted;
+      }
+    };
+    return awaiter(*this, std::move(f));
+  }
+
+  // jobs waiting for a worker
+  size_t queue_size() const {
+    std::lock_guard lock(mtx_);
+    return jobs_.size();
+  }
+
+  size_t max_queue() const { return max_queue_; }
+
+  size_t size() const { return workers_.size(); }
+
+ private:
+  void work() {
+    while (true) {
+      std::function<void()> job;
+      {
+        std::unique_lock lock(mtx_);
+        cv_.wait(lock, [this] {
+          return stop_ || !jobs_.empty();
+        });
+        if (jobs_.empty()) {
+          return;
+        }
+        job = std::move(jobs_.front());
+        jobs_.pop_front();
+      }
+      job();
+    }
+  }
+
+  const size_t max_queue_;
+  mutable std::mutex mtx_;
+  std::condition_variable cv_;
+  std::deque<std::function<void()>> jobs_;
+  bool stop_ = false;
+  std::vector<std::thread> workers_;
+};
+}  // namespace cinatra
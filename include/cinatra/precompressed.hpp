@@ -0,0 +1,123 @@
+#pragma once
+#include <atomic>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "accept_encoding.hpp"
+#include "compression_policy.hpp"
+#include "define.h"
+#include "file_validators.hpp"
+#include "mime_types.hpp"
+#ifdef CINATRA_ENABLE_GZIP
+#include "gzip.hpp"
+#endif
+
+namespace cinatra {
+// precompressed siblings of static files, "app.js.br" and "app.js.gz" for
+// "app.js", served instead of the file when the client accepts them.
+struct sidecar {
+  std::string_view encoding;
+  std::string path;
+  file_validators validators;
+};
+
+// content coding and suffix, preferred first on equal qvalues.
+inline constexpr std::pair<std::string_view, std::string_view>
+    sidecar_encodings[] = {{"br", ".br"}, {"gzip", ".gz"}};
+
+// the sidecar of path the client prefers, only one that is not older than
+// the file itself counts.
+inline bool find_sidecar(const std::string &path,
+                         const file_validators &original,
+                         std::string_view accept_encoding, sidecar &out) {
+  if (accept_encoding.empty()) {
+    return false;
+  }
+
+  int best_q = 0;
+  for (auto [encoding, suffix] : sidecar_encodings) {
+    int q = accept_encoding_q(accept_encoding, encoding);
+    if (q <= best_q) {
+      continue;
+    }
+
+    file_validators validators;
+    std::string sidecar_path = path + std::string(suffix);
+    if (!get_file_validators(sidecar_path, validators) ||
+        validators.mtime < original.mtime) {
+      continue;
+    }
+
+    best_q = q;
+    out.encoding = encoding;
+    out.path = std::move(sidecar_path);
+    out.validators = std::move(validators);
+  }
+  return best_q > 0;
+}
+
+#ifdef CINATRA_ENABLE_GZIP
+// writes "<file>.gz" for each compressible file under dir without a fresh
+// one, meant to run once in the background at startup. Returns how many
+// were written, stops early when stop is set.
+inline size_t generate_gzip_sidecars(const std::string &dir,
+                                     const std::atomic<bool> &stop) {
+  // smaller files hardly shrink
+  constexpr uintmax_t min_size = 256;
+  size_t count = 0;
+  std::error_code ec;
+  for (auto it = fs::recursive_directory_iterator(dir, ec);
+       !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+    if (stop) {
+      break;
+    }
+
+    std::error_code file_ec;
+    if (!it->is_regular_file(file_ec) || it->file_size(file_ec) < min_size) {
+      continue;
+    }
+    auto path = it->path().string();
+    auto extension = it->path().extension().string();
+    if (extension == ".gz" || extension == ".br" ||
+        !is_compressible_mime(get_mime_type(extension))) {
+      continue;
+    }
+
+    file_validators original, existing;
+    if (!get_file_validators(path, original) ||
+        (get_file_validators(path + ".gz", existing) &&
+         existing.mtime >= original.mtime)) {
+      continue;
+    }
+
+    std::ifstream in(path, std::ios::binary);
+    std::string content((std::istreambuf_iterator<char>(in)),
+                        std::istreambuf_iterator<char>());
+    std::string compressed;
+    if (!in || !gzip_codec::compress(content, compressed, 9) ||
+        compressed.size() >= content.size()) {
+      continue;
+    }
+
+    // readers never see a partial sidecar
+    auto tmp = path + ".gz.tmp";
+    {
+      std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+      out.write(compressed.data(), compressed.size());
+      if (!out) {
+        continue;
+      }
+    }
+    fs::rename(tmp, path + ".gz", file_ec);
+    if (file_ec) {
+      fs::remove(tmp, file_ec);
+      continue;
+    }
+    ++count;
+  }
+  return count;
+}
+#endif
+}  // namespace cinatra
@@ -0,0 +1,195 @@
+#pragma once
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "buffer_pool.hpp"
+#include "utils.hpp"
+
+namespace cinatra {
+// key/value pairs of a query string or an urlencoded body, in the order
+// they appear, the first one of a key wins. The source is only split on
+// first access. Values are percent-decoded during the split into a scratch
+// buffer sized for the whole source, so the views stay valid and a request
+// with up to inline_size params does not touch the heap.
+class query_params {
+ public:
+  using value_type = std::pair<std::string_view, std::string_view>;
+  static constexpr size_t inline_size = 16;
+
+  query_params() = default;
+  query_params(const query_params &) = delete;
+  query_params &operator=(const query_params &) = delete;
+
+  // str has to outlive the params, or be set again when it moves.
+  void set_source(std::string_view str) {
+    clear();
+    source_ = str;
+    parsed_ = str.empty();
+  }
+
+  std::string_view source() const { return source_; }
+
+  // adds a value as it is, without decoding it.
+  void add(std::string_view key, std::string_view value) {
+    parse();
+    push(key, value);
+  }
+
+  void clear() {
+    source_ = {};
+    parsed_ = true;
+    size_ = 0;
+    overflow_.clear();
+    if (scratch_.capacity() > 0) {
+      scratch_.release();
+    }
+  }
+
+  size_t size() const {
+    parse();
+    return size_;
+  }
+
+  bool empty() const { return size() == 0; }
+
+  const value_type *begin() const {
+    parse();
+    return data();
+  }
+
+  const value_type *end() const { return begin() + size_; }
+
+  const value_type &operator[](size_t n) const { return begin()[n]; }
+
+  const value_type *find(std::string_view key) const {
+    for (auto it = begin(); it != end(); ++it) {
+      if (it->first == key) {
+        return it;
+      }
+    }
+    return nullptr;
+  }
+
+  // the decoded value, empty if there is no such key.
+  std::string_view get(std::string_view key) const {
+    auto it = find(key);
+    return it ? it->second : std::string_view{};
+  }
+
+  // decodes "%xx" and '+' like code_utils::url_decode, the result is
+  // written to out and followed by a '\0'. Returns its length.
+  static size_t url_decode(std::string_view str, char *out) {
+    size_t len = 0;
+    for (size_t i = 0; i < str.size(); ++i) {
+      char c = str[i];
+      if (c == '%' && i + 2 < str.size()) {
+        int hi = hex_value(str[i + 1]);
+        int lo = hex_value(str[i + 2]);
+        // strtol stops at the first character that is not a hex digit.
+        out[len++] = char(hi < 0 ? 0 : (lo < 0 ? hi : hi * 16 + lo));
+        i += 2;
+      }
+      else if (c == '+') {
+        out[len++] = ' ';
+      }
+      else {
+        out[len++] = c;
+      }
+    }
+    out[len] = '\0';
+    return len;
+  }
+
+ private:
+  static int hex_value(char c) {
+    if (c >= '0' && c <= '9')
+      return c - '0';
+    if (c >= 'a' && c <= 'f')
+      return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+      return c - 'A' + 10;
+    return -1;
+  }
+
+  value_type *data() const {
+    return overflow_.empty() ? inline_ : overflow_.data();
+  }
+
+  void push(std::string_view key, std::string_view value) const {
+    for (auto it = data(), last = it + size_; it != last; ++it) {
+      if (it->first == key) {
+        return;
+      }
+    }
+
+    if (size_ < inline_size) {
+      inline_[size_++] = {key, value};
+      return;
+    }
+
+    if (overflow_.empty()) {
+      overflow_.assign(inline_, inline_ + size_);
+    }
+    overflow_.emplace_back(key, value);
+    ++size_;
+  }
+
+  void push_decoded(std::string_view key, std::string_view value) const {
+    if (!is_form_url_encode(value)) {
+      push(key, value);
+      return;
+    }
+
+    if (scratch_.size() == 0) {
+      // decoded values never grow, the source plus one '\0' is enough.
+      scratch_.resize(source_.size() + 1);
+    }
+    char *out = scratch_.data() + scratch_used_;
+    size_t len = url_decode(value, out);
+    scratch_used_ += len + 1;
+    push(key, {out, len});
+  }
+
+  // same splitting as the std::map based parser it replaces, including
+  // a key being reused by a following value without '='.
+  void parse() const {
+    if (parsed_) {
+      return;
+    }
+    parsed_ = true;
+    scratch_used_ = 0;
+
+    std::string_view str = source_;
+    std::string_view key;
+    size_t pos = 0;
+    size_t length = str.length();
+    for (size_t i = 0; i < length; i++) {
+      char c = str[i];
+      if (c == '=') {
+        key = trim(str.substr(pos, i - pos));
+        pos = i + 1;
+      }
+      else if (c == '&') {
+        push_decoded(key, trim(str.substr(pos, i - pos)));
+        pos = i + 1;
+      }
+    }
+
+    if (pos == 0) {
+      size_ = 0;
+      return;
+    }
+
+    push_decoded(key, trim(str.substr(pos)));
+  }
+
+  std::string_view source_;
+  mutable bool parsed_ = true;
+  mutable size_t size_ = 0;
+  mutable value_type inline_[inline_size];
+  mutable std::vector<value_type> overflow_;
+  mutable pooled_buffer scratch_;
+  mutable size_t scratch_used_ = 0;
+};
+}  // namespace cinatra
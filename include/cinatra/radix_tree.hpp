@@ -0,0 +1,326 @@
+#pragma once
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace cinatra {
+// the captures of a matched route, name and value of each ":name" and
+// "*name" in pattern order. The names are interned for good, so they stay
+// valid when the routes change; the values are views into the url.
+class path_params {
+ public:
+  using value_type = std::pair<std::string_view, std::string_view>;
+
+  // empty when there is no such capture
+  std::string_view get(std::string_view name) const {
+    for (auto &[key, value] : params_) {
+      if (key == name) {
+        return value;
+      }
+    }
+    return {};
+  }
+
+  const value_type &operator[](size_t i) const { return params_[i]; }
+  size_t size() const { return params_.size(); }
+  bool empty() const { return params_.empty(); }
+  auto begin() const { return params_.begin(); }
+  auto end() const { return params_.end(); }
+
+  // keeps the capacity, a connection allocates only for its first requests
+  void clear() { params_.clear(); }
+
+ private:
+  template <typename T>
+  friend class radix_tree;
+
+  std::vector<value_type> params_;
+};
+
+// Routes keyed by path, a compressed trie of the static text with nodes
+// for the captures. A pattern is static text with, at the start of a
+// segment, ":name" matching up to the next '/' or, last, "*name" matching
+// the rest of the path, possibly empty; the name is optional. Static text
+// is tried before a parameter and a parameter before a catch-all, the
+// matching goes back when a branch fails, so the most specific route wins.
+// Matching is O(path length) unless captures have to be tried out, and
+// allocates nothing.
+template <typename T>
+class radix_tree {
+ public:
+  radix_tree() = default;
+  radix_tree(radix_tree &&) = default;
+  radix_tree &operator=(radix_tree &&) = default;
+
+  radix_tree(const radix_tree &other) { copy(root_, other.root_); }
+
+  radix_tree &operator=(const radix_tree &other) {
+    if (this != &other) {
+      root_ = node{};
+      copy(root_, other.root_);
+    }
+    return *this;
+  }
+
+  // replaces the value of an equal pattern, captures may be named anew
+  void insert(std::string_view pattern, T value) {
+    std::vector<std::string_view> names;
+    node *n = &root_;
+    while (!pattern.empty()) {
+      if (at_segment_start(n, pattern) && pattern[0] == ':') {
+        auto end = pattern.find('/');
+        names.push_back(intern(pattern.substr(1, end - 1)));
+        if (!n->param) {
+          n->param = std::make_unique<node>();
+        }
+        n = n->param.get();
+        pattern = end == std::string_view::npos ? std::string_view{}
+                                                : pattern.substr(end);
+      }
+      else if (at_segment_start(n, pattern) && pattern[0] == '*') {
+        names.push_back(intern(pattern.substr(1)));
+        if (!n->catch_all) {
+          n->catch_all = std::make_unique<node>();
+        }
+        n = n->catch_all.get();
+        pattern = {};
+      }
+      else {
+        size_t end = static_end(pattern);
+        n = insert_static(n, pattern.substr(0, end));
+        pattern = pattern.substr(end);
+      }
+    }
+    n->route.emplace(entry{std::move(value), std::move(names)});
+  }
+
+  // the value of the pattern given to insert(), false when there was none
+  bool erase(std::string_view pattern) {
+    node *n = find_pattern(pattern);
+    if (n == nullptr || !n->route) {
+      return false;
+    }
+    n->route.reset();
+    return true;
+  }
+
+  // the value of the best route for path, nullptr when none matches.
+  // params holds its captures then.
+  const T *find(std::string_view path, path_params &params) const {
+    params.clear();
+    const entry *e = match(&root_, path, params.params_);
+    if (e == nullptr) {
+      params.clear();
+      return nullptr;
+    }
+    for (size_t i = 0; i < params.params_.size(); ++i) {
+      params.params_[i].first = e->names[i];
+    }
+    return &e->value;
+  }
+
+  T *find(std::string_view path, path_params &params) {
+    return const_cast<T *>(std::as_const(*this).find(path, params));
+  }
+
+  bool empty() const { return size(&root_) == 0; }
+
+ private:
+  struct entry {
+    T value;
+    std::vector<std::string_view> names;
+  };
+
+  struct node {
+    // static text, empty for the root and the capture nodes
+    std::string text;
+    // static children, no two start with the same char
+    std::vector<std::unique_ptr<node>> children;
+    std::unique_ptr<node> param;
+    std::unique_ptr<node> catch_all;
+    std::optional<entry> route;
+  };
+
+  // few distinct names ever, they are kept for the life of the program
+  static std::string_view intern(std::string_view name) {
+    static std::mutex mtx;
+    static std::unordered_set<std::string> names;
+    std::lock_guard lock(mtx);
+    return *names.emplace(name).first;
+  }
+
+  static void copy(node &to, const node &from) {
+    to.text = from.text;
+    to.route = from.route;
+    for (auto &child : from.children) {
+      copy(*to.children.emplace_back(std::make_unique<node>()), *child);
+    }
+    if (from.param) {
+      to.param = std::make_unique<node>();
+      copy(*to.param, *from.param);
+    }
+    if (from.catch_all) {
+      to.catch_all = std::make_unique<node>();
+      copy(*to.catch_all, *from.catch_all);
+    }
+  }
+
+  // a capture is only recognized right behind a '/'
+  static bool at_segment_start(const node *n, std::string_view pattern) {
+    return (pattern[0] == ':' || pattern[0] == '*') &&
+           (last_char(n) == '/');
+  }
+
+  static char last_char(const node *n) {
+    return n->text.empty() ? '\0' : n->text.back();
+  }
+
+  // the static text before the next capture
+  static size_t static_end(std::string_view pattern) {
+    for (size_t i = 0; i + 1 < pattern.size(); ++i) {
+      if (pattern[i] == '/' &&
+          (pattern[i + 1] == ':' || pattern[i + 1] == '*')) {
+        return i + 1;
+      }
+    }
+    return pattern.size();
+  }
+
+  static size_t common_prefix(std::string_view a, std::string_view b) {
+    size_t i = 0;
+    while (i < a.size() && i < b.size() && a[i] == b[i]) {
+      ++i;
+    }
+    return i;
+  }
+
+  static node *child_of(const node *n, char c) {
+    for (auto &child : n->children) {
+      if (child->text[0] == c) {
+        return child.get();
+      }
+    }
+    return nullptr;
+  }
+
+  // the node ending right at the end of text, below n
+  node *insert_static(node *n, std::string_view text) {
+    while (!text.empty()) {
+      node *child = child_of(n, text[0]);
+      if (child == nullptr) {
+        auto &added = n->children.emplace_back(std::make_unique<node>());
+        added->text = text;
+        return added.get();
+      }
+
+      size_t len = common_prefix(child->text, text);
+      if (len < child->text.size()) {
+        // split the child at the end of the common part
+        auto tail = std::make_unique<node>();
+        tail->text = child->text.substr(len);
+        tail->children = std::move(child->children);
+        tail->param = std::move(child->param);
+        tail->catch_all = std::move(child->catch_all);
+        tail->route = std::move(child->route);
+        child->route.reset();
+        child->text.resize(len);
+        child->children.clear();
+        child->children.push_back(std::move(tail));
+      }
+      n = child;
+      text = text.substr(len);
+    }
+    return n;
+  }
+
+  node *find_pattern(std::string_view pattern) {
+    node *n = &root_;
+    while (n != nullptr && !pattern.empty()) {
+      if (at_segment_start(n, pattern) && pattern[0] == ':') {
+        auto end = pattern.find('/');
+        n = n->param.get();
+        pattern = end == std::string_view::npos ? std::string_view{}
+                                                : pattern.substr(end);
+      }
+      else if (at_segment_start(n, pattern) && pattern[0] == '*') {
+        n = n->catch_all.get();
+        pattern = {};
+      }
+      else {
+        node *child = child_of(n, pattern[0]);
+        if (child == nullptr ||
+            pattern.substr(0, child->text.size()) != child->text) {
+          return nullptr;
+        }
+        n = child;
+        pattern = pattern.substr(child->text.size());
+      }
+    }
+    return n;
+  }
+
+  static const entry *match(const node *n, std::string_view path,
+                            std::vector<path_params::value_type> &captures) {
+    if (path.empty()) {
+      if (n->route) {
+        return &*n->route;
+      }
+      if (n->catch_all && n->catch_all->route && last_char(n) == '/') {
+        captures.emplace_back(std::string_view{}, path);
+        return &*n->catch_all->route;
+      }
+      return nullptr;
+    }
+
+    if (node *child = child_of(n, path[0])) {
+      if (path.substr(0, child->text.size()) == child->text) {
+        if (auto e =
+                match(child, path.substr(child->text.size()), captures)) {
+          return e;
+        }
+      }
+    }
+
+    if (last_char(n) != '/') {
+      return nullptr;
+    }
+
+    if (n->param) {
+      size_t end = path.find('/');
+      auto value = path.substr(0, end);
+      if (!value.empty()) {
+        captures.emplace_back(std::string_view{}, value);
+        if (auto e = match(n->param.get(), path.substr(value.size()),
+                           captures)) {
+          return e;
+        }
+        captures.pop_back();
+      }
+    }
+
+    if (n->catch_all && n->catch_all->route) {
+      captures.emplace_back(std::string_view{}, path);
+      return &*n->catch_all->route;
+    }
+    return nullptr;
+  }
+
+  static size_t size(const node *n) {
+    if (n == nullptr) {
+      return 0;
+    }
+    size_t count = n->route ? 1 : 0;
+    for (auto &child : n->children) {
+      count += size(child.get());
+    }
+    return count + size(n->param.get()) + size(n->catch_all.get());
+  }
+
+  node root_;
+};
+}  // namespace cinatra
@@ -1,9 +1,18 @@
 #pragma once
 #include <any>
+#include <cstring>
 #include <fstream>
+#include <optional>
 
+#include "async_simple/coro/Lazy.h"
+#include "buffer_pool.hpp"
+#include "byte_ranges.hpp"
+#include "chunked_decoder.hpp"
+#include "header_index.hpp"
 #include "multipart_reader.hpp"
 #include "picohttpparser.h"
+#include "query_params.hpp"
+#include "radix_tree.hpp"
 #include "utils.hpp"
 #ifdef CINATRA_ENABLE_GZIP
 #include "gzip.hpp"
@@ -39,7 +48,7 @@ class request {
  public:
   using event_call_back = std::function<void(request &)>;
 
-  request(response &res) : res_(res) { buf_.resize(1024); }
+  request(response &res) : res_(res) { buf_.resize(init_buf_size); }
 
   void set_conn(conn_type conn) { conn_ = std::move(conn); }
 
@@ -84,11 +93,11 @@ class request {
     if (get_method() != "GET"sv)
       return false;
 
-    auto h = get_header_value("connection");
+    auto h = get_header_value(http_header::connection);
     if (h.empty())
       return false;
 
-    auto u = get_header_value("upgrade");
+    auto u = get_header_value(http_header::upgrade);
     if (u.empty())
       return false;
 
@@ -98,7 +107,7 @@ class request {
     if (!iequal(u.data(), u.length(), WEBSOCKET.data()))
       return false;
 
-    auto sec_ws_key = get_header_value("sec-websocket-key");
+    auto sec_ws_key = get_header_value(http_header::sec_websocket_key);
     if (sec_ws_key.empty() || sec_ws_key.size() != 24)
       return false;
 
@@ -108,10 +117,9 @@ class request {
   conn_type get_weak_base_conn() { return conn_; }
 
   int parse_header(std::size_t last_len) {
-    using namespace std::string_view_literals;
     if (!copy_headers_.empty())
       copy_headers_.clear();
-    num_headers_ = sizeof(headers_) / sizeof(headers_[0]);
+    num_headers_ = max_headers;
     header_len_ = phr_parse_request(
         buf_.data(), cur_size_, &method_, &method_len_, &url_, &url_len_,
         &minor_version_, headers_, &num_headers_, last_len);
@@ -120,28 +128,39 @@ class request {
       return -1;
     }
 
-    if (header_len_ < 0)
+    if (header_len_ < 0) {
+      header_idx_.clear();
       return header_len_;
+    }
+
+    header_idx_.build(headers_, num_headers_);
 
     if (!check_request()) {
       return -1;
     }
 
     check_gzip();
-    auto header_value = get_header_value("content-length");
-    if (header_value.empty()) {
-      auto transfer_encoding = get_header_value("transfer-encoding");
-      if (transfer_encoding == "chunked"sv) {
-        is_chunked_ = true;
+    auto transfer_encoding = get_header_value(http_header::transfer_encoding);
+    if (!transfer_encoding.empty()) {
+      // it overrides Content-Length, RFC 9112 section 6.3. chunked is the
+      // only transfer coding that is decoded, a body in any other has no
+      // known length.
+      auto coding = trim(transfer_encoding);
+      if (!iequal(coding.data(), coding.size(), "chunked")) {
+        return -1;
       }
-
+      is_chunked_ = true;
       body_len_ = 0;
     }
-    else {
+    else if (auto header_value = get_header_value(http_header::content_length);
+             !header_value.empty()) {
       set_body_len(atoll(header_value.data()));
     }
+    else {
+      body_len_ = 0;
+    }
 
-    auto cookie = get_header_value("cookie");
+    auto cookie = get_header_value(http_header::cookie);
     if (!cookie.empty()) {
       cookie_str_ = std::string(cookie.data(), cookie.length());
     }
@@ -154,8 +173,7 @@ class request {
 
     size_t pos = raw_url_.find('?');
     if (pos != std::string_view::npos) {
-      queries_ = parse_query(
-          std::string_view{raw_url_}.substr(pos + 1, url_len_ - pos - 1));
+      queries_.set_source(std::string_view{raw_url_}.substr(pos + 1));
       url_len_ = pos;
     }
 
@@ -232,12 +250,48 @@ class request {
   }
 
   std::string_view body() {
+    if (body_collected_) {
+      return collected_body_;
+    }
     return std::string_view(buf_.data() + last_len_ + header_len_, body_len_);
   }
 
   void set_left_body_size(size_t size) { left_body_len_ = size; }
 
+  // the buffer is borrowed from the thread's buffer_pool, the connection
+  // gives it back while it waits for an idle peer.
+  void acquire_buffer() {
+    if (buf_.empty()) {
+      buf_.resize(init_buf_size);
+    }
+  }
+
+  void release_buffer() { buf_.release(); }
+
+  // return a buffer grown by a large request to the pool.
+  void shrink_buffer() {
+    if (buf_.capacity() > init_buf_size) {
+      buf_.release();
+    }
+  }
+
+  // move the pipelined requests after the current one to the front of the
+  // buffer, return the moved size.
+  size_t move_pipelined_data() {
+    size_t total = total_len();
+    if (cur_size_ <= total) {
+      return 0;
+    }
+
+    size_t left = cur_size_ - total;
+    std::memmove(buf_.data(), buf_.data() + total, left);
+    return left;
+  }
+
   std::string_view body() const {
+    if (body_collected_) {
+      return collected_body_;
+    }
 #ifdef CINATRA_ENABLE_GZIP
     if (has_gzip_ && !gzip_str_.empty()) {
       return {gzip_str_.data(), gzip_str_.length()};
@@ -257,9 +311,13 @@ class request {
     }
     files_.clear();
     is_chunked_ = false;
+    chunked_decoder_.reset();
+    lazy_handler_.reset();
+    collected_body_.clear();
+    body_collected_ = false;
+    path_params_.clear();
     state_ = data_proc_state::data_begin;
     part_data_ = {};
-    utf8_character_params_.clear();
     utf8_character_pathinfo_params_.clear();
     queries_.clear();
     cookie_str_.clear();
@@ -267,8 +325,11 @@ class request {
     multipart_form_map_.clear();
     is_range_resource_ = false;
     range_start_pos_ = 0;
+    ranges_.clear();
     static_resource_file_size_ = 0;
     copy_headers_.clear();
+    num_headers_ = 0;
+    header_idx_.clear();
   }
 
   void fit_size() {
@@ -334,43 +395,16 @@ class request {
   }
 
   std::string_view get_header_value(std::string_view key) const {
-    if (copy_headers_.empty()) {
-      for (size_t i = 0; i < num_headers_; i++) {
-        if (iequal(headers_[i].name, headers_[i].name_len, key.data(),
-                   key.length()))
-          return std::string_view(headers_[i].value, headers_[i].value_len);
-      }
-
-      return {};
-    }
-
-    auto it = std::find_if(
-        copy_headers_.begin(), copy_headers_.end(), [key](auto &pair) {
-          if (iequal(pair.first.data(), pair.first.size(), key.data())) {
-            return true;
-          }
-
-          return false;
-        });
-
-    if (it != copy_headers_.end()) {
-      return (*it).second;
-    }
+    return header_idx_.find(key);
+  }
 
-    return {};
+  std::string_view get_header_value(http_header key) const {
+    return header_idx_.get(key);
   }
 
-  std::pair<phr_header *, size_t> get_headers() {
-    if (copy_headers_.empty())
-      return {headers_, num_headers_};
+  const header_index &get_header_index() const { return header_idx_; }
 
-    num_headers_ = copy_headers_.size();
-    for (size_t i = 0; i < num_headers_; i++) {
-      headers_[i].name = copy_headers_[i].first.data();
-      headers_[i].name_len = copy_headers_[i].first.size();
-      headers_[i].value = copy_headers_[i].second.data();
-      headers_[i].value_len = copy_headers_[i].second.size();
-    }
+  std::pair<phr_header *, size_t> get_headers() {
     return {headers_, num_headers_};
   }
 
@@ -430,9 +464,7 @@ class request {
     }
 
     for (auto &pair : multipart_form_map_) {
-      form_url_map_.emplace(
-          std::string_view(pair.first.data(), pair.first.size()),
-          std::string_view(pair.second.data(), pair.second.size()));
+      form_url_map_.add(pair.first, pair.second);
     }
   }
 
@@ -463,47 +495,6 @@ class request {
     }
   }
 
-  std::map<std::string_view, std::string_view> parse_query(
-      std::string_view str) {
-    std::map<std::string_view, std::string_view> query;
-    std::string_view key;
-    std::string_view val;
-    size_t pos = 0;
-    size_t length = str.length();
-    for (size_t i = 0; i < length; i++) {
-      char c = str[i];
-      if (c == '=') {
-        key = {&str[pos], i - pos};
-        key = trim(key);
-        pos = i + 1;
-      }
-      else if (c == '&') {
-        val = {&str[pos], i - pos};
-        val = trim(val);
-        pos = i + 1;
-        // if (is_form_url_encode(key)) {
-        //	auto s = form_urldecode(key);
-        //}
-        query.emplace(key, val);
-      }
-    }
-
-    if (pos == 0) {
-      return {};
-    }
-
-    if ((length - pos) > 0) {
-      val = {&str[pos], length - pos};
-      val = trim(val);
-      query.emplace(key, val);
-    }
-    else if ((length - pos) == 0) {
-      query.emplace(key, "");
-    }
-
-    return query;
-  }
-
   bool parse_form_urlencoded() {
     form_url_map_.clear();
 #ifdef CINATRA_ENABLE_GZIP
@@ -513,19 +504,42 @@ class request {
         return false;
     }
 #endif
+    // split lazily, a body without any '=' or '&' has no params at all.
     auto body_str = body();
-    form_url_map_ = parse_query(body_str);
-    if (form_url_map_.empty())
+    if (body_str.find_first_of("=&") == std::string_view::npos)
       return false;
 
+    form_url_map_.set_source(body_str);
     return true;
   }
 
-  int parse_chunked(size_t bytes_transferred) {
-    auto str =
-        std::string_view(&buf_[header_len_], bytes_transferred - header_len_);
+  chunked_decoder &get_chunked_decoder() { return chunked_decoder_; }
+
+  // set by the router when the handler returns a Lazy<void>, the connection
+  // takes it right after the handler call and runs it.
+  void set_lazy_handler(async_simple::coro::Lazy<void> lazy) {
+    lazy_handler_.emplace(std::move(lazy));
+  }
+
+  std::optional<async_simple::coro::Lazy<void>> take_lazy_handler() {
+    return std::exchange(lazy_handler_, std::nullopt);
+  }
+
+  bool has_lazy_handler() const { return lazy_handler_.has_value(); }
+
+  // a chunked body for a coroutine handler, which runs once the body is
+  // complete, is collected here; body() returns it then.
+  void collect_body(std::string_view piece) {
+    collected_body_.append(piece);
+    body_collected_ = true;
+  }
 
-    return -1;
+  // a chunked body is read through a buffer of at least this size, it
+  // holds no more of the body than that.
+  void fit_chunked_size() {
+    if (buf_.size() < chunked_buf_size) {
+      resize(chunked_buf_size);
+    }
   }
 
   std::string_view get_method() const {
@@ -577,9 +591,11 @@ class request {
   }
 
   std::map<std::string_view, std::string_view> get_form_url_map() const {
-    return form_url_map_;
+    return {form_url_map_.begin(), form_url_map_.end()};
   }
 
+  const query_params &form_params() const { return form_url_map_; }
+
   void set_state(data_proc_state state) { state_ = state; }
 
   data_proc_state get_state() const { return state_; }
@@ -608,25 +624,17 @@ class request {
 
   content_type get_content_type() const { return http_type_; }
 
-  const std::map<std::string_view, std::string_view> &queries() const {
-    return queries_;
-  }
+  const query_params &queries() const { return queries_; }
 
   std::string_view get_query_value(size_t n) {
-    auto get_val = [&n](auto &map) {
-      auto it = map.begin();
-      std::advance(it, n);
-      return it->second;
-    };
-
     if (n >= queries_.size()) {
       if (n >= form_url_map_.size())
         return {};
 
-      return get_val(form_url_map_);
+      return form_url_map_[n].second;
     }
     else {
-      return get_val(queries_);
+      return queries_[n].second;
     }
   }
 
@@ -668,34 +676,21 @@ class request {
     }
   }
 
-  std::string_view get_query_value(std::string_view key) {
-    auto url = get_url();
-    url = url.length() > 1 && url.back() == '/'
-              ? url.substr(0, url.length() - 1)
-              : url;
-    std::string map_key = std::string(url.data(), url.size()) +
-                          std::string(key.data(), key.size());
-    auto it = queries_.find(key);
-    if (it == queries_.end()) {
-      auto itf = form_url_map_.find(key);
-      if (itf == form_url_map_.end())
-        return {};
+  // the capture of ":name" or "*name" in the route pattern, empty when
+  // there is none
+  std::string_view get_path_param(std::string_view name) const {
+    return path_params_.get(name);
+  }
 
-      if (code_utils::is_url_encode(itf->second)) {
-        auto ret = utf8_character_params_.emplace(
-            map_key, code_utils::get_string_by_urldecode(itf->second));
-        return std::string_view(ret.first->second.data(),
-                                ret.first->second.size());
-      }
-      return itf->second;
-    }
-    if (code_utils::is_url_encode(it->second)) {
-      auto ret = utf8_character_params_.emplace(
-          map_key, code_utils::get_string_by_urldecode(it->second));
-      return std::string_view(ret.first->second.data(),
-                              ret.first->second.size());
+  path_params &get_path_params() { return path_params_; }
+  const path_params &get_path_params() const { return path_params_; }
+
+  std::string_view get_query_value(std::string_view key) {
+    if (auto it = queries_.find(key)) {
+      return it->second;
     }
-    return it->second;
+
+    return form_url_map_.get(key);
   }
 
   bool uncompress(std::string_view str) {
@@ -796,6 +791,25 @@ class request {
     return 0;
   }
 
+  // parses a Range header against the size of the static file, the
+  // request is a range one when it is satisfiable.
+  range_result set_ranges(std::string_view range_header, std::int64_t size) {
+    auto result = parse_byte_ranges(range_header, size, ranges_);
+    is_range_resource_ = result == range_result::satisfiable;
+    range_start_pos_ = is_range_resource_ ? ranges_[0].first : 0;
+    return result;
+  }
+
+  // sorted and coalesced, empty unless set_ranges() succeeded.
+  const std::vector<byte_range> &get_ranges() const { return ranges_; }
+
+  // the Range header is ignored, the whole file is sent.
+  void clear_ranges() {
+    ranges_.clear();
+    is_range_resource_ = false;
+    range_start_pos_ = 0;
+  }
+
   void save_request_static_file_size(std::int64_t size) {
     static_resource_file_size_ = size;
   }
@@ -851,22 +865,35 @@ class request {
 
     auto filename = get_multipart_field_name("filename");
     multipart_headers_.clear();
-    if (!filename.empty()) {
-      copy_headers_.emplace_back("filename", std::move(filename));
-    }
 
-    if (header_len_ < 0)
-      return;
+    if (header_len_ < 0) {
+      num_headers_ = 0;
+    }
 
+    // copy the headers out of the buffer and point headers_ at the copies,
+    // the index only refers to positions in headers_.
+    copy_headers_.reserve(num_headers_ + 1);
     for (size_t i = 0; i < num_headers_; i++) {
       copy_headers_.emplace_back(
           std::string(headers_[i].name, headers_[i].name_len),
           std::string(headers_[i].value, headers_[i].value_len));
     }
+    if (!filename.empty()) {
+      copy_headers_.emplace_back("filename", std::move(filename));
+    }
+
+    num_headers_ = copy_headers_.size();
+    for (size_t i = 0; i < num_headers_; i++) {
+      headers_[i].name = copy_headers_[i].first.data();
+      headers_[i].name_len = copy_headers_[i].first.size();
+      headers_[i].value = copy_headers_[i].second.data();
+      headers_[i].value_len = copy_headers_[i].second.size();
+    }
+    header_idx_.build(headers_, num_headers_);
   }
 
   void check_gzip() {
-    auto encoding = get_header_value("content-encoding");
+    auto encoding = get_header_value(http_header::content_encoding);
     if (encoding.empty()) {
       has_gzip_ = false;
     }
@@ -877,12 +904,17 @@ class request {
   }
 
   constexpr const static size_t MaxSize = 3 * 1024 * 1024;
+  constexpr const static size_t init_buf_size = 1024;
+  constexpr const static size_t chunked_buf_size = 16 * 1024;
   conn_type conn_;
   response &res_;
-  std::vector<char> buf_;
+  pooled_buffer buf_;
 
+  constexpr const static size_t max_headers = 64;
   size_t num_headers_ = 0;
-  struct phr_header headers_[64];
+  // one more for the multipart "filename" kept by copy_method_url_headers
+  struct phr_header headers_[max_headers + 1];
+  header_index header_idx_;
   const char *method_ = nullptr;
   size_t method_len_ = 0;
   const char *url_ = nullptr;
@@ -902,13 +934,18 @@ class request {
 
   size_t last_len_ = 0;  // for pipeline, last request buffer position
 
-  std::map<std::string_view, std::string_view> queries_;
-  std::map<std::string_view, std::string_view> form_url_map_;
+  query_params queries_;
+  path_params path_params_;
+  query_params form_url_map_;
   std::map<std::string, std::string> multipart_form_map_;
   bool has_gzip_ = false;
   std::string gzip_str_;
 
   bool is_chunked_ = false;
+  chunked_decoder chunked_decoder_;
+  std::optional<async_simple::coro::Lazy<void>> lazy_handler_;
+  std::string collected_body_;
+  bool body_collected_ = false;
 
   // validate
   size_t max_header_len_ = 1024 * 1024;
@@ -921,9 +958,9 @@ class request {
   std::map<std::string, std::string> multipart_headers_;
   std::string last_multpart_key_;
   std::vector<upload_file> files_;
-  std::map<std::string, std::string> utf8_character_params_;
   std::map<std::string, std::string> utf8_character_pathinfo_params_;
   std::int64_t range_start_pos_ = 0;
+  std::vector<byte_range> ranges_;
   bool is_range_resource_ = 0;
   std::int64_t static_resource_file_size_ = 0;
   std::unordered_map<std::string, std::any> aspect_data_;
@@ -4,148 +4,207 @@
 
 #ifndef CINATRA_RESPONSE_HPP
 #define CINATRA_RESPONSE_HPP
+#include "compression_policy.hpp"
+#include "file_validators.hpp"
+#include "header_index.hpp"
 #include "http_cache.hpp"
+#include "http_date.hpp"
 #include "itoa.hpp"
 #include "mime_types.hpp"
 #include "response_cv.hpp"
 #include "session_manager.hpp"
 #include "use_asio.hpp"
 #include "utils.hpp"
+#include <charconv>
 #include <chrono>
+#include <memory>
 #include <string>
 #include <string_view>
 #include <vector>
 namespace cinatra {
+// a serialized response waiting for a batched write, its buffers point into
+// the strings it holds, into static fragments or into what owner keeps.
+struct stashed_response {
+  std::string head;
+  std::string content;
+  std::string compressed;
+  std::shared_ptr<const void> owner;
+  std::vector<asio::const_buffer> buffers;
+};
+
 class response {
 public:
   response() {}
 
-  std::string &response_str() { return rep_str_; }
+  // set_status_and_content has been called, the response can be written.
+  bool has_response() const { return ready_; }
 
-  void enable_response_time(bool enable) {
-    need_response_time_ = enable;
-    if (need_response_time_) {
-      char mbstr[50];
-      std::time_t tm = std::chrono::system_clock::to_time_t(last_time_);
-      std::strftime(mbstr, sizeof(mbstr), "%a, %d %b %Y %T GMT",
-                    std::localtime(&tm));
-      last_date_str_ = mbstr;
-    }
+  void enable_response_time(bool enable) { need_response_time_ = enable; }
+
+  // the Date line is taken from date instead of being formatted per
+  // response.
+  void set_date_source(http_date *date) { date_ = date; }
+
+  // bodies are compressed by to_buffers() as policy says, nullptr never.
+  void set_compression_policy(const compression_policy *policy) {
+    compression_ = policy;
   }
 
   template <status_type status, req_content_type content_type, size_t N>
   constexpr auto
   set_status_and_content(const char (&content)[N],
                          content_encoding encoding = content_encoding::none) {
-    constexpr auto status_str = to_rep_string(status);
-    constexpr auto type_str = to_content_type_str(content_type);
-    constexpr auto len_str = num_to_string<N - 1>::value;
-
-    rep_str_.append(status_str)
-        .append(len_str.data(), len_str.size())
-        .append(type_str)
-        .append(rep_server);
-
-    if (need_response_time_)
-      append_date_time();
-    else
-      rep_str_.append("\r\n");
-
-    rep_str_.append(content);
+    // everything but the date is known at compile time, the serializer
+    // points at the fragments and the literal.
+    constexpr auto &len_str = num_to_string<N - 1>::value;
+    status_ = status;
+    res_type_ = content_type;
+    (void)encoding;
+    content_.clear();
+    body_ = std::string_view(content, N - 1);
+    len_line_ = std::string_view(len_str.data(), len_str.size());
+    ready_ = true;
   }
 
   void append_date_time() {
-    using namespace std::chrono_literals;
-
-    auto t = std::chrono::system_clock::now();
-    if (t - last_time_ > 1s) {
-      char mbstr[50];
-      std::time_t tm = std::chrono::system_clock::to_time_t(t);
-      std::strftime(mbstr, sizeof(mbstr), "%a, %d %b %Y %T GMT",
-                    std::localtime(&tm));
-      last_date_str_ = mbstr;
-      rep_str_.append("Date: ").append(mbstr).append("\r\n\r\n");
-      last_time_ = t;
-    } else {
-      rep_str_.append("Date: ").append(last_date_str_).append("\r\n\r\n");
-    }
+    char line[http_date::line_size];
+    http_date::format(
+        std::chrono::system_clock::to_time_t(std::chrono::system_clock::now()),
+        line);
+    head_.append(line, sizeof(line));
   }
 
-  void build_response_str() {
-    rep_str_.append(to_rep_string(status_));
-
-    //			if (keep_alive) {
-    //				rep_str_.append("Connection: keep-alive\r\n");
-    //			}
-    //			else {
-    //				rep_str_.append("Connection: close\r\n");
-    //			}
-
-    if (!headers_.empty()) {
-      for (auto &header : headers_) {
-        rep_str_.append(header.first)
-            .append(":")
-            .append(header.second)
-            .append("\r\n");
-      }
-      headers_.clear();
+  // serializes the response as a buffer sequence: the status line,
+  // content type and server header are constant fragments from
+  // response_cv.hpp, the other headers go to head_, which keeps its
+  // capacity across requests, and the body is not copied. The buffers
+  // stay valid until the next reset().
+  const std::vector<asio::const_buffer> &to_buffers() {
+    buffers_.clear();
+    head_.clear();
+    if (!prebuilt_head_.empty()) {
+      return prebuilt_to_buffers();
     }
 
-    char temp[20] = {};
-    itoa_fwd((int)content_.size(), temp);
-    rep_str_.append("Content-Length: ").append(temp).append("\r\n");
-    if (res_type_ != req_content_type::none) {
-      rep_str_.append(get_content_type(res_type_));
+    bool has_body = has_content_length(status_);
+    if (has_body && compression_ && !compression_checked_) {
+      compression_checked_ = true;
+      compress_body();
     }
-    rep_str_.append("Server: cinatra\r\n");
-    if (session_ != nullptr && session_->is_need_update()) {
-      auto cookie_str = session_->get_cookie().to_string();
-      rep_str_.append("Set-Cookie: ").append(cookie_str).append("\r\n");
-      session_->set_need_update(false);
+    for (auto &header : headers_) {
+      head_.append(header.first)
+          .append(": ")
+          .append(header.second)
+          .append("\r\n");
     }
+    if (has_body && len_line_.empty()) {
+      char temp[20];
+      auto [end, ec] = std::to_chars(temp, temp + sizeof(temp), body_.size());
+      head_.append(rep_len).append(temp, end).append("\r\n");
+    }
+    size_t first_part = head_.size();
 
-    if (need_response_time_)
-      append_date_time();
-    else
-      rep_str_.append("\r\n");
-
-    rep_str_.append(std::move(content_));
-  }
-
-  std::vector<asio::const_buffer> to_buffers() {
-    std::vector<asio::const_buffer> buffers;
-    add_header("Host", "cinatra");
     if (session_ != nullptr && session_->is_need_update()) {
       auto cookie_str = session_->get_cookie().to_string();
-      add_header("Set-Cookie", cookie_str.c_str());
+      head_.append("Set-Cookie: ").append(cookie_str).append("\r\n");
       session_->set_need_update(false);
     }
-    buffers.reserve(headers_.size() * 4 + 5);
-    buffers.emplace_back(to_buffer(status_));
-    for (auto const &h : headers_) {
-      buffers.emplace_back(asio::buffer(h.first));
-      buffers.emplace_back(asio::buffer(name_value_separator));
-      buffers.emplace_back(asio::buffer(h.second));
-      buffers.emplace_back(asio::buffer(crlf));
+    std::string_view date_line;
+    if (need_response_time_) {
+      if (date_) {
+        date_line = date_->line();
+      }
+      else {
+        append_date_time();
+      }
     }
 
-    buffers.push_back(asio::buffer(crlf));
-
-    if (body_type_ == content_type::string) {
-      buffers.emplace_back(
-          asio::buffer(content_.data(), content_.size()));
+    buffers_.push_back(asio::buffer(to_rep_string(status_)));
+    if (first_part > 0) {
+      buffers_.push_back(asio::buffer(head_.data(), first_part));
+    }
+    if (has_body && !len_line_.empty()) {
+      buffers_.push_back(asio::buffer(len_line_));
+    }
+    if (res_type_ != req_content_type::none) {
+      buffers_.push_back(asio::buffer(to_content_type_str(res_type_)));
+    }
+    buffers_.push_back(asio::buffer(rep_server));
+    if (head_.size() > first_part) {
+      buffers_.push_back(
+          asio::buffer(head_.data() + first_part, head_.size() - first_part));
+    }
+    if (!date_line.empty()) {
+      buffers_.push_back(asio::buffer(date_line));
+    }
+    buffers_.push_back(asio::buffer(rep_crcf));
+    if (has_body && !body_.empty()) {
+      buffers_.push_back(asio::buffer(body_));
     }
 
     if (http_cache::get().need_cache(raw_url_)) {
       cache_data.clear();
-      for (auto &buf : buffers) {
+      for (auto &buf : buffers_) {
         cache_data.push_back(
             std::string(asio::buffer_cast<const char *>(buf),
                         asio::buffer_size(buf)));
       }
     }
 
-    return buffers;
+    return buffers_;
+  }
+
+  // serializes the response into out, taking over the storage its buffers
+  // point into instead of copying it; the strings are swapped, so both
+  // sides keep their capacity. The response is reset() next.
+  void stash(stashed_response &out) {
+    to_buffers();
+    auto head = std::string_view(head_);
+    auto content = std::string_view(content_);
+    auto compressed = std::string_view(compressed_);
+    out.head.swap(head_);
+    out.content.swap(content_);
+    out.compressed.swap(compressed_);
+    out.owner = std::move(prebuilt_owner_);
+
+    // a short string is stored inline, its bytes move with the swap.
+    auto rebase = [](const asio::const_buffer &buf, std::string_view from,
+                     const std::string &to, asio::const_buffer &result) {
+      auto data = static_cast<const char *>(buf.data());
+      if (buf.size() == 0 || data < from.data() ||
+          data >= from.data() + from.size()) {
+        return false;
+      }
+      result = asio::buffer(to.data() + (data - from.data()), buf.size());
+      return true;
+    };
+    out.buffers.clear();
+    for (auto &buf : buffers_) {
+      asio::const_buffer result = buf;
+      rebase(buf, head, out.head, result) ||
+          rebase(buf, content, out.content, result) ||
+          rebase(buf, compressed, out.compressed, result);
+      out.buffers.push_back(result);
+    }
+  }
+
+  // a response whose status line and headers, up to the empty line, were
+  // built beforehand, e.g. by static_file_cache. owner keeps head and body
+  // alive until reset(); headers added with add_header still go out.
+  void set_prebuilt_response(std::string_view head, std::string_view body,
+                             std::shared_ptr<const void> owner) {
+    status_ = status_type::ok;
+    prebuilt_head_ = head;
+    body_ = body;
+    prebuilt_owner_ = std::move(owner);
+    ready_ = true;
+  }
+
+  // 1xx, 204 and 304 responses have neither a Content-Length nor a body.
+  static bool has_content_length(status_type status) {
+    int code = int(status);
+    return !(code >= 100 && code < 200) && status != status_type::no_content &&
+           status != status_type::not_modified;
   }
 
   void add_header(std::string &&key, std::string &&value) {
@@ -163,7 +222,7 @@ public:
   void set_status_and_content(status_type status) {
     status_ = status;
     set_content(std::string(to_string(status)));
-    build_response_str();
+    ready_ = true;
   }
 
   void
@@ -177,7 +236,7 @@ public:
     if (encoding == content_encoding::gzip) {
       std::string encode_str;
       bool r = gzip_codec::compress(
-          std::string_view(content.data(), content.length()), encode_str, true);
+          std::string_view(content.data(), content.length()), encode_str);
       if (!r) {
         set_status_and_content(status_type::internal_server_error,
                                "gzip compress error");
@@ -191,7 +250,7 @@ public:
       (void)encoding;
       set_content(std::move(content));
     }
-    build_response_str();
+    ready_ = true;
   }
 
   std::string_view get_content_type(req_content_type type) {
@@ -213,12 +272,17 @@ public:
   bool need_delay() const { return delay_; }
 
   void reset() {
-    if (headers_.empty())
-      rep_str_.clear();
+    ready_ = false;
+    body_ = {};
+    prebuilt_head_ = {};
+    prebuilt_owner_ = nullptr;
+    len_line_ = {};
+    buffers_.clear();
     res_type_ = req_content_type::none;
     status_ = status_type::init;
     proc_continue_ = true;
     delay_ = false;
+    compression_checked_ = false;
     headers_.clear();
     content_.clear();
     session_ = nullptr;
@@ -234,6 +298,8 @@ public:
   void set_content(std::string &&content) {
     body_type_ = content_type::string;
     content_ = std::move(content);
+    body_ = content_;
+    len_line_ = {};
   }
 
   void set_chunked() {
@@ -275,7 +341,7 @@ public:
 
   std::shared_ptr<cinatra::session> start_session() {
     if (domain_.empty()) {
-      auto host = get_header_value("host");
+      auto host = get_header_value(http_header::host);
       if (!host.empty()) {
         size_t pos = host.find(':');
         if (pos != std::string_view::npos) {
@@ -302,16 +368,14 @@ public:
 
   void set_headers(std::pair<phr_header *, size_t> headers) {
     req_headers_ = headers;
+    req_header_idx_ = nullptr;
   }
 
+  void set_headers(const header_index &index) { req_header_idx_ = &index; }
+
   void render_string(std::string &&content) {
-#ifdef CINATRA_ENABLE_GZIP
-    set_status_and_content(status_type::ok, std::move(content),
-                           req_content_type::string, content_encoding::gzip);
-#else
     set_status_and_content(status_type::ok, std::move(content),
                            req_content_type::string, content_encoding::none);
-#endif
   }
 
   std::vector<std::string> raw_content() { return cache_data; }
@@ -335,7 +399,120 @@ public:
   }
 
 private:
+  // replaces the body by its compressed form when the policy, the client
+  // and the handler all allow it. A cached response is sent to every
+  // client, so it is left alone.
+  void compress_body() {
+    if (!compression_->enabled || body_.size() < compression_->min_size ||
+        http_cache::get().need_cache(raw_url_)) {
+      return;
+    }
+
+    std::string_view mime;
+    // an index, headers_ grows below
+    size_t etag = headers_.size();
+    bool has_vary = false;
+    for (size_t i = 0; i < headers_.size(); i++) {
+      auto &[name, value] = headers_[i];
+      auto is = [&name = name](std::string_view key) {
+        return iequal(name.data(), name.size(), key.data(), key.size());
+      };
+      if (is("Content-Encoding") || is("Content-Range")) {
+        return;
+      }
+      if (is("Content-Type")) {
+        mime = value;
+      }
+      else if (is("ETag")) {
+        etag = i;
+      }
+      else if (is("Vary")) {
+        has_vary = true;
+      }
+    }
+    if (mime.empty()) {
+      // "Content-Type: text/plain; charset=UTF-8\r\n"
+      mime = to_content_type_str(res_type_);
+      mime = mime.substr((std::min)(mime.find(':') + 1, mime.size()));
+    }
+    if (!compression_->compressible(mime, body_.size())) {
+      return;
+    }
+
+    // the body depends on Accept-Encoding from here on, whatever it is now
+    if (!has_vary) {
+      headers_.emplace_back("Vary", "Accept-Encoding");
+    }
+    auto codec =
+        compression_->negotiate(get_header_value(http_header::accept_encoding));
+    if (!codec) {
+      return;
+    }
+    compressed_.clear();
+    if (!codec->compress(body_, compressed_, compression_->options) ||
+        compressed_.size() >= body_.size()) {
+      return;
+    }
+
+    if (etag < headers_.size()) {
+      // another representation, so another ETag, is_not_modified() still
+      // matches it against the handler's
+      auto &tag = headers_[etag].second;
+      tag = coded_etag(tag, codec->name());
+    }
+    headers_.emplace_back("Content-Encoding", std::string(codec->name()));
+    body_ = compressed_;
+    len_line_ = {};
+  }
+
+  const std::vector<asio::const_buffer> &prebuilt_to_buffers() {
+    for (auto &header : headers_) {
+      head_.append(header.first)
+          .append(": ")
+          .append(header.second)
+          .append("\r\n");
+    }
+    if (session_ != nullptr && session_->is_need_update()) {
+      auto cookie_str = session_->get_cookie().to_string();
+      head_.append("Set-Cookie: ").append(cookie_str).append("\r\n");
+      session_->set_need_update(false);
+    }
+    std::string_view date_line;
+    if (need_response_time_) {
+      if (date_) {
+        date_line = date_->line();
+      }
+      else {
+        append_date_time();
+      }
+    }
+
+    buffers_.push_back(asio::buffer(prebuilt_head_));
+    if (!head_.empty()) {
+      buffers_.push_back(asio::buffer(head_));
+    }
+    if (!date_line.empty()) {
+      buffers_.push_back(asio::buffer(date_line));
+    }
+    buffers_.push_back(asio::buffer(rep_crcf));
+    if (!body_.empty()) {
+      buffers_.push_back(asio::buffer(body_));
+    }
+    return buffers_;
+  }
+
+  std::string_view get_header_value(http_header key) const {
+    if (req_header_idx_) {
+      return req_header_idx_->get(key);
+    }
+    return get_header_value(detail::known_header_names[size_t(key)]);
+  }
+
   std::string_view get_header_value(std::string_view key) const {
+    if (req_header_idx_) {
+      return req_header_idx_->find(key);
+    }
+
     phr_header *headers = req_headers_.first;
     size_t num_headers = req_headers_.second;
     for (size_t i = 0; i < num_headers; i++) {
@@ -359,14 +536,24 @@ private:
   bool delay_ = false;
 
   std::pair<phr_header *, size_t> req_headers_;
+  const header_index *req_header_idx_ = nullptr;
   std::string_view domain_;
   std::string_view path_;
   std::shared_ptr<cinatra::session> session_ = nullptr;
-  std::string rep_str_;
-  std::chrono::system_clock::time_point last_time_ =
-      std::chrono::system_clock::now();
-  std::string last_date_str_;
-  req_content_type res_type_;
+  // the body to send, content_ or a literal
+  std::string_view body_;
+  // precomputed "Content-Length: N\r\n" of a literal body
+  std::string_view len_line_;
+  bool ready_ = false;
+  std::string_view prebuilt_head_;
+  std::shared_ptr<const void> prebuilt_owner_;
+  std::string head_;
+  std::vector<asio::const_buffer> buffers_;
+  http_date *date_ = nullptr;
+  const compression_policy *compression_ = nullptr;
+  bool compression_checked_ = false;
+  std::string compressed_;
+  req_content_type res_type_ = req_content_type::none;
   bool need_response_time_ = false;
 };
 } // namespace cinatra
@@ -22,6 +22,7 @@ enum class status_type {
   forbidden = 403,
   not_found = 404,
   conflict = 409,
+  range_not_satisfiable = 416,
   internal_server_error = 500,
   not_implemented = 501,
   bad_gateway = 502,
@@ -109,6 +110,12 @@ inline std::string_view conflict =
     "<body><h1>409 Conflict</h1></body>"
     "</html>";
 
+inline std::string_view range_not_satisfiable =
+    "<html>"
+    "<head><title>Range Not Satisfiable</title></head>"
+    "<body><h1>416 Range Not Satisfiable</h1></body>"
+    "</html>";
+
 inline std::string_view internal_server_error =
     "<html>"
     "<head><title>Internal Server Error</title></head>"
@@ -159,6 +166,8 @@ inline constexpr std::string_view rep_unauthorized =
 inline constexpr std::string_view rep_forbidden = "HTTP/1.1 403 Forbidden\r\n";
 inline constexpr std::string_view rep_not_found = "HTTP/1.1 404 Not Found\r\n";
 inline constexpr std::string_view rep_conflict = "HTTP/1.1 409 Conflict\r\n";
+inline constexpr std::string_view rep_range_not_satisfiable =
+    "HTTP/1.1 416 Range Not Satisfiable\r\n";
 inline constexpr std::string_view rep_internal_server_error =
     "HTTP/1.1 500 Internal Server Error\r\n";
 inline constexpr std::string_view rep_not_implemented =
@@ -294,6 +303,9 @@ inline asio::const_buffer to_buffer(status_type status) {
       return asio::buffer(rep_not_found.data(), rep_not_found.length());
     case status_type::conflict:
       return asio::buffer(rep_conflict.data(), rep_conflict.length());
+    case status_type::range_not_satisfiable:
+      return asio::buffer(rep_range_not_satisfiable.data(),
+                          rep_range_not_satisfiable.length());
     case status_type::internal_server_error:
       return asio::buffer(rep_internal_server_error.data(),
                           rep_internal_server_error.length());
@@ -361,6 +373,9 @@ inline constexpr std::string_view to_rep_string(status_type status) {
     case cinatra::status_type::conflict:
       return rep_conflict;
       break;
+    case cinatra::status_type::range_not_satisfiable:
+      return rep_range_not_satisfiable;
+      break;
     case cinatra::status_type::internal_server_error:
       return rep_internal_server_error;
       break;
@@ -409,6 +424,8 @@ inline std::string_view to_string(status_type status) {
       return not_found;
     case status_type::conflict:
       return conflict;
+    case status_type::range_not_satisfiable:
+      return range_not_satisfiable;
     case status_type::internal_server_error:
       return internal_server_error;
     case status_type::not_implemented:
@@ -0,0 +1,262 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <string_view>
+#include <utility>
+
+#include "http_router.hpp"
+#include "request.hpp"
+#include "response.hpp"
+#include "utils.hpp"
+
+namespace cinatra {
+// the path of a route as a template argument, route<"/plaintext", GET>(f)
+template <size_t N>
+struct route_path {
+  char value[N]{};
+
+  constexpr route_path(const char (&str)[N]) { std::copy_n(str, N, value); }
+
+  constexpr std::string_view view() const { return {value, N - 1}; }
+};
+
+template <route_path Path, typename Function, http_method... Methods>
+struct static_route {
+  static constexpr std::string_view path = Path.view();
+  static constexpr std::array<std::string_view, sizeof...(Methods)> methods = {
+      method_name(Methods)...};
+
+  Function f;
+};
+
+// a route of a route_table, the path is matched exactly, without
+// parameters or wildcards
+template <route_path Path, http_method... Methods, typename Function>
+constexpr auto route(Function f) {
+  static_assert(sizeof...(Methods) > 0, "a route needs the methods");
+  static_assert(Path.view().size() > 0 && Path.view()[0] == '/',
+                "the path of a route starts with '/'");
+  return static_route<Path, Function, Methods...>{std::move(f)};
+}
+
+namespace detail {
+struct route_key {
+  std::string_view method;
+  std::string_view path;
+  size_t route = 0;
+};
+
+// fnv-1a over "METHOD path"
+constexpr uint64_t route_hash(std::string_view method, std::string_view path) {
+  uint64_t h = 14695981039346656037ull;
+  auto add = [&h](char c) {
+    h ^= uint8_t(c);
+    h *= 1099511628211ull;
+  };
+  for (char c : method) {
+    add(c);
+  }
+  add(' ');
+  for (char c : path) {
+    add(c);
+  }
+  return h;
+}
+
+// the slot of a hash under the seed of its bucket
+constexpr uint64_t route_slot(uint64_t h, uint32_t seed) {
+  h ^= seed * 0x9e3779b97f4a7c15ull;
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdull;
+  h ^= h >> 33;
+  return h;
+}
+
+// Hash and displace: the keys are spread over buckets by their hash, then
+// each bucket, the largest first, gets the first seed that puts all of its
+// keys into free slots. A lookup is one hash of the key, and one compare to
+// tell a hit from a miss.
+template <size_t N>
+struct perfect_hash {
+  static constexpr size_t bucket_count = N / 2 + 1;
+  static constexpr size_t slot_count = std::bit_ceil(N * 2);
+
+  std::array<uint32_t, bucket_count> seeds{};
+  // index of the key, -1 for a free slot
+  std::array<int32_t, slot_count> slots{};
+
+  constexpr int32_t find(uint64_t h) const {
+    auto seed = seeds[h % bucket_count];
+    return slots[route_slot(h, seed) & (slot_count - 1)];
+  }
+};
+
+template <size_t N>
+constexpr perfect_hash<N> make_perfect_hash(
+    const std::array<route_key, N> &keys) {
+  using hash_type = perfect_hash<N>;
+  constexpr size_t bucket_count = hash_type::bucket_count;
+  constexpr size_t mask = hash_type::slot_count - 1;
+
+  for (size_t i = 0; i < N; ++i) {
+    for (size_t j = i + 1; j < N; ++j) {
+      if (keys[i].method == keys[j].method && keys[i].path == keys[j].path) {
+        throw "a route is in the table twice";
+      }
+    }
+  }
+
+  hash_type table;
+  table.slots.fill(-1);
+  std::array<uint64_t, N> hashes{};
+  std::array<size_t, bucket_count> sizes{};
+  for (size_t i = 0; i < N; ++i) {
+    hashes[i] = route_hash(keys[i].method, keys[i].path);
+    ++sizes[hashes[i] % bucket_count];
+  }
+
+  std::array<size_t, bucket_count> order{};
+  for (size_t b = 0; b < bucket_count; ++b) {
+    order[b] = b;
+  }
+  std::sort(order.begin(), order.end(), [&sizes](size_t a, size_t b) {
+    return sizes[a] > sizes[b];
+  });
+
+  for (size_t b : order) {
+    if (sizes[b] == 0) {
+      break;
+    }
+    for (uint32_t seed = 0;; ++seed) {
+      if (seed == 1u << 20) {
+        throw "no seed for a bucket of the route table";
+      }
+      std::array<size_t, N> taken{};
+      size_t count = 0;
+      bool fits = true;
+      for (size_t i = 0; i < N && fits; ++i) {
+        if (hashes[i] % bucket_count != b) {
+          continue;
+        }
+        size_t slot = route_slot(hashes[i], seed) & mask;
+        fits = table.slots[slot] < 0 &&
+               std::find(taken.begin(), taken.begin() + count, slot) ==
+                   taken.begin() + count;
+        taken[count++] = slot;
+      }
+      if (!fits) {
+        continue;
+      }
+
+      table.seeds[b] = seed;
+      count = 0;
+      for (size_t i = 0; i < N; ++i) {
+        if (hashes[i] % bucket_count == b) {
+          table.slots[taken[count++]] = int32_t(i);
+        }
+      }
+      break;
+    }
+  }
+  return table;
+}
+
+template <size_t I, typename Route>
+struct route_holder {
+  Route route;
+};
+
+// flat, unlike a std::tuple, whose recursion makes tables of hundreds of
+// routes slow to compile
+template <typename Sequence, typename... Routes>
+struct route_holders;
+
+template <size_t... Is, typename... Routes>
+struct route_holders<std::index_sequence<Is...>, Routes...>
+    : route_holder<Is, Routes>... {
+  using thunk = void (*)(route_holders &, request &, response &);
+
+  constexpr explicit route_holders(Routes... routes)
+      : route_holder<Is, Routes>{std::move(routes)}... {}
+
+  template <size_t I, typename Route>
+  static void call(route_holders &self, request &req, response &res) {
+    auto &f = static_cast<route_holder<I, Route> &>(self).route.f;
+    using result_type =
+        std::invoke_result_t<decltype(f), request &, response &>;
+    if constexpr (is_lazy_v<result_type>) {
+      static_assert(std::is_void_v<typename result_type::ValueType>,
+                    "a coroutine handler must return Lazy<void>");
+      // the table outlives the coroutine, and with it the captures of f
+      req.set_lazy_handler(f(req, res));
+    }
+    else {
+      f(req, res);
+    }
+  }
+
+  static constexpr std::array<thunk, sizeof...(Routes)> thunks = {
+      &call<Is, Routes>...};
+};
+}  // namespace detail
+
+// Routes with fixed paths, looked up through a perfect hash built at
+// compile time and dispatched to the handlers without a std::function in
+// between. Handlers take (request &, response &) and return void or
+// Lazy<void>, aspects are not supported. Made by make_routes() and given to
+// http_server::set_route_table, the router serves what it doesn't have.
+template <typename... Routes>
+class route_table {
+ public:
+  constexpr explicit route_table(Routes... routes)
+      : routes_(std::move(routes)...) {}
+
+  // calls the handler of method and path, false when there is none
+  bool dispatch(std::string_view method, std::string_view path,
+                request &req, response &res) {
+    auto index = hash_.find(detail::route_hash(method, path));
+    if (index < 0) {
+      return false;
+    }
+    auto &key = keys_[index];
+    if (key.method != method || key.path != path) {
+      return false;
+    }
+    holders::thunks[key.route](routes_, req, res);
+    return true;
+  }
+
+  static constexpr size_t size() { return keys_.size(); }
+
+ private:
+  using holders =
+      detail::route_holders<std::index_sequence_for<Routes...>, Routes...>;
+
+  static constexpr auto make_keys() {
+    std::array<detail::route_key, (Routes::methods.size() + ...)> keys{};
+    size_t n = 0;
+    size_t route = 0;
+    auto add = [&](std::string_view path, auto &methods) {
+      for (auto method : methods) {
+        keys[n++] = {method, path, route};
+      }
+      ++route;
+    };
+    (add(Routes::path, Routes::methods), ...);
+    return keys;
+  }
+
+  static constexpr auto keys_ = make_keys();
+  static constexpr auto hash_ = detail::make_perfect_hash(keys_);
+
+  holders routes_;
+};
+
+template <typename... Routes>
+constexpr auto make_routes(Routes... routes) {
+  static_assert(sizeof...(Routes) > 0, "a route table needs routes");
+  return route_table<Routes...>(std::move(routes)...);
+}
+}  // namespace cinatra
@@ -0,0 +1,463 @@
+#pragma once
+#include <atomic>
+#include <fstream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "define.h"
+#include "file_validators.hpp"
+#include "mime_types.hpp"
+#include "precompressed.hpp"
+#include "use_asio.hpp"
+#include "utils.hpp"
+#if defined(__linux__)
+#include <sys/inotify.h>
+#define CINATRA_HAS_INOTIFY
+#endif
+
+namespace cinatra {
+// a cached static file: a copy of its bytes and the ready made header
+// block of the response. A copy and not a mapping of the file, which
+// would fault once the file is truncated or rewritten in place.
+struct static_file {
+  static_file() = default;
+  static_file(const static_file &) = delete;
+  static_file &operator=(const static_file &) = delete;
+
+  size_t cost() const {
+    return body.size() + gzip_body.size() + br_body.size() + header.size() +
+           gzip_header.size() + br_header.size();
+  }
+
+  std::string_view mime;
+  std::string_view body;
+  file_validators validators;
+  // status line and headers, without the empty line ending them
+  std::string header;
+  // the gzip and brotli variants, from sidecar files or, for gzip when it
+  // is enabled, compressed on load; empty when there are none. They are
+  // other representations, so they have their own ETags.
+  std::string gzip_body;
+  std::string gzip_header;
+  std::string gzip_etag;
+  std::string br_body;
+  std::string br_header;
+  std::string br_etag;
+
+  std::string content;  // the storage of body
+  // used since the clock hand of the cache last passed it
+  mutable std::atomic<bool> referenced = false;
+};
+
+// static files kept in memory by path, up to a byte budget; files not used
+// lately are dropped first, picked by a clock hand (second chance) so that
+// evicting one doesn't scan them all. On Linux files are invalidated by
+// inotify events of their directory, elsewhere they stay until clear().
+// Lookups take a shared lock only, so hits need no system call.
+class static_file_cache {
+ public:
+  void set_max_bytes(size_t size) {
+    std::unique_lock lock(mtx_);
+    max_bytes_ = size;
+    evict(0);
+  }
+
+  size_t max_bytes() const { return max_bytes_; }
+
+  // files bigger than this are not cached, max_bytes() / 8 by default.
+  void set_max_file_size(size_t size) { max_file_size_ = size; }
+
+  size_t max_file_size() const {
+    return max_file_size_ ? max_file_size_ : max_bytes_ / 8;
+  }
+
+  // headers added to every cached response, after Content-Type.
+  void set_extra_headers(std::string headers) {
+    std::unique_lock lock(mtx_);
+    extra_headers_ = std::move(headers);
+    erase_all();
+  }
+
+  // load "<file>.br" and "<file>.gz" sidecars as the compressed variants.
+  void set_sidecars(bool enable) {
+    std::unique_lock lock(mtx_);
+    sidecars_ = enable;
+    erase_all();
+  }
+
+  size_t size_bytes() const {
+    std::shared_lock lock(mtx_);
+    return bytes_;
+  }
+
+  size_t size() const {
+    std::shared_lock lock(mtx_);
+    return files_.size();
+  }
+
+  void clear() {
+    std::unique_lock lock(mtx_);
+    erase_all();
+  }
+
+  void invalidate(const std::string &path) {
+    std::unique_lock lock(mtx_);
+    ++generation_;
+    erase(path);
+  }
+
+  // starts watching for changes on ctx, before the first get().
+  void watch(asio::io_context &ctx) {
+#ifdef CINATRA_HAS_INOTIFY
+    if (events_) {
+      return;
+    }
+
+    int fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) {
+      return;
+    }
+
+    events_ = std::make_unique<asio::posix::stream_descriptor>(ctx, fd);
+    read_events();
+#else
+    (void)ctx;
+#endif
+  }
+
+  // stops watching, from the io_context given to watch(). The cached files
+  // are dropped as they could not be invalidated any more.
+  void unwatch() {
+#ifdef CINATRA_HAS_INOTIFY
+    if (!events_) {
+      return;
+    }
+
+    std::error_code ec;
+    events_->close(ec);
+    std::unique_lock lock(mtx_);
+    events_ = nullptr;
+    watches_.clear();
+    watched_dirs_.clear();
+    erase_all();
+#endif
+  }
+
+  // the cached file, it is loaded on a miss. nullptr when the file can't
+  // be read or is too big to be cached.
+  std::shared_ptr<const static_file> get(const std::string &path) {
+    {
+      std::shared_lock lock(mtx_);
+      auto it = files_.find(path);
+      if (it != files_.end()) {
+        auto &referenced = it->second.file->referenced;
+        if (!referenced.load(std::memory_order_relaxed)) {
+          referenced.store(true, std::memory_order_relaxed);
+        }
+        return it->second.file;
+      }
+    }
+
+    // watch before loading, so a change during the load is not missed.
+    uint64_t generation;
+    if (needs_watch(path, generation)) {
+      std::unique_lock lock(mtx_);
+      watch_dir(path);
+      generation = generation_;
+    }
+
+    auto file = load(path);
+    if (file == nullptr) {
+      return nullptr;
+    }
+
+    std::unique_lock lock(mtx_);
+    if (auto it = files_.find(path); it != files_.end()) {
+      return it->second.file;
+    }
+    if (generation != generation_ || file->cost() > max_bytes_) {
+      // something changed meanwhile, serve it once without caching it
+      return file;
+    }
+
+    evict(file->cost());
+    bytes_ += file->cost();
+    // behind the hand, so it is the last one it reaches
+    files_.emplace(path, entry{file, clock_.insert(hand_, path)});
+    return file;
+  }
+
+ private:
+  std::shared_ptr<static_file> load(const std::string &path) {
+    std::error_code ec;
+    if (!fs::is_regular_file(path, ec)) {
+      return nullptr;
+    }
+    size_t size = fs::file_size(path, ec);
+    if (ec || size > max_file_size()) {
+      return nullptr;
+    }
+
+    auto file = std::make_shared<static_file>();
+    if (!get_file_validators(path, file->validators) ||
+        !read_file(path, size, *file)) {
+      return nullptr;
+    }
+
+    file->mime = get_mime_type(get_extension(path));
+    std::string headers = "Access-Control-Allow-origin: *\r\nContent-type: ";
+    headers.append(file->mime).append("; charset=utf8\r\n");
+    bool sidecars;
+    {
+      std::shared_lock lock(mtx_);
+      headers.append(extra_headers_);
+      sidecars = sidecars_;
+    }
+
+    auto &validators = file->validators;
+    if (sidecars) {
+      read_sidecar(path + ".br", validators, file->br_body);
+      read_sidecar(path + ".gz", validators, file->gzip_body);
+    }
+#ifdef CINATRA_ENABLE_GZIP
+    if (file->gzip_body.empty() && is_compressible_mime(file->mime) &&
+        !gzip_codec::compress(file->body, file->gzip_body)) {
+      file->gzip_body.clear();
+    }
+#endif
+    if (!file->gzip_body.empty() || !file->br_body.empty()) {
+      headers.append("Vary: Accept-Encoding\r\n");
+    }
+
+    file->header =
+        make_header(headers + validators.to_headers(), file->body.size());
+    auto make_variant = [&](std::string_view encoding, const std::string &body,
+                            std::string &header, std::string &etag) {
+      if (body.empty()) {
+        return;
+      }
+      etag = coded_etag(validators.etag, encoding);
+      header = make_header(headers + "Content-Encoding: " +
+                               std::string(encoding) + "\r\nETag: " + etag +
+                               "\r\nLast-Modified: " +
+                               validators.last_modified + "\r\n",
+                           body.size());
+    };
+    make_variant("gzip", file->gzip_body, file->gzip_header, file->gzip_etag);
+    make_variant("br", file->br_body, file->br_header, file->br_etag);
+    return file;
+  }
+
+  // a sidecar older than the file is stale and ignored.
+  static void read_sidecar(const std::string &path,
+                           const file_validators &original, std::string &out) {
+    file_validators validators;
+    if (!get_file_validators(path, validators) ||
+        validators.mtime < original.mtime) {
+      return;
+    }
+
+    std::ifstream in(path, std::ios::binary);
+    out.resize(size_t(validators.size));
+    in.read(out.data(), validators.size);
+    out.resize(size_t(in.gcount()));
+  }
+
+  static std::string make_header(const std::string &headers, size_t length) {
+    std::string header = "HTTP/1.1 200 OK\r\n";
+    header.append(headers)
+        .append("Content-Length: ")
+        .append(std::to_string(length))
+        .append("\r\nServer: cinatra\r\n");
+    return header;
+  }
+
+  static bool read_file(const std::string &path, size_t size,
+                        static_file &file) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open()) {
+      return false;
+    }
+
+    file.content.resize(size);
+    in.read(file.content.data(), size);
+    file.content.resize(size_t(in.gcount()));
+    file.body = file.content;
+    return true;
+  }
+
+  struct entry {
+    std::shared_ptr<static_file> file;
+    std::list<std::string>::iterator pos;  // in clock_
+  };
+
+  // the lock is held by the caller of these.
+  void erase(std::unordered_map<std::string, entry>::iterator it) {
+    if (hand_ == it->second.pos) {
+      ++hand_;
+    }
+    clock_.erase(it->second.pos);
+    bytes_ -= it->second.file->cost();
+    files_.erase(it);
+  }
+
+  void erase(const std::string &path) {
+    if (auto it = files_.find(path); it != files_.end()) {
+      erase(it);
+    }
+  }
+
+  void erase_all() {
+    files_.clear();
+    clock_.clear();
+    hand_ = clock_.end();
+    bytes_ = 0;
+  }
+
+  // makes room for cost more bytes. The hand gives a file used since it
+  // last passed a second chance and drops the first one which wasn't.
+  void evict(size_t cost) {
+    while (!files_.empty() && bytes_ + cost > max_bytes_) {
+      if (hand_ == clock_.end()) {
+        hand_ = clock_.begin();
+      }
+      auto it = files_.find(*hand_);
+      if (it->second.file->referenced.exchange(false,
+                                               std::memory_order_relaxed)) {
+        ++hand_;
+        continue;
+      }
+      erase(it);
+    }
+  }
+
+  // whether the directory of path isn't watched yet, checked under the
+  // shared lock. generation is set when it is.
+  bool needs_watch(const std::string &path, uint64_t &generation) const {
+    std::shared_lock lock(mtx_);
+#ifdef CINATRA_HAS_INOTIFY
+    if (events_ &&
+        !watched_dirs_.count(fs::path(path).parent_path().string())) {
+      return true;
+    }
+#else
+    (void)path;
+#endif
+    generation = generation_;
+    return false;
+  }
+
+  // the lock is held.
+  void watch_dir(const std::string &path) {
+#ifdef CINATRA_HAS_INOTIFY
+    if (!events_) {
+      return;
+    }
+
+    auto dir = fs::path(path).parent_path().string();
+    if (watched_dirs_.count(dir)) {
+      return;
+    }
+
+    int wd = ::inotify_add_watch(
+        events_->native_handle(), dir.data(),
+        IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE |
+            IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF);
+    if (wd < 0) {
+      return;
+    }
+
+    watched_dirs_.insert(dir);
+    watches_[wd] = std::move(dir);
+#else
+    (void)path;
+#endif
+  }
+
+#ifdef CINATRA_HAS_INOTIFY
+  void read_events() {
+    events_->async_read_some(
+        asio::buffer(event_buf_),
+        [this](const std::error_code &ec, size_t size) {
+          if (ec) {
+            return;
+          }
+
+          handle_events(size);
+          read_events();
+        });
+  }
+
+  void handle_events(size_t size) {
+    std::unique_lock lock(mtx_);
+    ++generation_;
+    for (size_t pos = 0; pos + sizeof(inotify_event) <= size;) {
+      auto event = reinterpret_cast<inotify_event *>(event_buf_ + pos);
+      pos += sizeof(inotify_event) + event->len;
+
+      if (event->mask & IN_Q_OVERFLOW) {
+        // events were lost
+        erase_all();
+        continue;
+      }
+
+      auto it = watches_.find(event->wd);
+      if (it == watches_.end()) {
+        continue;
+      }
+
+      if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+        // the directory itself is gone, drop what was cached from it. A
+        // moved one is still watched under its new name, a directory put
+        // in its place, an atomic deploy, is watched on the next miss.
+        auto prefix = it->second + "/";
+        for (auto file = files_.begin(); file != files_.end();) {
+          auto next = std::next(file);
+          if (file->first.compare(0, prefix.size(), prefix) == 0) {
+            erase(file);
+          }
+          file = next;
+        }
+        ::inotify_rm_watch(events_->native_handle(), event->wd);
+        watched_dirs_.erase(it->second);
+        watches_.erase(it);
+        continue;
+      }
+
+      if (event->len > 0) {
+        auto name = it->second + "/" + event->name;
+        // a changed sidecar changes the file it belongs to
+        auto extension = get_extension(name);
+        if (extension == ".gz" || extension == ".br") {
+          erase(name.substr(0, name.size() - extension.size()));
+        }
+        erase(name);
+      }
+    }
+  }
+
+  std::unique_ptr<asio::posix::stream_descriptor> events_;
+  alignas(inotify_event) char event_buf_[16 * 1024];
+  std::unordered_map<int, std::string> watches_;
+  std::unordered_set<std::string> watched_dirs_;
+#endif
+
+  mutable std::shared_mutex mtx_;
+  std::unordered_map<std::string, entry> files_;
+  // the paths of files_, the hand goes round them to evict
+  std::list<std::string> clock_;
+  std::list<std::string>::iterator hand_ = clock_.end();
+  uint64_t generation_ = 0;
+  size_t bytes_ = 0;
+  size_t max_bytes_ = 0;
+  size_t max_file_size_ = 0;
+  bool sidecars_ = false;
+  std::string extra_headers_;
+};
+}  // namespace cinatra
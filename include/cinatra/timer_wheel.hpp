@@ -0,0 +1,169 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+
+#include "use_asio.hpp"
+
+namespace cinatra {
+// intrusive entry of a timer_wheel, embedded in its owner. on_expire is
+// called with owner when the deadline passes.
+struct timer_node {
+  timer_node *prev = nullptr;
+  timer_node *next = nullptr;
+  uint64_t expire_tick = 0;
+  void (*on_expire)(void *owner) = nullptr;
+  void *owner = nullptr;
+
+  bool linked() const { return next != nullptr; }
+};
+
+// per io_context hierarchical timer wheel with coarse ticks. Arming,
+// re-arming and cancelling a node is an O(1) relink; the only asio timer
+// is the wheel's own tick, which runs only while some node is linked.
+// Not thread safe, use it from its io_context only.
+class timer_wheel : public asio::execution_context::service {
+ public:
+  inline static asio::execution_context::id id;
+
+  static constexpr std::chrono::milliseconds tick_duration{100};
+
+  explicit timer_wheel(asio::io_context &ctx)
+      : asio::execution_context::service(ctx),
+        timer_(ctx),
+        start_(std::chrono::steady_clock::now()) {
+    for (auto &slot : near_) {
+      slot.prev = slot.next = &slot;
+    }
+    for (auto &slot : far_) {
+      slot.prev = slot.next = &slot;
+    }
+  }
+
+  template <typename Rep, typename Period>
+  void add(timer_node &node, std::chrono::duration<Rep, Period> timeout) {
+    if (!running_) {
+      // nothing is linked, catch up with the clock before linking.
+      now_ = current_tick();
+    }
+
+    uint64_t ticks = (timeout + tick_duration - std::chrono::nanoseconds(1)) /
+                     tick_duration;
+    if (node.linked()) {
+      unlink(node);
+    }
+    else {
+      ++count_;
+    }
+    node.expire_tick = now_ + (ticks == 0 ? 1 : ticks);
+    link(node);
+
+    if (!running_) {
+      running_ = true;
+      arm();
+    }
+  }
+
+  void remove(timer_node &node) {
+    if (!node.linked()) {
+      return;
+    }
+    unlink(node);
+    --count_;
+  }
+
+  std::size_t size() const { return count_; }
+
+ private:
+  static constexpr uint64_t near_bits = 8;
+  static constexpr uint64_t far_bits = 6;
+  static constexpr uint64_t near_size = uint64_t(1) << near_bits;
+  static constexpr uint64_t far_size = uint64_t(1) << far_bits;
+
+  void shutdown() override {
+    std::error_code ec;
+    timer_.cancel(ec);
+  }
+
+  uint64_t current_tick() const {
+    return (std::chrono::steady_clock::now() - start_) / tick_duration;
+  }
+
+  static void unlink(timer_node &node) {
+    node.prev->next = node.next;
+    node.next->prev = node.prev;
+    node.prev = node.next = nullptr;
+  }
+
+  void link(timer_node &node) {
+    uint64_t delta = node.expire_tick - now_;
+    timer_node *slot;
+    if (delta < near_size) {
+      slot = &near_[node.expire_tick & (near_size - 1)];
+    }
+    else {
+      if (delta >= near_size * far_size) {
+        // clamp, the node is cascaded again when its slot comes up.
+        delta = near_size * far_size - 1;
+      }
+      slot = &far_[((now_ + delta) >> near_bits) & (far_size - 1)];
+    }
+
+    node.prev = slot->prev;
+    node.next = slot;
+    slot->prev->next = &node;
+    slot->prev = &node;
+  }
+
+  void advance() {
+    ++now_;
+    if ((now_ & (near_size - 1)) == 0) {
+      timer_node &slot = far_[(now_ >> near_bits) & (far_size - 1)];
+      while (slot.next != &slot) {
+        timer_node &node = *slot.next;
+        unlink(node);
+        if (node.expire_tick < now_) {
+          node.expire_tick = now_;
+        }
+        link(node);
+      }
+    }
+
+    timer_node &slot = near_[now_ & (near_size - 1)];
+    while (slot.next != &slot) {
+      timer_node &node = *slot.next;
+      unlink(node);
+      --count_;
+      node.on_expire(node.owner);
+    }
+  }
+
+  void arm() {
+    timer_.expires_at(start_ + (now_ + 1) * tick_duration);
+    timer_.async_wait([this](const std::error_code &ec) {
+      if (ec) {
+        running_ = false;
+        return;
+      }
+
+      uint64_t target = current_tick();
+      while (now_ < target && count_ > 0) {
+        advance();
+      }
+
+      if (count_ == 0) {
+        running_ = false;
+        return;
+      }
+      arm();
+    });
+  }
+
+  asio::steady_timer timer_;
+  std::chrono::steady_clock::time_point start_;
+  uint64_t now_ = 0;
+  std::size_t count_ = 0;
+  bool running_ = false;
+  timer_node near_[near_size];
+  timer_node far_[far_size];
+};
+}  // namespace cinatra
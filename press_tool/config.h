@@ -16,6 +16,7 @@ struct press_config {
   std::chrono::steady_clock::duration press_interval;
   std::string url;
   int read_fix = 0;
+  int pipeline = 1;
   std::map<std::string, std::string> add_headers;
 };
 
@@ -23,6 +24,8 @@ struct thread_counter {
   std::thread thd;
   std::shared_ptr<asio::io_context> ioc;
   std::vector<std::shared_ptr<cinatra::coro_http_client>> conns;
+  // raw connections for the pipeline mode
+  std::vector<std::shared_ptr<asio::ip::tcp::socket>> sockets;
   //  uint64_t connections;
   uint64_t complete;
   uint64_t requests;
@@ -31,6 +34,7 @@ struct thread_counter {
   uint64_t errors;
   uint64_t max_request_time;
   uint64_t min_request_time = UINT32_MAX;
+  std::vector<uint64_t> latencies;
   bool has_net_err = false;
 };
 }  // namespace cinatra::press_tool
\ No newline at end of file
@@ -31,6 +31,10 @@ press_config init_conf(const cmdline::parser& parser) {
     exit(1);
   }
   conf.read_fix = parser.get<int>("readfix");
+  conf.pipeline = parser.get<int>("pipeline");
+  if (conf.pipeline < 1) {
+    conf.pipeline = 1;
+  }
 
   std::string duration_str = parser.get<std::string>("duration");
   if (duration_str.size() < 2) {
@@ -126,6 +130,140 @@ async_simple::coro::Lazy<void> create_clients(const press_config& conf,
   std::cout << "\n";
 }
 
+// pipeline mode: connect raw sockets, coro_http_client waits for each
+// response before sending the next request.
+void create_pipeline_conns(const press_config& conf,
+                           std::vector<thread_counter>& v) {
+  cinatra::uri_t u;
+  if (!u.parse_from(conf.url.data())) {
+    std::cerr << "invalid url " << conf.url << "\n";
+    exit(1);
+  }
+
+  for (int i = 0; i < conf.connections; ++i) {
+    auto& thd_counter = v[i % conf.threads_num];
+    auto socket = std::make_shared<asio::ip::tcp::socket>(*thd_counter.ioc);
+    asio::ip::tcp::resolver resolver(*thd_counter.ioc);
+    std::error_code ec;
+    asio::connect(*socket, resolver.resolve(u.get_host(), u.get_port()), ec);
+    if (ec) {
+      std::cerr << "connect " << conf.url << " failed: " << ec.message()
+                << "\n";
+      exit(1);
+    }
+    socket->set_option(asio::ip::tcp::no_delay(true));
+    thd_counter.sockets.push_back(std::move(socket));
+  }
+
+  std::cout << "create " << conf.connections << " connections"
+            << " successfully, pipeline " << conf.pipeline << "\n";
+}
+
+std::string build_pipeline_batch(const press_config& conf) {
+  cinatra::uri_t u;
+  u.parse_from(conf.url.data());
+  std::string req = "GET " + u.get_path();
+  if (!u.get_query().empty()) {
+    req.append("?").append(u.get_query());
+  }
+  req.append(" HTTP/1.1\r\nHost: ").append(u.get_host()).append("\r\n");
+  for (auto& [k, v] : conf.add_headers) {
+    req.append(k).append(": ").append(v).append("\r\n");
+  }
+  req.append("\r\n");
+
+  std::string batch;
+  for (int i = 0; i < conf.pipeline; ++i) {
+    batch.append(req);
+  }
+  return batch;
+}
+
+// send the whole batch in one write, then read back as many responses.
+async_simple::coro::Lazy<void> press_pipeline_conn(
+    thread_counter& counter, asio::ip::tcp::socket& socket,
+    const std::string& batch, int depth, std::atomic_bool& stop) {
+  std::string buf;
+  buf.resize(64 * 1024);
+  size_t cur = 0;
+  cinatra::http_parser parser;
+  while (!stop) {
+    auto start = std::chrono::steady_clock::now();
+    auto [ec, size] =
+        co_await asio_util::async_write(socket, asio::buffer(batch));
+    if (ec) {
+      counter.has_net_err = true;
+      co_return;
+    }
+
+    int got = 0;
+    int ok = 0;
+    size_t pos = 0;
+    while (got < depth) {
+      int ret = parser.parse_response(buf.data() + pos, cur - pos, 0);
+      if (ret > 0 && size_t(parser.total_len()) <= cur - pos) {
+        if (parser.status() == 200) {
+          ok++;
+        }
+        counter.bytes += parser.total_len();
+        pos += parser.total_len();
+        got++;
+        continue;
+      }
+
+      if (ret == -1) {
+        counter.has_net_err = true;
+        co_return;
+      }
+
+      // need more data
+      std::memmove(buf.data(), buf.data() + pos, cur - pos);
+      cur -= pos;
+      pos = 0;
+      if (cur == buf.size()) {
+        buf.resize(buf.size() * 2);
+      }
+      auto [rec, n] = co_await asio_util::async_read_some(
+          socket, asio::buffer(buf.data() + cur, buf.size() - cur));
+      if (rec) {
+        if (!stop) {
+          counter.has_net_err = true;
+        }
+        co_return;
+      }
+      cur += n;
+    }
+    std::memmove(buf.data(), buf.data() + pos, cur - pos);
+    cur -= pos;
+
+    auto latency = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+    counter.requests += depth;
+    counter.complete += ok;
+    counter.errors += depth - ok;
+    for (int i = 0; i < ok; ++i) {
+      counter.latencies.push_back(latency);
+    }
+    if (counter.max_request_time < uint64_t(latency))
+      counter.max_request_time = latency;
+    if (counter.min_request_time > uint64_t(latency))
+      counter.min_request_time = latency;
+  }
+}
+
+async_simple::coro::Lazy<void> press_pipeline(thread_counter& counter,
+                                              const press_config& conf,
+                                              std::atomic_bool& stop) {
+  std::string batch = build_pipeline_batch(conf);
+  std::vector<async_simple::coro::Lazy<void>> futures;
+  for (auto& socket : counter.sockets) {
+    futures.push_back(
+        press_pipeline_conn(counter, *socket, batch, conf.pipeline, stop));
+  }
+  co_await async_simple::coro::collectAll(std::move(futures));
+}
+
 async_simple::coro::Lazy<void> press(thread_counter& counter,
                                      const std::string& url,
                                      std::atomic_bool& stop) {
@@ -158,6 +296,7 @@ async_simple::coro::Lazy<void> press(thread_counter& counter,
         counter.complete++;
         counter.bytes += result.total;
 
+        counter.latencies.push_back(latency);
         if (counter.max_request_time < latency)
           counter.max_request_time = latency;
         if (counter.min_request_time > latency)
@@ -204,6 +343,10 @@ int main(int argc, char* argv[]) {
       "SAMEORIGIN\"",
       false, "");
   parser.add<int>("readfix", 'r', "read fixed response", false, 0);
+  parser.add<int>("pipeline", 'p',
+                  "number of GET requests pipelined on each connection per "
+                  "write, e.g. 16",
+                  false, 1);
 
   parser.parse_check(argc, argv);
 
@@ -222,13 +365,23 @@ int main(int argc, char* argv[]) {
   }
 
   // create clients
-  async_simple::coro::syncAwait(create_clients(conf, v));
+  if (conf.pipeline > 1) {
+    create_pipeline_conns(conf, v);
+  }
+  else {
+    async_simple::coro::syncAwait(create_clients(conf, v));
+  }
 
   // create parallel request
   std::vector<async_simple::coro::Lazy<void>> futures;
   std::atomic_bool stop = false;
   for (auto& counter : v) {
-    futures.push_back(press(counter, conf.url, stop));
+    if (conf.pipeline > 1) {
+      futures.push_back(press_pipeline(counter, conf, stop));
+    }
+    else {
+      futures.push_back(press(counter, conf.url, stop));
+    }
   }
 
   // start timer
@@ -247,6 +400,12 @@ int main(int argc, char* argv[]) {
         conn->set_bench_stop();
         conn->async_close();
       }
+      for (auto& socket : counter.sockets) {
+        asio::post(socket->get_executor(), [socket] {
+          std::error_code ec;
+          socket->close(ec);
+        });
+      }
     }
   });
   std::thread timer_thd([&timer_ioc] {
@@ -285,7 +444,10 @@ int main(int argc, char* argv[]) {
   uint64_t max_latency = 0.0;
   uint64_t min_latency = UINT32_MAX;
   uint64_t errors_requests = 0;
+  std::vector<uint64_t> latencies;
   for (auto& counter : v) {
+    latencies.insert(latencies.end(), counter.latencies.begin(),
+                     counter.latencies.end());
     total += counter.requests;
     complete += counter.complete;
     errors += counter.errors;
@@ -317,6 +479,12 @@ int main(int argc, char* argv[]) {
             << "     " << double(max_latency) / 1000000 << "ms"
             << "     " << variation << "ms"
             << "     " << stdev << "ms\n";
+  std::cout << "  Latency Distribution\n";
+  for (double p : {50.0, 90.0, 99.0}) {
+    std::cout << "    " << std::setprecision(0) << p << "%    "
+              << std::setprecision(3)
+              << double(percentile(latencies, p)) / 1000000 << "ms\n";
+  }
   std::cout << "  " << complete << " requests in " << dur_s << "s"
             << ", " << bytes_to_string(total_resp_size) << " read"
             << ", total: " << total << ", errors: " << errors << "\n";
@@ -1,5 +1,7 @@
 #pragma once
+#include <algorithm>
 #include <string>
+#include <vector>
 
 namespace cinatra::press_tool {
 constexpr uint64_t ONE_BYTE = 1;
@@ -31,6 +33,17 @@ inline std::string bytes_to_string(uint64_t bytes) {
   return ss.str();
 }
 
+// p in [0, 100], the samples will be sorted
+inline uint64_t percentile(std::vector<uint64_t> &samples, double p) {
+  if (samples.empty()) {
+    return 0;
+  }
+
+  std::sort(samples.begin(), samples.end());
+  size_t index = size_t(p / 100 * (samples.size() - 1));
+  return samples[index];
+}
+
 inline std::vector<std::string> &split(std::string &str,
                                        const std::string &delimiter,
                                        std::vector<std::string> &elems) {
@@ -3,6 +3,7 @@
 #include <chrono>
 #include <filesystem>
 #include <future>
+#include <set>
 #include <system_error>
 #include <vector>
 
@@ -767,6 +768,2118 @@ TEST_CASE("test coro_http_client no scheme still send request check") {
   server_thread.join();
 }
 
+TEST_CASE("test coroutine connection engine") {
+  http_server server(std::thread::hardware_concurrency());
+  server.enable_coro_connection(true);
+  bool r = server.listen("0.0.0.0", "8091");
+  if (!r) {
+    std::cout << "listen failed."
+              << "\n";
+  }
+  server.set_http_handler<GET>("/plaintext", [](request &, response &res) {
+    res.set_status_and_content(status_type::ok, "Hello, World!",
+                               req_content_type::string);
+  });
+  server.set_http_handler<POST>("/echo", [](request &req, response &res) {
+    res.set_status_and_content(status_type::ok, std::string(req.body()));
+  });
+
+  std::promise<void> pr;
+  std::future<void> f = pr.get_future();
+  std::thread server_thread([&server, &pr]() {
+    pr.set_value();
+    server.run();
+  });
+  f.wait();
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  coro_http_client client{};
+  for (int i = 0; i < 3; i++) {
+    auto result = async_simple::coro::syncAwait(
+        client.async_get("http://127.0.0.1:8091/plaintext"));
+    CHECK(result.status == 200);
+    CHECK(result.resp_body == "Hello, World!");
+  }
+
+  std::string body(4096, 'a');
+  auto result = async_simple::coro::syncAwait(client.async_post(
+      "http://127.0.0.1:8091/echo", body, req_content_type::string));
+  CHECK(result.status == 200);
+  CHECK(result.resp_body == body);
+
+  result = async_simple::coro::syncAwait(
+      client.async_get("http://127.0.0.1:8091/not_exist"));
+  CHECK(result.status == 404);
+
+  server.stop();
+  server_thread.join();
+}
+
+TEST_CASE("test reuse port acceptor per io_context") {
+  http_server server(2);
+  server.enable_reuse_port(true, true);
+  bool r = server.listen("0.0.0.0", "8092");
+  if (!r) {
+    std::cout << "listen failed."
+              << "\n";
+  }
+  server.set_http_handler<GET>("/", [](request &, response &res) {
+    res.set_status_and_content(status_type::ok, "hello world");
+  });
+
+  std::promise<void> pr;
+  std::future<void> f = pr.get_future();
+  std::thread server_thread([&server, &pr]() {
+    pr.set_value();
+    server.run();
+  });
+  f.wait();
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  for (int i = 0; i < 4; i++) {
+    coro_http_client client{};
+    auto result = async_simple::coro::syncAwait(
+        client.async_get("http://127.0.0.1:8092/"));
+    CHECK(result.status == 200);
+    CHECK(result.resp_body == "hello world");
+  }
+
+  server.stop();
+  server_thread.join();
+}
+
+TEST_CASE("test timer wheel") {
+  asio::io_context ioc;
+  auto &wheel = asio::use_service<timer_wheel>(ioc);
+
+  std::vector<int> fired;
+  struct entry {
+    timer_node node;
+    int id;
+    std::vector<int> *fired;
+  };
+  entry entries[3];
+  for (int i = 0; i < 3; i++) {
+    entries[i].id = i;
+    entries[i].fired = &fired;
+    entries[i].node.owner = &entries[i];
+    entries[i].node.on_expire = [](void *owner) {
+      auto e = static_cast<entry *>(owner);
+      e->fired->push_back(e->id);
+    };
+  }
+
+  wheel.add(entries[0].node, std::chrono::milliseconds(300));
+  wheel.add(entries[1].node, std::chrono::milliseconds(100));
+  wheel.add(entries[2].node, std::chrono::milliseconds(100));
+  // relink moves the deadline, remove drops it.
+  wheel.add(entries[1].node, std::chrono::milliseconds(500));
+  wheel.remove(entries[2].node);
+  CHECK(wheel.size() == 2);
+
+  auto start = std::chrono::steady_clock::now();
+  ioc.run();  // returns once the wheel is empty
+  auto elapsed = std::chrono::steady_clock::now() - start;
+
+  CHECK(fired == std::vector<int>{0, 1});
+  CHECK(wheel.size() == 0);
+  CHECK(elapsed >= std::chrono::milliseconds(400));
+  CHECK(elapsed < std::chrono::seconds(2));
+}
+
+TEST_CASE("test keep alive timeout closes idle connection") {
+  http_server server(1);
+  server.set_keep_alive_timeout(1);
+  bool r = server.listen("0.0.0.0", "8093");
+  if (!r) {
+    std::cout << "listen failed."
+              << "\n";
+  }
+
+  std::promise<void> pr;
+  std::future<void> f = pr.get_future();
+  std::thread server_thread([&server, &pr]() {
+    pr.set_value();
+    server.run();
+  });
+  f.wait();
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  asio::io_context ioc;
+  asio::ip::tcp::socket socket(ioc);
+  std::error_code ec;
+  socket.connect(
+      asio::ip::tcp::endpoint(asio::ip::address::from_string("127.0.0.1"),
+                              8093),
+      ec);
+  CHECK(!ec);
+
+  auto start = std::chrono::steady_clock::now();
+  char buf[16];
+  socket.read_some(asio::buffer(buf), ec);
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  CHECK(ec == asio::error::eof);
+  CHECK(elapsed < std::chrono::seconds(3));
+
+  server.stop();
+  server_thread.join();
+}
+
+TEST_CASE("test pipelined requests of any method") {
+  http_server server(1);
+  server.set_max_pipeline_depth(2);
+  bool r = server.listen("0.0.0.0", "8094");
+  if (!r) {
+    std::cout << "listen failed."
+              << "\n";
+  }
+  server.set_http_handler<GET, POST, PUT, DEL>(
+      "/pipe", [](request &req, response &res) {
+        std::string str(req.get_method());
+        if (!req.body().empty()) {
+          str.append(" ").append(req.body());
+        }
+        res.set_status_and_content(status_type::ok, std::move(str));
+      });
+
+  std::promise<void> pr;
+  std::future<void> f = pr.get_future();
+  std::thread server_thread([&server, &pr]() {
+    pr.set_value();
+    server.run();
+  });
+  f.wait();
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  asio::io_context ioc;
+  asio::ip::tcp::socket socket(ioc);
+  std::error_code ec;
+  socket.connect(
+      asio::ip::tcp::endpoint(asio::ip::address::from_string("127.0.0.1"),
+                              8094),
+      ec);
+  REQUIRE(!ec);
+
+  std::string batch =
+      "GET /pipe HTTP/1.1\r\nHost: cinatra\r\n\r\n"
+      "POST /pipe HTTP/1.1\r\nContent-Length: 3\r\n\r\nabc"
+      "PUT /pipe HTTP/1.1\r\nContent-Length: 5\r\n\r\nhello"
+      "DELETE /pipe HTTP/1.1\r\n\r\n"
+      "GET /pipe HT";
+  asio::write(socket, asio::buffer(batch), ec);
+  REQUIRE(!ec);
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  // the last request is split across two writes.
+  asio::write(socket, asio::buffer(std::string("TP/1.1\r\n\r\n")), ec);
+  REQUIRE(!ec);
+
+  std::vector<std::string> bodies;
+  std::string buf;
+  http_parser parser;
+  char tmp[1024];
+  while (bodies.size() < 5) {
+    size_t n = socket.read_some(asio::buffer(tmp), ec);
+    REQUIRE(!ec);
+    buf.append(tmp, n);
+    while (true) {
+      int ret = parser.parse_response(buf.data(), buf.size(), 0);
+      if (ret < 0 || size_t(parser.total_len()) > buf.size()) {
+        break;
+      }
+      CHECK(parser.status() == 200);
+      bodies.push_back(buf.substr(parser.header_len(), parser.body_len()));
+      buf.erase(0, parser.total_len());
+    }
+  }
+
+  CHECK(bodies == std::vector<std::string>{"GET", "POST abc", "PUT hello",
+                                           "DELETE", "GET"});
+  CHECK(buf.empty());
+
+  server.stop();
+  server_thread.join();
+}
+
+TEST_CASE("test buffer pool") {
+  auto before = buffer_pool::stats();
+  {
+    pooled_buffer buf;
+    buf.resize(100);
+    CHECK(buf.capacity() == 1024);
+    std::memcpy(buf.data(), "hello", 5);
+    buf.resize(3000);
+    CHECK(buf.capacity() == 4096);
+    CHECK(std::string_view(buf.data(), 5) == "hello");
+    buf.resize(10);
+    CHECK(buf.capacity() == 4096);
+  }
+
+  pooled_buffer buf;
+  buf.resize(4000);  // the 4KB buffer released above
+  auto after = buffer_pool::stats();
+  CHECK(after.hits > before.hits);
+  CHECK(after.misses >= before.misses + 2);
+  CHECK(after.resident_bytes >= before.resident_bytes + 4096);
+  CHECK(after.hit_rate() > 0);
+}
+
+TEST_CASE("test large request buffer goes back to the pool") {
+  http_server server(1);
+  server.set_release_idle_buffer(true);
+  bool r = server.listen("0.0.0.0", "8095");
+  if (!r) {
+    std::cout << "listen failed."
+              << "\n";
+  }
+  server.set_http_handler<GET>("/plaintext", [](request &, response &res) {
+    res.set_status_and_content(status_type::ok, "hello world");
+  });
+  server.set_http_handler<POST>("/echo", [](request &req, response &res) {
+    res.set_status_and_content(status_type::ok, std::string(req.body()));
+  });
+
+  std::promise<void> pr;
+  std::future<void> f = pr.get_future();
+  std::thread server_thread([&server, &pr]() {
+    pr.set_value();
+    server.run();
+  });
+  f.wait();
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  auto before = buffer_pool::stats();
+  coro_http_client client{};
+  std::string body(200 * 1024, 'a');
+  auto result = async_simple::coro::syncAwait(client.async_post(
+      "http://127.0.0.1:8095/echo", body, req_content_type::string));
+  CHECK(result.status == 200);
+  CHECK(result.resp_body == body);
+
+  result = async_simple::coro::syncAwait(
+      client.async_get("http://127.0.0.1:8095/plaintext"));
+  CHECK(result.status == 200);
+  CHECK(result.resp_body == "hello world");
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+  // the 256KB buffer is cached by the server thread's pool again.
+  auto after = buffer_pool::stats();
+  CHECK(after.cached_bytes >= before.cached_bytes + 200 * 1024);
+
+  server.stop();
+  server_thread.join();
+}
+
+TEST_CASE("test header index") {
+  std::string_view raw =
+      "GET /index.html HTTP/1.1\r\n"
+      "Host: www.example.com\r\n"
+      "CONNECTION: keep-alive\r\n"
+      "Sec-Fetch-Mode: navigate\r\n"
+      "X-Custom: first\r\n"
+      "x-custom: second\r\n"
+      "X-Trace-Id: 42\r\n"
+      "\r\n";
+
+  response res;
+  request req(res);
+  std::memcpy(req.buffer(), raw.data(), raw.size());
+  req.update_and_expand_size(raw.size());
+  CHECK(req.parse_header(0) == int(raw.size()));
+
+  auto check = [&req] {
+    CHECK(req.get_header_value(http_header::host) == "www.example.com");
+    CHECK(req.get_header_value("Connection") == "keep-alive");
+    CHECK(req.get_header_value("sec-fetch-mode") == "navigate");
+    CHECK(req.get_header_value("X-CUSTOM") == "first");
+    CHECK(req.get_header_value("x-trace-id") == "42");
+    CHECK(req.get_header_value("cookie").empty());
+    CHECK(req.get_header_value("x-missing").empty());
+  };
+  check();
+
+  // the headers are copied out of the buffer before it is reused.
+  req.set_current_size(0);
+  check();
+  CHECK(req.get_headers().second == 6);
+}
+
+TEST_CASE("test query params") {
+  query_params params;
+  params.set_source("name=tom+cat&city=%E5%8C%97%E4%BA%AC&name=jerry&n=12");
+  CHECK(params.size() == 3);
+  CHECK(params.get("name") == "tom cat");
+  CHECK(params.get("city") == "\xE5\x8C\x97\xE4\xBA\xAC");
+  CHECK(params[2].second == "12");
+  CHECK(params.get("missing").empty());
+  CHECK(params.find("missing") == nullptr);
+
+  // past the inline storage
+  std::string many;
+  for (int i = 0; i < 40; i++) {
+    many += "k" + std::to_string(i) + "=" + std::to_string(i) + "&";
+  }
+  params.set_source(many);
+  CHECK(params.size() == 40);
+  CHECK(params.get("k0") == "0");
+  CHECK(params.get("k39") == "39");
+
+  params.set_source("no params");
+  CHECK(params.empty());
+
+  std::string_view raw = "GET /test?id=42&msg=a%20b HTTP/1.1\r\n"
+                         "Host: localhost\r\n"
+                         "\r\n";
+  response res;
+  request req(res);
+  std::memcpy(req.buffer(), raw.data(), raw.size());
+  req.update_and_expand_size(raw.size());
+  CHECK(req.parse_header(0) == int(raw.size()));
+  CHECK(req.get_url() == "/test");
+  CHECK(req.get_query_value("msg") == "a b");
+  CHECK(req.get_query_value<int>("id") == 42);
+  CHECK(req.get_query_value(0) == "42");
+  CHECK(req.queries().size() == 2);
+}
+
+TEST_CASE("test response buffers") {
+  auto to_string = [](const std::vector<asio::const_buffer> &buffers) {
+    std::string str;
+    for (auto &buf : buffers) {
+      str.append(static_cast<const char *>(buf.data()), buf.size());
+    }
+    return str;
+  };
+
+  response res;
+  std::string body(100000, 'a');
+  const char *body_data = body.data();
+  res.add_header("X-Test", "1");
+  res.set_status_and_content(status_type::ok, std::move(body),
+                             req_content_type::string);
+  auto &buffers = res.to_buffers();
+  // the body is sent in place
+  CHECK(buffers.back().data() == body_data);
+  CHECK(to_string(buffers) ==
+        "HTTP/1.1 200 OK\r\nX-Test: 1\r\nContent-Length: 100000\r\n"
+        "Content-Type: text/plain; charset=UTF-8\r\nServer: cinatra\r\n\r\n" +
+            std::string(100000, 'a'));
+
+  res.reset();
+  res.set_status_and_content<status_type::ok, req_content_type::string>(
+      "hello");
+  CHECK(to_string(res.to_buffers()) ==
+        "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n"
+        "Content-Type: text/plain; charset=UTF-8\r\nServer: "
+        "cinatra\r\n\r\nhello");
+
+  res.reset();
+  res.set_status_and_content(status_type::no_content, "ignored");
+  CHECK(to_string(res.to_buffers()) ==
+        "HTTP/1.1 204 No Content\r\nServer: cinatra\r\n\r\n");
+
+  res.reset();
+  res.set_status(status_type::switching_protocols);
+  res.add_header("Upgrade", "WebSocket");
+  CHECK(!res.has_response());
+  CHECK(to_string(res.to_buffers()) ==
+        "HTTP/1.1 101 Switching Protocals\r\nUpgrade: WebSocket\r\n"
+        "Server: cinatra\r\n\r\n");
+}
+
+TEST_CASE("test http date") {
+  char line[http_date::line_size];
+  http_date::format(784111777, line);
+  CHECK(std::string_view(line, sizeof(line)) ==
+        "Date: Sun, 06 Nov 1994 08:49:37 GMT\r\n");
+
+  asio::io_context ctx;
+  auto &date = asio::use_service<http_date>(ctx);
+  auto first = date.line();
+  CHECK(first.size() == http_date::line_size);
+  CHECK(first.substr(0, 6) == "Date: ");
+  CHECK(first.substr(first.size() - 6) == " GMT\r\n");
+
+  response res;
+  res.enable_response_time(true);
+  res.set_date_source(&date);
+  res.set_status_and_content(status_type::ok, "ok");
+  bool found = false;
+  for (auto &buf : res.to_buffers()) {
+    // the cached line is referenced, not copied
+    found |= buf.data() == first.data();
+  }
+  CHECK(found);
+
+  // the tick stops once the line is no longer used
+  ctx.run_for(std::chrono::milliseconds(2500));
+  CHECK(ctx.stopped());
+}
+
+TEST_CASE("test static file sent with sendfile") {
+  std::string dir = "./sendfile_test_dir";
+  std::filesystem::create_directories(dir);
+  std::string content;
+  for (int i = 0; i < 300 * 1024; i++) {
+    content.push_back(char('a' + i % 26));
+  }
+  {
+    std::ofstream file(dir + "/big.txt", std::ios::binary);
+    file << content;
+  }
+
+  http_server server(1);
+  server.set_static_dir(dir);
+  bool r = server.listen("0.0.0.0", "8096");
+  if (!r) {
+    std::cout << "listen failed."
+              << "\n";
+  }
+
+  std::promise<void> pr;
+  std::future<void> f = pr.get_future();
+  std::thread server_thread([&server, &pr]() {
+    pr.set_value();
+    server.run();
+  });
+  f.wait();
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  coro_http_client client{};
+  auto result = async_simple::coro::syncAwait(
+      client.async_get("http://127.0.0.1:8096/big.txt"));
+  CHECK(result.status == 200);
+  CHECK(result.resp_body == content);
+
+  // the same connection goes on after the file
+  client.add_header("Range", "bytes=1000-");
+  result = async_simple::coro::syncAwait(
+      client.async_get("http://127.0.0.1:8096/big.txt"));
+  CHECK(result.status == 206);
+  CHECK(result.resp_body == content.substr(1000));
+
+  server.stop();
+  server_thread.join();
+  std::filesystem::remove_all(dir);
+}
+
+TEST_CASE("test static file cache") {
+  std::string dir = fs::absolute("./static_cache_test_dir").string();
+  std::filesystem::create_directories(dir);
+  auto write_file = [&dir](const std::string &name, const std::string &str) {
+    std::ofstream file(dir + "/" + name, std::ios::binary);
+    file << str;
+  };
+  write_file("small.html", "<p>hello</p>");
+  write_file("big.js", std::string(20 * 1024, 'x'));
+
+  static_file_cache cache;
+  cache.set_max_bytes(1024 * 1024);
+  auto small = cache.get(dir + "/small.html");
+  REQUIRE(small != nullptr);
+  CHECK(small->body == "<p>hello</p>");
+  CHECK(small->mime == "text/html");
+  CHECK(small->header.find("Content-Length: 12\r\n") != std::string::npos);
+  CHECK(cache.get(dir + "/small.html") == small);
+
+  auto big = cache.get(dir + "/big.js");
+  REQUIRE(big != nullptr);
+  CHECK(big->body == std::string(20 * 1024, 'x'));
+  CHECK(cache.size() == 2);
+  // the cache holds a copy, the file may shrink under it
+  write_file("big.js", "");
+  CHECK(big->body == std::string(20 * 1024, 'x'));
+
+  // over budget, the least recently used one goes
+  cache.get(dir + "/small.html");
+  cache.set_max_bytes(small->cost() + 100);
+  CHECK(cache.size() == 1);
+  CHECK(cache.size_bytes() == small->cost());
+  cache.set_max_bytes(small->cost() + big->cost());
+  CHECK(cache.get(dir + "/missing.txt") == nullptr);
+
+  http_server server(1);
+  server.set_static_dir(dir);
+  server.set_static_cache_max_bytes(1024 * 1024);
+  bool r = server.listen("0.0.0.0", "8097");
+  if (!r) {
+    std::cout << "listen failed."
+              << "\n";
+  }
+
+  std::promise<void> pr;
+  std::future<void> f = pr.get_future();
+  std::thread server_thread([&server, &pr]() {
+    pr.set_value();
+    server.run();
+  });
+  f.wait();
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  coro_http_client client{};
+  auto result = async_simple::coro::syncAwait(
+      client.async_get("http://127.0.0.1:8097/small.html"));
+  CHECK(result.status == 200);
+  CHECK(result.resp_body == "<p>hello</p>");
+  CHECK(server.static_cache().size() == 1);
+
+#ifdef CINATRA_HAS_INOTIFY
+  // a changed file is dropped by its inotify event
+  write_file("small.html", "<p>changed</p>");
+  for (int i = 0; i < 50 && server.static_cache().size() != 0; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  result = async_simple::coro::syncAwait(
+      client.async_get("http://127.0.0.1:8097/small.html"));
+  CHECK(result.resp_body == "<p>changed</p>");
+
+  auto wait_size = [&server](size_t size) {
+    for (int i = 0; i < 50 && server.static_cache().size() != size; i++) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+  };
+  // a directory swapped by renames, as an atomic deploy does
+  std::filesystem::create_directories(dir + "/site");
+  write_file("site/index.html", "v1");
+  result = async_simple::coro::syncAwait(
+      client.async_get("http://127.0.0.1:8097/site/index.html"));
+  CHECK(result.resp_body == "v1");
+  CHECK(server.static_cache().size() == 2);
+  std::filesystem::create_directories(dir + "/site_new");
+  write_file("site_new/index.html", "v2");
+  std::filesystem::rename(dir + "/site", dir + "/site_old");
+  std::filesystem::rename(dir + "/site_new", dir + "/site");
+  wait_size(1);
+  result = async_simple::coro::syncAwait(
+      client.async_get("http://127.0.0.1:8097/site/index.html"));
+  CHECK(result.resp_body == "v2");
+
+  // the new directory is watched
+  write_file("site/index.html", "v3");
+  wait_size(1);
+  result = async_simple::coro::syncAwait(
+      client.async_get("http://127.0.0.1:8097/site/index.html"));
+  CHECK(result.resp_body == "v3");
+#endif
+
+  server.stop();
+  server_thread.join();
+  std::filesystem::remove_all(dir);
+}
+
+TEST_CASE("test conditional get of static files") {
+  CHECK(is_not_modified("\"1-2-3\"", "", "\"1-2-3\"", 0));
+  CHECK(is_not_modified("\"a\", W/\"1-2-3\"", "", "\"1-2-3\"", 0));
+  CHECK(is_not_modified("*", "", "\"1-2-3\"", 0));
+  CHECK(!is_not_modified("\"a\"", "", "\"1-2-3\"", 0));
+  // If-None-Match wins over If-Modified-Since
+  CHECK(!is_not_modified("\"a\"", "Sun, 06 Nov 1994 08:49:37 GMT",
+                         "\"1-2-3\"", 784111777));
+  CHECK(is_not_modified("", "Sun, 06 Nov 1994 08:49:37 GMT", "\"1-2-3\"",
+                        784111777));
+  CHECK(!is_not_modified("", "Sun, 06 Nov 1994 08:49:37 GMT", "\"1-2-3\"",
+                         784111778));
+  CHECK(!is_not_modified("", "yesterday", "\"1-2-3\"", 0));
+  // the tag of a compressed representation
+  CHECK(is_not_modified("\"1-2-3-gz\"", "", "\"1-2-3\"", 0));
+  CHECK(is_not_modified("W/\"1-2-3-br\"", "", "\"1-2-3\"", 0));
+  CHECK(!is_not_modified("\"1-2-3-4\"", "", "\"1-2-3\"", 0));
+  CHECK(!is_not_modified("\"1-2-3-gz\"", "", "\"1-2-3-br\"", 0));
+
+  std::string dir = fs::absolute("./conditional_get_test_dir").string();
+  std::filesystem::create_directories(dir);
+  {
+    std::ofstream file(dir + "/index.html", std::ios::binary);
+    file << "<p>hello</p>";
+  }
+
+  file_validators validators;
+  REQUIRE(get_file_validators(dir + "/index.html", validators));
+  CHECK(validators.etag.front() == '"');
+  CHECK(validators.etag.back() == '"');
+  CHECK(get_timestamp(validators.last_modified).second == validators.mtime);
+
+  http_server server(1);
+  server.set_static_dir(dir);
+  bool r = server.listen("0.0.0.0", "8098");
+  if (!r) {
+    std::cout << "listen failed."
+              << "\n";
+  }
+
+  std::promise<void> pr;
+  std::future<void> f = pr.get_future();
+  std::thread server_thread([&server, &pr]() {
+    pr.set_value();
+    server.run();
+  });
+  f.wait();
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  auto header_value = [](const resp_data &result, std::string_view name) {
+    for (auto &[k, v] : result.resp_headers) {
+      if (k == name) {
+        return v;
+      }
+    }
+    return std::string{};
+  };
+
+  coro_http_client client{};
+  auto result = async_simple::coro::syncAwait(
+      client.async_get("http://127.0.0.1:8098/index.html"));
+  CHECK(result.status == 200);
+  CHECK(header_value(result, "ETag") == validators.etag);
+  CHECK(header_value(result, "Last-Modified") == validators.last_modified);
+
+  client.add_header("If-None-Match", validators.etag);
+  result = async_simple::coro::syncAwait(
+      client.async_get("http://127.0.0.1:8098/index.html"));
+  CHECK(result.status == 304);
+  CHECK(result.resp_body.empty());
+  CHECK(header_value(result, "ETag") == validators.etag);
+
+  client.add_header("If-Modified-Since", validators.last_modified);
+  result = async_simple::coro::syncAwait(
+      client.async_get("http://127.0.0.1:8098/index.html"));
+  CHECK(result.status == 304);
+
+  // the same answers from the in memory cache
+  server.set_static_cache_max_bytes(1024 * 1024);
+  client.add_header("If-None-Match", "\"other\"");
+  result = async_simple::coro::syncAwait(
+      client.async_get("http://127.0.0.1:8098/index.html"));
+  CHECK(result.status == 200);
+  CHECK(result.resp_body == "<p>hello</p>");
+  CHECK(header_value(result, "ETag") == validators.etag);
+
+  client.add_header("If-None-Match", validators.etag);
+  result = async_simple::coro::syncAwait(
+      client.async_get("http://127.0.0.1:8098/index.html"));
+  CHECK(result.status == 304);
+  CHECK(result.resp_body.empty());
+
+  server.stop();
+  server_thread.join();
+  std::filesystem::remove_all(dir);
+}
+
+TEST_CASE("test byte ranges") {
+  std::vector<byte_range> ranges;
+  CHECK(parse_byte_ranges("bytes=0-99", 1000, ranges) ==
+        range_result::satisfiable);
+  CHECK((ranges.size() == 1 && ranges[0].first == 0 && ranges[0].last == 99));
+  CHECK(parse_byte_ranges("bytes=-500", 1000, ranges) ==
+        range_result::satisfiable);
+  CHECK((ranges[0].first == 500 && ranges[0].last == 999));
+  CHECK(parse_byte_ranges("bytes=900-2000", 1000, ranges) ==
+        range_result::satisfiable);
+  CHECK((ranges[0].first == 900 && ranges[0].last == 999));
+  CHECK(parse_byte_ranges("bytes=5-6, 0-1,1-2", 1000, ranges) ==
+        range_result::satisfiable);
+  REQUIRE(ranges.size() == 2);
+  CHECK((ranges[0].first == 0 && ranges[0].last == 2));
+  CHECK((ranges[1].first == 5 && ranges[1].last == 6));
+  CHECK(parse_byte_ranges("bytes=1000-", 1000, ranges) ==
+        range_result::unsatisfiable);
+  CHECK(parse_byte_ranges("bytes=-0", 1000, ranges) ==
+        range_result::unsatisfiable);
+  CHECK(parse_byte_ranges("items=0-1", 1000, ranges) == range_result::none);
+  CHECK(parse_byte_ranges("bytes=5-1", 1000, ranges) == range_result::none);
+  CHECK(parse_byte_ranges("bytes=0-1,x", 1000, ranges) == range_result::none);
+
+  {
+    // too many bytes in the ranges, the whole file is sent
+    response res;
+    request req(res);
+    CHECK(req.set_ranges("bytes=0-9,20-29", 1000) ==
+          range_result::satisfiable);
+    CHECK(req.is_range());
+    req.clear_ranges();
+    CHECK(!req.is_range());
+    CHECK(req.get_ranges().empty());
+    CHECK(req.get_range_start_pos() == 0);
+  }
+
+  std::string dir = fs::absolute("./byte_ranges_test_dir").string();
+  std::filesystem::create_directories(dir);
+  std::string content;
+  for (int i = 0; content.size() < 100 * 1024; i++) {
+    content.append(std::to_string(i)).append(",");
+  }
+  {
+    std::ofstream file(dir + "/data.txt", std::ios::binary);
+    file << content;
+  }
+  auto size = std::to_string(content.size());
+
+  http_server server(1);
+  server.set_static_dir(dir);
+  bool r = server.listen("0.0.0.0", "8100");
+  if (!r) {
+    std::cout << "listen failed."
+              << "\n";
+  }
+
+  std::promise<void> pr;
+  std::future<void> f = pr.get_future();
+  std::thread server_thread([&server, &pr]() {
+    pr.set_value();
+    server.run();
+  });
+  f.wait();
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  auto header_value = [](const resp_data &result, std::string_view name) {
+    for (auto &[k, v] : result.resp_headers) {
+      if (k == name) {
+        return v;
+      }
+    }
+    return std::string{};
+  };
+
+  std::string uri = "http://127.0.0.1:8100/data.txt";
+  coro_http_client client{};
+  client.add_header("Range", "bytes=10-109");
+  auto result = async_simple::coro::syncAwait(client.async_get(uri));
+  CHECK(result.status == 206);
+  CHECK(result.resp_body == content.substr(10, 100));
+  CHECK(header_value(result, "Content-Range") == "bytes 10-109/" + size);
+
+  client.add_header("Range", "bytes=-500");
+  result = async_simple::coro::syncAwait(client.async_get(uri));
+  CHECK(result.status == 206);
+  CHECK(result.resp_body == content.substr(content.size() - 500));
+
+  client.add_header("Range", "bytes=0-9,20-29");
+  result = async_simple::coro::syncAwait(client.async_get(uri));
+  CHECK(result.status == 206);
+  auto type = header_value(result, "Content-Type");
+  REQUIRE(type.find("multipart/byteranges; boundary=") == 0);
+  auto boundary = type.substr(type.find('=') + 1);
+  std::string body = "--" + boundary +
+                     "\r\nContent-Type: text/plain\r\n"
+                     "Content-Range: bytes 0-9/" +
+                     size + "\r\n\r\n" + content.substr(0, 10) + "\r\n--" +
+                     boundary +
+                     "\r\nContent-Type: text/plain\r\n"
+                     "Content-Range: bytes 20-29/" +
+                     size + "\r\n\r\n" + content.substr(20, 10) + "\r\n--" +
+                     boundary + "--\r\n";
+  CHECK(result.resp_body == body);
+
+  client.add_header("Range", "bytes=" + size + "-");
+  result = async_simple::coro::syncAwait(client.async_get(uri));
+  CHECK(result.status == 416);
+  CHECK(header_value(result, "Content-Range") == "bytes */" + size);
+
+  // a stale If-Range gets the whole file
+  client.add_header("Range", "bytes=0-9");
+  client.add_header("If-Range", "\"stale\"");
+  result = async_simple::coro::syncAwait(client.async_get(uri));
+  CHECK(result.status == 200);
+  CHECK(result.resp_body.size() == content.size());
+
+  server.stop();
+  server_thread.join();
+  std::filesystem::remove_all(dir);
+}
+
+TEST_CASE("test precompressed sidecars") {
+  CHECK(accept_encoding_q("gzip, deflate, br", "br") == 1000);
+  CHECK(accept_encoding_q("gzip;q=0.5, br;q=0", "br") == 0);
+  CHECK(accept_encoding_q("gzip;q=0.5, br;q=0", "gzip") == 500);
+  CHECK(accept_encoding_q("*;q=0.1", "gzip") == 100);
+  CHECK(accept_encoding_q("gzip", "identity") == 1000);
+  CHECK(accept_encoding_q("identity;q=0", "identity") == 0);
+  CHECK(!accepts_encoding("", "gzip"));
+
+  std::string dir = fs::absolute("./sidecars_test_dir").string();
+  std::filesystem::create_directories(dir);
+  auto write_file = [&dir](const std::string &name, const std::string &str) {
+    std::ofstream file(dir + "/" + name, std::ios::binary);
+    file << str;
+  };
+  std::string script(1024, 'a');
+  write_file("app.js", script);
+  write_file("app.js.br", "BR");
+  write_file("app.js.gz", "GZ");
+
+#ifdef CINATRA_ENABLE_GZIP
+  write_file("style.css", std::string(1024, 'b'));
+  std::atomic<bool> stop = false;
+  CHECK(generate_gzip_sidecars(dir, stop) == 1);
+  CHECK(fs::exists(dir + "/style.css.gz"));
+  CHECK(generate_gzip_sidecars(dir, stop) == 0);
+#endif
+
+  http_server server(1);
+  server.set_static_dir(dir);
+  server.set_static_sidecars(true);
+  bool r = server.listen("0.0.0.0", "8101");
+  if (!r) {
+    std::cout << "listen failed."
+              << "\n";
+  }
+
+  std::promise<void> pr;
+  std::future<void> f = pr.get_future();
+  std::thread server_thread([&server, &pr]() {
+    pr.set_value();
+    server.run();
+  });
+  f.wait();
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  auto header_value = [](const resp_data &result, std::string_view name) {
+    for (auto &[k, v] : result.resp_headers) {
+      if (k == name) {
+        return v;
+      }
+    }
+    return std::string{};
+  };
+
+  std::string uri = "http://127.0.0.1:8101/app.js";
+  coro_http_client client{};
+  for (bool cached : {false, true}) {
+    if (cached) {
+      server.set_static_cache_max_bytes(1024 * 1024);
+    }
+
+    client.add_header("Accept-Encoding", "gzip, br");
+    auto result = async_simple::coro::syncAwait(client.async_get(uri));
+    CHECK(result.status == 200);
+    CHECK(result.resp_body == "BR");
+    CHECK(header_value(result, "Content-Encoding") == "br");
+    CHECK(header_value(result, "Vary") == "Accept-Encoding");
+    auto etag = header_value(result, "ETag");
+
+    client.add_header("Accept-Encoding", "gzip, br;q=0.5");
+    result = async_simple::coro::syncAwait(client.async_get(uri));
+    CHECK(result.resp_body == "GZ");
+    CHECK(header_value(result, "Content-Encoding") == "gzip");
+    CHECK(header_value(result, "ETag") != etag);
+
+    client.add_header("Accept-Encoding", "br");
+    client.add_header("If-None-Match", etag);
+    result = async_simple::coro::syncAwait(client.async_get(uri));
+    CHECK(result.status == 304);
+
+    result = async_simple::coro::syncAwait(client.async_get(uri));
+    CHECK(result.resp_body == script);
+    CHECK(header_value(result, "Content-Encoding").empty());
+  }
+
+  server.stop();
+  server_thread.join();
+  std::filesystem::remove_all(dir);
+}
+
+#ifdef CINATRA_ENABLE_GZIP
+TEST_CASE("test chunked gzip stream") {
+  gzip_codec::compressor compressor;
+  REQUIRE(compressor.init());
+  std::string out;
+  CHECK(compressor.compress("hello ", out, Z_SYNC_FLUSH));
+  CHECK(!out.empty());
+  CHECK(compressor.compress("world", out));
+  CHECK(compressor.finish(out));
+  CHECK(!compressor.active());
+  std::string plain;
+  CHECK(gzip_codec::uncompress(out, plain));
+  CHECK(plain == "hello world");
+
+  // the stream is reset for the next body, at another level or after an
+  // unfinished one
+  CHECK(compressor.initialized());
+  for (int level : {1, 1, 9}) {
+    REQUIRE(compressor.init(level));
+    out.clear();
+    CHECK(compressor.compress("again", out));
+    if (level == 9) {
+      REQUIRE(compressor.init(level));
+      out.clear();
+      CHECK(compressor.compress("again", out));
+    }
+    CHECK(compressor.finish(out));
+    plain.clear();
+    CHECK(gzip_codec::uncompress(out, plain));
+    CHECK(plain == "again");
+  }
+
+  std::string expected;
+  for (int i = 0; i < 1000; i++) {
+    expected.append("line ").append(std::to_string(i)).append("\n");
+  }
+
+  // above the 5M of a small file, so sent chunked and gzip'ed while read
+  std::string dir = fs::absolute("./chunked_gzip_test_dir").string();
+  std::filesystem::create_directories(dir);
+  {
+    std::ofstream file(dir + "/big.txt", std::ios::binary);
+    for (int i = 0; i < 6 * 1024; i++) {
+      file << std::string(1024, 'a' + i % 26);
+    }
+  }
+
+  http_server server(1);
+  server.set_static_dir(dir);
+  server.set_http_handler<GET>("/export", [&expected](request &req,
+                                                      response &) {
+    static size_t sent = 0;
+    auto conn = req.get_conn<NonSSL>();
+    switch (req.get_state()) {
+      case data_proc_state::data_begin:
+        sent = 0;
+        conn->enable_chunked_gzip(-1, 4096);
+        conn->write_chunked_header("text/plain");
+        break;
+      case data_proc_state::data_continue: {
+        auto piece = expected.substr(sent, 1000);
+        sent += piece.size();
+        conn->write_chunked_data(std::move(piece), sent == expected.size());
+      } break;
+      default:
+        break;
+    }
+  });
+  bool r = server.listen("0.0.0.0", "8102");
+  if (!r) {
+    std::cout << "listen failed."
+              << "\n";
+  }
+
+  std::promise<void> pr;
+  std::future<void> f = pr.get_future();
+  std::thread server_thread([&server, &pr]() {
+    pr.set_value();
+    server.run();
+  });
+  f.wait();
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+#ifdef INJECT_FOR_HTTP_CLIENT_TEST
+  // left over by "test inject failed" when it could not connect
+  inject_response_valid = ClientInjectAction::none;
+  inject_header_valid = ClientInjectAction::none;
+  inject_chunk_valid = ClientInjectAction::none;
+  inject_write_failed = ClientInjectAction::none;
+  inject_read_failed = ClientInjectAction::none;
+#endif
+  coro_http_client client{};
+  auto result = async_simple::coro::syncAwait(
+      client.async_get("http://127.0.0.1:8102/export"));
+  CHECK(result.status == 200);
+  plain.clear();
+  CHECK(gzip_codec::uncompress(result.resp_body, plain));
+  CHECK(plain == expected);
+
+  client.add_header("Accept-Encoding", "gzip");
+  result = async_simple::coro::syncAwait(
+      client.async_get("http://127.0.0.1:8102/big.txt"));
+  CHECK(result.status == 200);
+  std::string etag;
+  for (auto &[k, v] : result.resp_headers) {
+    if (k == "ETag") {
+      etag = v;
+    }
+  }
+  CHECK(etag.ends_with("-gz\""));
+  plain.clear();
+  CHECK(gzip_codec::uncompress(result.resp_body, plain));
+  CHECK(plain.size() == 6 * 1024 * 1024);
+  client.add_header("Accept-Encoding", "gzip");
+  client.add_header("If-None-Match", etag);
+  result = async_simple::coro::syncAwait(
+      client.async_get("http://127.0.0.1:8102/big.txt"));
+  CHECK(result.status == 304);
+
+  server.stop();
+  server_thread.join();
+  std::filesystem::remove_all(dir);
+}
+#endif
+
+TEST_CASE("test content codec registry") {
+  struct reverse_codec : content_codec {
+    std::string_view name() const override { return "x-reverse"; }
+    bool compress(std::string_view data, std::string &out,
+                  const codec_options &) override {
+      out.append(data.rbegin(), data.rend());
+      return true;
+    }
+    bool uncompress(std::string_view data, std::string &out) override {
+      out.append(data.rbegin(), data.rend());
+      return true;
+    }
+  };
+
+  auto &registry = codec_registry::instance();
+  CHECK(registry.find("x-reverse") == nullptr);
+  registry.add(std::make_shared<reverse_codec>());
+  auto codec = registry.find("X-Reverse");
+  REQUIRE(codec != nullptr);
+  std::string out, plain;
+  CHECK(codec->compress("abc", out, {}));
+  CHECK(out == "cba");
+  CHECK(codec->uncompress(out, plain));
+  CHECK(plain == "abc");
+
+#ifdef CINATRA_ENABLE_GZIP
+  std::string json;
+  for (int i = 0; i < 100; i++) {
+    json.append("{\"id\":").append(std::to_string(i)).append("},");
+  }
+
+  for (std::string_view name : {"gzip", "deflate"}) {
+    auto zlib = registry.find(name);
+    REQUIRE(zlib != nullptr);
+    // the pooled context is reset between bodies and switches parameters
+    for (codec_options options :
+         {codec_options{}, codec_options{1, 0},
+          codec_options{9, Z_FILTERED}, codec_options{}}) {
+      out.clear();
+      plain.clear();
+      CHECK(zlib->compress(json, out, options));
+      CHECK(out.size() < json.size());
+      CHECK(zlib->uncompress(out, plain));
+      CHECK(plain == json);
+    }
+  }
+
+  out.clear();
+  CHECK(gzip_codec::compress(json, out));
+  CHECK(gzip_codec::deflater::local(gzip_codec::deflate_format::gzip)
+            .initialized());
+  plain.clear();
+  CHECK(!gzip_codec::uncompress("not gzip", plain));
+  plain.clear();
+  CHECK(gzip_codec::uncompress(out, plain));
+  CHECK(plain == json);
+#endif
+}
+
+TEST_CASE("test compression policy") {
+  // "aaab" -> "3a1b", enough to see what the server did
+  struct rle_codec : content_codec {
+    std::string_view name() const override { return "x-rle"; }
+    bool compress(std::string_view data, std::string &out,
+                  const codec_options &) override {
+      for (size_t i = 0; i < data.size();) {
+        size_t n = 1;
+        while (i + n < data.size() && data[i + n] == data[i]) {
+          n++;
+        }
+        out.append(std::to_string(n)).push_back(data[i]);
+        i += n;
+      }
+      return true;
+    }
+    bool uncompress(std::string_view, std::string &) override {
+      return false;
+    }
+  };
+  codec_registry::instance().add(std::make_shared<rle_codec>());
+
+  compression_policy policy;
+  policy.enabled = true;
+  policy.codings = {"x-rle"};
+  CHECK(policy.compressible("text/html; charset=utf-8", 2048));
+  CHECK(policy.compressible("application/json", 2048));
+  CHECK(!policy.compressible("application/json", 100));
+  CHECK(!policy.compressible("image/jpeg", 2048));
+  CHECK(policy.negotiate("x-rle") == nullptr);
+  policy.resolve();
+  CHECK(policy.negotiate("gzip, x-rle;q=0.5") != nullptr);
+  CHECK(policy.negotiate("gzip, x-rle;q=0") == nullptr);
+  CHECK(policy.negotiate("") == nullptr);
+  policy.mime_types = {"text/", "application/x-ndjson"};
+  CHECK(policy.compressible("TEXT/CSV", 2048));
+  CHECK(policy.compressible("application/x-ndjson", 2048));
+  CHECK(!policy.compressible("text/", 2048));
+  CHECK(!policy.compressible("application/json", 2048));
+  policy.mime_types.clear();
+
+  std::string big(2000, 'a');
+  std::string dir = fs::absolute("./compression_policy_test_dir").string();
+  std::filesystem::create_directories(dir);
+  {
+    std::ofstream file(dir + "/big.css", std::ios::binary);
+    file << big;
+  }
+
+  http_server server(1);
+  server.set_compression_policy(policy);
+  server.set_static_dir(dir);
+  server.set_http_handler<GET>("/big", [&big](request &req, response &res) {
+    res.add_header("ETag", "\"v1\"");
+    if (is_not_modified(req.get_header_value("If-None-Match"), "", "\"v1\"",
+                        0)) {
+      res.set_status_and_content(status_type::not_modified);
+      return;
+    }
+    res.render_string(std::string(big));
+  });
+  server.set_http_handler<GET>("/small", [](request &, response &res) {
+    res.render_string("aaaa");
+  });
+  server.set_http_handler<GET>("/jpeg", [&big](request &, response &res) {
+    res.add_header("Content-Type", "image/jpeg");
+    res.set_status_and_content(status_type::ok, std::string(big));
+  });
+  server.set_http_handler<GET>("/encoded", [&big](request &, response &res) {
+    res.add_header("Content-Encoding", "identity");
+    res.render_string(std::string(big));
+  });
+  bool r = server.listen("0.0.0.0", "8103");
+  if (!r) {
+    std::cout << "listen failed."
+              << "\n";
+  }
+
+  std::promise<void> pr;
+  std::future<void> f = pr.get_future();
+  std::thread server_thread([&server, &pr]() {
+    pr.set_value();
+    server.run();
+  });
+  f.wait();
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  auto header_value = [](const resp_data &result, std::string_view name) {
+    for (auto &[k, v] : result.resp_headers) {
+      if (k == name) {
+        return v;
+      }
+    }
+    return std::string{};
+  };
+
+  coro_http_client client{};
+  std::string uri = "http://127.0.0.1:8103";
+  client.add_header("Accept-Encoding", "gzip;q=0.5, x-rle");
+  auto result = async_simple::coro::syncAwait(client.async_get(uri + "/big"));
+  CHECK(result.status == 200);
+  CHECK(result.resp_body == "2000a");
+  CHECK(header_value(result, "Content-Encoding") == "x-rle");
+  CHECK(header_value(result, "Vary") == "Accept-Encoding");
+  CHECK(header_value(result, "ETag") == "\"v1-x-rle\"");
+
+  // revalidated with the tag of the compressed body
+  client.add_header("Accept-Encoding", "x-rle");
+  client.add_header("If-None-Match", "\"v1-x-rle\"");
+  result = async_simple::coro::syncAwait(client.async_get(uri + "/big"));
+  CHECK(result.status == 304);
+
+  client.add_header("Accept-Encoding", "x-rle");
+  result = async_simple::coro::syncAwait(client.async_get(uri + "/big.css"));
+  CHECK(result.status == 200);
+  CHECK(header_value(result, "Content-Encoding") == "x-rle");
+  auto etag = header_value(result, "ETag");
+  client.add_header("Accept-Encoding", "x-rle");
+  client.add_header("If-None-Match", etag);
+  result = async_simple::coro::syncAwait(client.async_get(uri + "/big.css"));
+  CHECK(result.status == 304);
+
+  result = async_simple::coro::syncAwait(client.async_get(uri + "/big"));
+  CHECK(result.resp_body == big);
+  CHECK(header_value(result, "Content-Encoding").empty());
+  CHECK(header_value(result, "Vary") == "Accept-Encoding");
+  CHECK(header_value(result, "ETag") == "\"v1\"");
+
+  for (std::string_view path : {"/small", "/jpeg", "/encoded"}) {
+    client.add_header("Accept-Encoding", "x-rle");
+    result = async_simple::coro::syncAwait(
+        client.async_get(uri + std::string(path)));
+    CHECK(result.status == 200);
+    CHECK(header_value(result, "Content-Encoding") != "x-rle");
+    CHECK(header_value(result, "Vary").empty());
+  }
+
+  server.stop();
+  server_thread.join();
+  std::filesystem::remove_all(dir);
+}
+
+TEST_CASE("test chunked request body") {
+  {
+    chunked_decoder decoder;
+    std::string body = "4;ext=1\r\nWiki\r\n5\r\npedia\r\nE\r\n in\r\n\r\nchunks."
+                       "\r\n0\r\nExpires: never\r\n\r\nGET";
+    // fed a byte at a time, the framing may be split anywhere
+    std::string out;
+    size_t consumed = 0;
+    auto status = chunked_decoder::status::need_more;
+    size_t i = 0;
+    for (; i < body.size(); i++) {
+      status = decoder.feed(std::string_view(&body[i], 1), consumed,
+                            [&out](std::string_view piece) {
+                              out.append(piece);
+                            });
+      if (status != chunked_decoder::status::need_more) {
+        break;
+      }
+    }
+    CHECK(status == chunked_decoder::status::done);
+    CHECK(out == "Wikipedia in\r\n\r\nchunks.");
+    CHECK(decoder.body_size() == out.size());
+    CHECK(body.substr(i + 1) == "GET");
+
+    for (std::string bad : {"x\r\n", "4\nWiki", "4\r\nWikiX", "1\r\na\r\n0\n",
+                            "10000000000000000\r\n"}) {
+      decoder.reset();
+      CHECK(decoder.feed(bad, consumed, [](std::string_view) {}) ==
+            chunked_decoder::status::error);
+    }
+  }
+
+  http_server server(1);
+  std::string received;
+  size_t largest_piece = 0;
+  server.set_http_handler<POST>(
+      "/upload", [&](request &req, response &res) {
+        switch (req.get_state()) {
+          case data_proc_state::data_continue:
+            received.append(req.get_part_data());
+            largest_piece = (std::max)(largest_piece, req.get_part_data().size());
+            break;
+          case data_proc_state::data_end:
+            res.set_status_and_content(status_type::ok,
+                                       std::to_string(received.size()));
+            break;
+          default:
+            break;
+        }
+      });
+  bool r = server.listen("0.0.0.0", "8104");
+  if (!r) {
+    std::cout << "listen failed."
+              << "\n";
+  }
+
+  std::promise<void> pr;
+  std::future<void> f = pr.get_future();
+  std::thread server_thread([&server, &pr]() {
+    pr.set_value();
+    server.run();
+  });
+  f.wait();
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  asio::io_context ioc;
+  asio::ip::tcp::socket socket(ioc);
+  std::error_code ec;
+  socket.connect(
+      asio::ip::tcp::endpoint(asio::ip::address::from_string("127.0.0.1"),
+                              8104),
+      ec);
+  REQUIRE(!ec);
+
+  auto read_response = [&socket, &ec](int &status) {
+    std::string buf;
+    http_parser parser;
+    char tmp[1024];
+    while (true) {
+      size_t n = socket.read_some(asio::buffer(tmp), ec);
+      if (ec) {
+        return std::string{};
+      }
+      buf.append(tmp, n);
+      int ret = parser.parse_response(buf.data(), buf.size(), 0);
+      if (ret >= 0 && size_t(parser.total_len()) <= buf.size()) {
+        status = parser.status();
+        return buf.substr(parser.header_len(), parser.body_len());
+      }
+    }
+  };
+
+  // 1MB in 64KB chunks, split across writes inside the framing
+  std::string expected;
+  std::string request =
+      "POST /upload HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n";
+  for (int i = 0; i < 16; i++) {
+    std::string chunk(64 * 1024, char('a' + i));
+    expected.append(chunk);
+    request.append("10000\r\n").append(chunk).append("\r\n");
+  }
+  request.append("0\r\n\r\n");
+  asio::write(socket, asio::buffer(request.data(), 20), ec);
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  asio::write(socket, asio::buffer(request.data() + 20, request.size() - 20),
+              ec);
+  REQUIRE(!ec);
+  int status = 0;
+  CHECK(read_response(status) == std::to_string(expected.size()));
+  CHECK(status == 200);
+  CHECK(received == expected);
+  CHECK(largest_piece <= 64 * 1024);
+
+  // the connection is kept for the next request
+  received.clear();
+  request =
+      "POST /upload HTTP/1.1\r\nTransfer-Encoding: Chunked\r\n\r\n"
+      "3\r\nabc\r\n0\r\n\r\n";
+  asio::write(socket, asio::buffer(request), ec);
+  CHECK(read_response(status) == "3");
+  CHECK(received == "abc");
+
+  request =
+      "POST /upload HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+      "3\r\nabc\r\nzz\r\n";
+  asio::write(socket, asio::buffer(request), ec);
+  read_response(status);
+  CHECK(status == 400);
+
+  server.stop();
+  server_thread.join();
+}
+
+TEST_CASE("test streamed request body") {
+  http_server server(1);
+  size_t received = 0;
+  size_t pieces = 0;
+  size_t largest_piece = 0;
+  std::atomic<bool> paused = false;
+  std::vector<std::thread> resumers;
+  server.set_http_handler<POST>(
+      "/stream",
+      [&](request &req, response &res) {
+        switch (req.get_state()) {
+          case data_proc_state::data_continue: {
+            // nothing is read while the previous piece is held
+            CHECK(!paused);
+            auto piece = req.get_part_data();
+            received += piece.size();
+            largest_piece = (std::max)(largest_piece, piece.size());
+            if (++pieces % 2 == 0) {
+              auto conn = req.get_conn<NonSSL>();
+              conn->pause_body();
+              paused = true;
+              resumers.emplace_back([conn, &paused] {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                paused = false;
+                conn->resume_body();
+              });
+            }
+          } break;
+          case data_proc_state::data_end:
+            res.set_status_and_content(status_type::ok,
+                                       std::to_string(received));
+            break;
+          default:
+            break;
+        }
+      },
+      stream_body{});
+  bool r = server.listen("0.0.0.0", "8105");
+  if (!r) {
+    std::cout << "listen failed."
+              << "\n";
+  }
+
+  std::promise<void> pr;
+  std::future<void> f = pr.get_future();
+  std::thread server_thread([&server, &pr]() {
+    pr.set_value();
+    server.run();
+  });
+  f.wait();
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  asio::io_context ioc;
+  asio::ip::tcp::socket socket(ioc);
+  std::error_code ec;
+  socket.connect(
+      asio::ip::tcp::endpoint(asio::ip::address::from_string("127.0.0.1"),
+                              8105),
+      ec);
+  REQUIRE(!ec);
+
+  // well past request::MaxSize
+  size_t size = 8 * 1024 * 1024;
+  std::string request = "POST /stream HTTP/1.1\r\nContent-Length: " +
+                        std::to_string(size) + "\r\n\r\n";
+  request.append(size, 'x');
+  asio::write(socket, asio::buffer(request), ec);
+  REQUIRE(!ec);
+
+  std::string buf;
+  http_parser parser;
+  char tmp[1024];
+  while (true) {
+    size_t n = socket.read_some(asio::buffer(tmp), ec);
+    REQUIRE(!ec);
+    buf.append(tmp, n);
+    int ret = parser.parse_response(buf.data(), buf.size(), 0);
+    if (ret >= 0 && size_t(parser.total_len()) <= buf.size()) {
+      break;
+    }
+  }
+  CHECK(parser.status() == 200);
+  CHECK(buf.substr(parser.header_len()) == std::to_string(size));
+  CHECK(received == size);
+  CHECK(largest_piece <= 64 * 1024);
+
+  server.stop();
+  server_thread.join();
+  for (auto &t : resumers) {
+    t.join();
+  }
+}
+
+// posts 4 chunks of "hello" on socket, the response body or "" on errors
+std::string post_chunked_hello(asio::ip::tcp::socket &socket,
+                               std::string_view path) {
+  std::string request = "POST ";
+  request.append(path).append(
+      " HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n");
+  for (int i = 0; i < 4; ++i) {
+    request.append("5\r\nhello\r\n");
+  }
+  request.append("0\r\n\r\n");
+  std::error_code ec;
+  asio::write(socket, asio::buffer(request), ec);
+  if (ec) {
+    return "";
+  }
+
+  std::string buf;
+  http_parser parser;
+  char tmp[1024];
+  while (true) {
+    size_t n = socket.read_some(asio::buffer(tmp), ec);
+    if (ec) {
+      return "";
+    }
+    buf.append(tmp, n);
+    int ret = parser.parse_response(buf.data(), buf.size(), 0);
+    if (ret >= 0 && size_t(parser.total_len()) <= buf.size()) {
+      return buf.substr(parser.header_len(), parser.body_len());
+    }
+  }
+}
+
+struct lazy_after_aspect {
+  bool after(request &, response &res) {
+    res.add_header("X-After", "1");
+    return true;
+  }
+};
+
+TEST_CASE("test coroutine handler") {
+  http_server server(1);
+  server.set_http_handler<GET>("/backend", [](request &, response &res) {
+    res.set_status_and_content(status_type::ok, "backend");
+  });
+  // the only io thread of the server serves /backend while /lazy waits
+  server.set_http_handler<GET>(
+      "/lazy",
+      [](request &, response &res) -> async_simple::coro::Lazy<void> {
+        coro_http_client client{};
+        auto data = co_await client.async_get("http://127.0.0.1:8106/backend");
+        res.set_status_and_content(status_type::ok,
+                                   "got " + std::string(data.resp_body));
+      },
+      lazy_after_aspect{});
+  server.set_http_handler<GET>(
+      "/throw", [](request &, response &) -> async_simple::coro::Lazy<void> {
+        co_await async_simple::coro::Yield{};
+        throw std::runtime_error("lazy");
+      });
+  int uploads = 0;
+  server.set_http_handler<POST>(
+      "/upload",
+      [&uploads](request &req,
+                 response &res) -> async_simple::coro::Lazy<void> {
+        ++uploads;
+        co_await async_simple::coro::Yield{};
+        res.set_status_and_content(status_type::ok, std::string(req.body()));
+      });
+  bool r = server.listen("0.0.0.0", "8106");
+  if (!r) {
+    std::cout << "listen failed."
+              << "\n";
+  }
+
+  std::promise<void> pr;
+  std::future<void> f = pr.get_future();
+  std::thread server_thread([&server, &pr]() {
+    pr.set_value();
+    server.run();
+  });
+  f.wait();
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  coro_http_client client{};
+  auto data = client.get("http://127.0.0.1:8106/lazy");
+  CHECK(data.status == 200);
+  CHECK(data.resp_body == "got backend");
+  auto after = std::find_if(data.resp_headers.begin(), data.resp_headers.end(),
+                            [](auto &h) {
+                              return h.first == "X-After";
+                            });
+  CHECK(after != data.resp_headers.end());
+
+  // the connection is kept alive across coroutine handlers
+  data = client.get("http://127.0.0.1:8106/lazy");
+  CHECK(data.resp_body == "got backend");
+
+  data = client.get("http://127.0.0.1:8106/throw");
+  CHECK(data.status == 500);
+  CHECK(data.resp_body == "lazy exception in business function");
+
+  // a chunked body is given whole to a coroutine handler, which runs once
+  asio::io_context ioc;
+  asio::ip::tcp::socket socket(ioc);
+  std::error_code ec;
+  socket.connect(
+      asio::ip::tcp::endpoint(asio::ip::address::from_string("127.0.0.1"),
+                              8106),
+      ec);
+  REQUIRE(!ec);
+  CHECK(post_chunked_hello(socket, "/upload") == "hellohellohellohello");
+  CHECK(uploads == 1);
+  CHECK(post_chunked_hello(socket, "/upload") == "hellohellohellohello");
+  CHECK(uploads == 2);
+
+  server.stop();
+  server_thread.join();
+}
+
+TEST_CASE("test offloaded handler") {
+  http_server server(1);
+  // one worker and one queued job at most
+  auto pool = std::make_shared<offload_pool>(1, 1);
+  std::atomic<int> started = 0;
+  std::promise<void> gate;
+  std::shared_future<void> opened = gate.get_future().share();
+  std::thread::id io_thread, worker_thread;
+  server.set_http_handler<GET>(
+      "/heavy",
+      [&](request &, response &res) {
+        worker_thread = std::this_thread::get_id();
+        ++started;
+        opened.wait();
+        res.set_status_and_content(status_type::ok, "heavy");
+      },
+      offload{pool});
+  server.set_http_handler<GET>("/light", [&](request &, response &res) {
+    io_thread = std::this_thread::get_id();
+    res.set_status_and_content(status_type::ok, "light");
+  });
+  std::atomic<int> uploads = 0;
+  server.set_http_handler<POST>(
+      "/upload",
+      [&uploads](request &req, response &res) {
+        ++uploads;
+        res.set_status_and_content(status_type::ok,
+                                   std::to_string(req.body().size()));
+      },
+      offload{});
+  // an lvalue handler is copied, the caller's stays intact
+  struct tagged_handler {
+    std::string tag;
+    void operator()(request &, response &res) {
+      res.set_status_and_content(status_type::ok, std::string(tag));
+    }
+  };
+  tagged_handler tagged{"tagged"};
+  server.set_http_handler<GET>("/tagged", tagged, offload{});
+  CHECK(tagged.tag == "tagged");
+  bool r = server.listen("0.0.0.0", "8107");
+  if (!r) {
+    std::cout << "listen failed."
+              << "\n";
+  }
+
+  std::promise<void> pr;
+  std::future<void> f = pr.get_future();
+  std::thread server_thread([&server, &pr]() {
+    pr.set_value();
+    server.run();
+  });
+  f.wait();
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  auto get = [](std::string path) {
+    coro_http_client client{};
+    auto data = client.get("http://127.0.0.1:8107" + path);
+    return std::make_pair(data.status, std::string(data.resp_body));
+  };
+
+  // the first one holds the worker, the second waits in the queue
+  auto running = std::async(std::launch::async, get, "/heavy");
+  while (started == 0) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  auto queued = std::async(std::launch::async, get, "/heavy");
+  while (pool->queue_size() == 0) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  auto shed = get("/heavy");
+  CHECK(shed.first == 503);
+
+  // the io thread is free meanwhile
+  auto light = get("/light");
+  CHECK(light.first == 200);
+  CHECK(light.second == "light");
+
+  gate.set_value();
+  CHECK(running.get() == std::make_pair(200, std::string("heavy")));
+  CHECK(queued.get() == std::make_pair(200, std::string("heavy")));
+  CHECK(started == 2);
+  CHECK(worker_thread != io_thread);
+  CHECK(get("/tagged") == std::make_pair(200, std::string("tagged")));
+
+  // a chunked body reaches the worker whole
+  asio::io_context ioc;
+  asio::ip::tcp::socket socket(ioc);
+  std::error_code ec;
+  socket.connect(
+      asio::ip::tcp::endpoint(asio::ip::address::from_string("127.0.0.1"),
+                              8107),
+      ec);
+  REQUIRE(!ec);
+  CHECK(post_chunked_hello(socket, "/upload") == "20");
+  CHECK(post_chunked_hello(socket, "/upload") == "20");
+  CHECK(uploads == 2);
+
+  server.stop();
+  server_thread.join();
+}
+
+TEST_CASE("test radix tree router") {
+  radix_tree<int> tree;
+  tree.insert("/users", 1);
+  tree.insert("/users/:id", 2);
+  tree.insert("/users/:id/files/*path", 3);
+  tree.insert("/users/me", 4);
+  tree.insert("/static/*", 5);
+  tree.insert("/a/b", 6);
+  tree.insert("/ab", 7);
+  tree.insert("/x/:a/y", 8);
+  tree.insert("/x/k/z", 9);
+
+  path_params params;
+  auto find = [&](std::string_view path) {
+    auto value = tree.find(path, params);
+    return value ? *value : 0;
+  };
+  CHECK(find("/users") == 1);
+  CHECK(find("/users/42") == 2);
+  CHECK(params.get("id") == "42");
+  CHECK(find("/users/me") == 4);
+  CHECK(params.empty());
+  CHECK(find("/users/42/files/a/b.txt") == 3);
+  CHECK(params.size() == 2);
+  CHECK(params.get("id") == "42");
+  CHECK(params.get("path") == "a/b.txt");
+  CHECK(find("/users/42/x") == 0);
+  CHECK(find("/users/") == 0);
+  CHECK(find("/static/") == 5);
+  CHECK(find("/static/css/app.css") == 5);
+  CHECK(params[0].second == "css/app.css");
+  CHECK(find("/a/b") == 6);
+  CHECK(find("/ab") == 7);
+  CHECK(find("/a") == 0);
+  CHECK(find("/abc") == 0);
+  // the static branch fails further down, the parameter is tried then
+  CHECK(find("/x/k/y") == 8);
+  CHECK(params.get("a") == "k");
+  CHECK(find("/x/k/z") == 9);
+
+  CHECK(tree.erase("/users/me"));
+  CHECK(!tree.erase("/users/m"));
+  CHECK(find("/users/me") == 2);
+  tree.insert("/users/:name", 10);
+  CHECK(find("/users/me") == 10);
+  CHECK(params.get("name") == "me");
+
+  http_server server(1);
+  server.set_http_handler<GET>("/users/:id", [](request &req, response &res) {
+    res.set_status_and_content(status_type::ok,
+                               "user " + std::string(req.get_path_param("id")));
+  });
+  server.set_http_handler<GET>(
+      "/users/:id/files/*path", [](request &req, response &res) {
+        res.set_status_and_content(
+            status_type::ok, std::string(req.get_path_param("id")) + ":" +
+                                 std::string(req.get_path_param("path")));
+      });
+  server.set_http_handler<GET>("/api/*", [](request &, response &res) {
+    res.set_status_and_content(status_type::ok, "api");
+  });
+  bool r = server.listen("0.0.0.0", "8108");
+  if (!r) {
+    std::cout << "listen failed."
+              << "\n";
+  }
+
+  std::promise<void> pr;
+  std::future<void> f = pr.get_future();
+  std::thread server_thread([&server, &pr]() {
+    pr.set_value();
+    server.run();
+  });
+  f.wait();
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  coro_http_client client{};
+  auto data = client.get("http://127.0.0.1:8108/users/7");
+  CHECK(data.resp_body == "user 7");
+  data = client.get("http://127.0.0.1:8108/users/7/files/a/b?x=1");
+  CHECK(data.resp_body == "7:a/b");
+  data = client.get("http://127.0.0.1:8108/api/v1/items");
+  CHECK(data.resp_body == "api");
+  // only a prefix matches a wildcard route
+  data = client.get("http://127.0.0.1:8108/v1/api/items");
+  CHECK(data.resp_body != "api");
+
+  server.stop();
+  server_thread.join();
+}
+
+template <size_t I>
+constexpr auto numbered_path() {
+  char path[] = "/n/000";
+  path[3] = char('0' + I / 100);
+  path[4] = char('0' + I / 10 % 10);
+  path[5] = char('0' + I % 10);
+  return route_path<sizeof(path)>(path);
+}
+
+template <size_t... Is>
+auto make_numbered_routes(std::index_sequence<Is...>) {
+  return make_routes(route<numbered_path<Is>(), GET>(
+      [](request &, response &res) {
+        res.set_status_and_content(status_type::ok, std::to_string(Is));
+      })...);
+}
+
+TEST_CASE("test route table") {
+  auto numbered = make_numbered_routes(std::make_index_sequence<64>{});
+  static_assert(decltype(numbered)::size() == 64);
+
+  http_server server(1);
+  server.set_route_table(make_routes(
+      route<"/plaintext", GET>([](request &, response &res) {
+        res.set_status_and_content(status_type::ok, "Hello, World!");
+      }),
+      route<"/echo", GET, POST>([](request &req, response &res) {
+        res.set_status_and_content(status_type::ok,
+                                   std::string(req.get_method()));
+      }),
+      route<"/lazy", GET>(
+          [](request &, response &res) -> async_simple::coro::Lazy<void> {
+            co_await async_simple::coro::Yield{};
+            res.set_status_and_content(status_type::ok, "lazy");
+          })));
+  // the router still serves what the table doesn't have
+  server.set_http_handler<GET>("/users/:id", [](request &req, response &res) {
+    res.set_status_and_content(status_type::ok,
+                               std::string(req.get_path_param("id")));
+  });
+  bool r = server.listen("0.0.0.0", "8109");
+  if (!r) {
+    std::cout << "listen failed."
+              << "\n";
+  }
+
+  std::promise<void> pr;
+  std::future<void> f = pr.get_future();
+  std::thread server_thread([&server, &pr]() {
+    pr.set_value();
+    server.run();
+  });
+  f.wait();
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  coro_http_client client{};
+  auto data = client.get("http://127.0.0.1:8109/plaintext");
+  CHECK(data.resp_body == "Hello, World!");
+  data = client.get("http://127.0.0.1:8109/echo");
+  CHECK(data.resp_body == "GET");
+  data = client.post("http://127.0.0.1:8109/echo", "", req_content_type::string);
+  CHECK(data.resp_body == "POST");
+  data = client.get("http://127.0.0.1:8109/lazy");
+  CHECK(data.resp_body == "lazy");
+  data = client.get("http://127.0.0.1:8109/users/5");
+  CHECK(data.resp_body == "5");
+  data = client.post("http://127.0.0.1:8109/plaintext", "",
+                     req_content_type::string);
+  CHECK(data.resp_body != "Hello, World!");
+
+  server.stop();
+  server_thread.join();
+
+  std::string path = "/n/063";
+  // dispatch only touches request and response in the handler
+  response res;
+  request req(res);
+  CHECK(numbered.dispatch("GET", path, req, res));
+  CHECK(res.has_response());
+  CHECK(!numbered.dispatch("POST", path, req, res));
+  CHECK(!numbered.dispatch("GET", "/n/064", req, res));
+  CHECK(!numbered.dispatch("GET", "/n/12", req, res));
+}
+
+TEST_CASE("test route updates while serving") {
+  http_server server(2);
+  server.set_http_handler<GET>("/stable", [](request &, response &res) {
+    res.set_status_and_content(status_type::ok, "stable");
+  });
+  bool r = server.listen("0.0.0.0", "8110");
+  if (!r) {
+    std::cout << "listen failed."
+              << "\n";
+  }
+
+  std::promise<void> pr;
+  std::future<void> f = pr.get_future();
+  std::thread server_thread([&server, &pr]() {
+    pr.set_value();
+    server.run();
+  });
+  f.wait();
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  std::atomic<bool> done = false;
+  std::atomic<size_t> stable_ok = 0, stable_bad = 0, feature_ok = 0;
+  std::vector<std::thread> clients;
+  for (int i = 0; i < 2; ++i) {
+    clients.emplace_back([&] {
+      coro_http_client client{};
+      while (!done) {
+        auto data = client.get("http://127.0.0.1:8110/stable");
+        (data.resp_body == "stable" ? stable_ok : stable_bad)++;
+        data = client.get("http://127.0.0.1:8110/feature/1");
+        if (data.resp_body == "feature 1") {
+          ++feature_ok;
+        }
+      }
+    });
+  }
+
+  // the routes change under the requests
+  for (int i = 0; i < 200; ++i) {
+    server.set_http_handler<GET>(
+        "/feature/:id", [](request &req, response &res) {
+          res.set_status_and_content(
+              status_type::ok,
+              "feature " + std::string(req.get_path_param("id")));
+        });
+    std::this_thread::sleep_for(std::chrono::microseconds(200));
+    server.remove_http_handler<GET>("/feature/:id");
+  }
+  server.set_http_handler<GET>("/feature/:id", [](request &req, response &res) {
+    res.set_status_and_content(
+        status_type::ok, "feature " + std::string(req.get_path_param("id")));
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  done = true;
+  for (auto &t : clients) {
+    t.join();
+  }
+  CHECK(stable_ok > 0);
+  CHECK(stable_bad == 0);
+  CHECK(feature_ok > 0);
+
+  coro_http_client client{};
+  server.remove_http_handler<GET>("/feature/:id");
+  auto data = client.get("http://127.0.0.1:8110/feature/1");
+  CHECK(data.resp_body != "feature 1");
+
+  // so do stream_body routes
+  size_t pieces = 0;
+  server.set_http_handler<POST>(
+      "/upload",
+      [&pieces](request &req, response &res) {
+        if (req.get_state() == data_proc_state::data_continue) {
+          ++pieces;
+        }
+        else if (req.get_state() == data_proc_state::data_end) {
+          res.set_status_and_content(status_type::ok, "streamed");
+        }
+      },
+      stream_body{});
+  data = client.post("http://127.0.0.1:8110/upload", "abc",
+                     req_content_type::string);
+  CHECK(data.resp_body == "streamed");
+  CHECK(pieces > 0);
+  server.remove_http_handler<POST>("/upload");
+  size_t calls = 0;
+  server.set_http_handler<POST>(
+      "/upload", [&calls](request &req, response &res) {
+        ++calls;
+        res.set_status_and_content(status_type::ok, std::string(req.body()));
+      });
+  data = client.post("http://127.0.0.1:8110/upload", "abc",
+                     req_content_type::string);
+  CHECK(data.resp_body == "abc");
+  CHECK(calls == 1);
+
+  server.stop();
+  server_thread.join();
+}
+
+TEST_CASE("test stop closes the connections of every io_context") {
+  http_server server(2);
+  std::mutex mtx;
+  std::set<std::thread::id> threads;
+  server.set_http_handler<GET>("/", [&](request &, response &res) {
+    {
+      std::lock_guard lock(mtx);
+      threads.insert(std::this_thread::get_id());
+    }
+    res.set_status_and_content(status_type::ok, "hello");
+  });
+  std::promise<void> release;
+  std::shared_future<void> released = release.get_future().share();
+  server.set_http_handler<GET>("/block", [released](request &, response &res) {
+    released.wait();
+    res.set_status_and_content(status_type::ok, "late");
+  });
+  bool r = server.listen("0.0.0.0", "8111");
+  if (!r) {
+    std::cout << "listen failed."
+              << "\n";
+  }
+
+  std::promise<void> pr;
+  std::future<void> f = pr.get_future();
+  std::thread server_thread([&server, &pr]() {
+    pr.set_value();
+    server.run();
+  });
+  f.wait();
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  asio::io_context ioc;
+  auto endpoint = asio::ip::tcp::endpoint(
+      asio::ip::address::from_string("127.0.0.1"), 8111);
+  std::vector<std::unique_ptr<asio::ip::tcp::socket>> sockets;
+  auto connect = [&] {
+    auto &socket =
+        sockets.emplace_back(std::make_unique<asio::ip::tcp::socket>(ioc));
+    std::error_code ec;
+    socket->connect(endpoint, ec);
+    REQUIRE(!ec);
+    return socket.get();
+  };
+
+  // keep-alive connections spread over both io_contexts
+  for (int i = 0; i < 4; ++i) {
+    auto socket = connect();
+    std::error_code ec;
+    asio::write(*socket, asio::buffer(std::string("GET / HTTP/1.1\r\n\r\n")),
+                ec);
+    REQUIRE(!ec);
+    std::string buf;
+    http_parser parser;
+    char tmp[1024];
+    while (true) {
+      size_t n = socket->read_some(asio::buffer(tmp), ec);
+      REQUIRE(!ec);
+      buf.append(tmp, n);
+      int ret = parser.parse_response(buf.data(), buf.size(), 0);
+      if (ret >= 0 && size_t(parser.total_len()) <= buf.size()) {
+        break;
+      }
+    }
+    CHECK(parser.status() == 200);
+  }
+  CHECK(threads.size() == 2);
+
+  // one io thread is held by a handler while the server stops, the
+  // connections accepted for it meanwhile are registered after stop()
+  std::error_code ec;
+  asio::write(*connect(),
+              asio::buffer(std::string("GET /block HTTP/1.1\r\n\r\n")), ec);
+  REQUIRE(!ec);
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  connect();
+  connect();
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+  std::thread releaser([&release] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    release.set_value();
+  });
+  server.stop();
+  server_thread.join();
+  releaser.join();
+
+  for (auto &socket : sockets) {
+    // whatever was sent before, the server closes the connection
+    char tmp[1024];
+    while (!ec) {
+      socket->read_some(asio::buffer(tmp), ec);
+    }
+    CHECK((ec == asio::error::eof || ec == asio::error::connection_reset));
+    ec.clear();
+  }
+
+  // and nothing is accepted any more
+  asio::ip::tcp::socket late(ioc);
+  late.connect(endpoint, ec);
+  CHECK(ec);
+}
+
+TEST_CASE("test stop drains the in place io_context") {
+  http_server_<NonSSL, io_service_inplace> server;
+  server.set_http_handler<GET>("/", [](request &, response &res) {
+    res.set_status_and_content(status_type::ok, "hello");
+  });
+  bool r = server.listen("0.0.0.0", "8112");
+  if (!r) {
+    std::cout << "listen failed."
+              << "\n";
+  }
+
+  std::promise<void> pr;
+  std::future<void> f = pr.get_future();
+  std::thread server_thread([&server, &pr]() {
+    pr.set_value();
+    server.run();
+  });
+  f.wait();
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  asio::io_context ioc;
+  asio::ip::tcp::socket socket(ioc);
+  std::error_code ec;
+  socket.connect(
+      asio::ip::tcp::endpoint(asio::ip::address::from_string("127.0.0.1"),
+                              8112),
+      ec);
+  REQUIRE(!ec);
+  asio::write(socket, asio::buffer(std::string("GET / HTTP/1.1\r\n\r\n")),
+              ec);
+  REQUIRE(!ec);
+  std::string buf;
+  http_parser parser;
+  char tmp[1024];
+  while (true) {
+    size_t n = socket.read_some(asio::buffer(tmp), ec);
+    REQUIRE(!ec);
+    buf.append(tmp, n);
+    int ret = parser.parse_response(buf.data(), buf.size(), 0);
+    if (ret >= 0 && size_t(parser.total_len()) <= buf.size()) {
+      break;
+    }
+  }
+  CHECK(parser.status() == 200);
+
+  // run() returns once the keep-alive connection is closed, not before
+  server.stop();
+  server_thread.join();
+  socket.non_blocking(true, ec);
+  socket.read_some(asio::buffer(tmp), ec);
+  CHECK((ec == asio::error::eof || ec == asio::error::connection_reset));
+}
+
 TEST_CASE("test conversion between unix time and gmt time, http format") {
   std::chrono::microseconds time_cost{0};
   std::ifstream file("../../tests/files_for_test_time_parse/http_times.txt");